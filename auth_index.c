@@ -0,0 +1,318 @@
+/*
+ * Compiler and reader for the overseer's binary authorisation index. See auth_index.h for the file layout.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "auth_index.h"
+
+/* One (card, door) permission parsed from the text file */
+typedef struct {
+    char code[AUTH_CODE_LEN];
+    uint32_t door_id;
+} auth_pair;
+
+static const char auth_magic[8] = "AUTHIDX";
+
+/* FNV-1a over the significant bytes of a card code */
+static uint64_t hash_code(const char *code)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (int i = 0; i < AUTH_CODE_LEN && code[i] != '\0'; i++) {
+        hash ^= (unsigned char)code[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+/* Nanosecond modification time, so edits within the same second are still noticed */
+static int64_t source_mtime(const struct stat *st)
+{
+    return (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+}
+
+static int compare_pairs(const void *a, const void *b)
+{
+    const auth_pair *x = a, *y = b;
+    int cmp = memcmp(x->code, y->code, AUTH_CODE_LEN);
+    if (cmp != 0) {
+        return cmp;
+    }
+    return (x->door_id > y->door_id) - (x->door_id < y->door_id);
+}
+
+/* Read every "{code} DOOR:{id} ..." line into a flat pair array */
+static auth_pair *parse_text(FILE *in, size_t *count)
+{
+    size_t len = 0, cap = 1024;
+    auth_pair *pairs = malloc(cap * sizeof(*pairs));
+    char line[4096];
+    int line_number = 0;
+
+    while (pairs != NULL && fgets(line, sizeof(line), in) != NULL) {
+        line_number++;
+        char *save = NULL;
+        char *code = strtok_r(line, " \t\r\n", &save);
+        if (code == NULL || code[0] == '#') {
+            continue;
+        }
+        if (strlen(code) > AUTH_CODE_LEN) {
+            fprintf(stderr, "auth_index: line %d: card code longer than %d characters, skipped\n", line_number, AUTH_CODE_LEN);
+            continue;
+        }
+
+        char *token;
+        while ((token = strtok_r(NULL, " \t\r\n", &save)) != NULL) {
+            char *end;
+            if (strncmp(token, "DOOR:", 5) != 0) {
+                fprintf(stderr, "auth_index: line %d: ignoring '%s'\n", line_number, token);
+                continue;
+            }
+            unsigned long door_id = strtoul(token + 5, &end, 10);
+            if (*end != '\0' || end == token + 5) {
+                fprintf(stderr, "auth_index: line %d: ignoring '%s'\n", line_number, token);
+                continue;
+            }
+            if (len == cap) {
+                cap *= 2;
+                auth_pair *grown = realloc(pairs, cap * sizeof(*pairs));
+                if (grown == NULL) {
+                    free(pairs);
+                    return NULL;
+                }
+                pairs = grown;
+            }
+            memset(pairs[len].code, 0, AUTH_CODE_LEN);
+            memcpy(pairs[len].code, code, strlen(code));
+            pairs[len].door_id = (uint32_t)door_id;
+            len++;
+        }
+    }
+    *count = len;
+    return pairs;
+}
+
+int auth_index_compile(const char *text_path, const char *index_path)
+{
+    FILE *in = fopen(text_path, "r");
+    if (in == NULL) {
+        perror("fopen(authorisation file)");
+        return -1;
+    }
+    struct stat text_stat;
+    if (fstat(fileno(in), &text_stat) == -1) {
+        perror("fstat()");
+        fclose(in);
+        return -1;
+    }
+
+    size_t pair_count;
+    auth_pair *pairs = parse_text(in, &pair_count);
+    fclose(in);
+    if (pairs == NULL) {
+        perror("malloc()");
+        return -1;
+    }
+
+    /* Sorting groups each card's doors into one run and makes duplicate lines collapse */
+    qsort(pairs, pair_count, sizeof(*pairs), compare_pairs);
+
+    uint32_t card_count = 0;
+    for (size_t i = 0; i < pair_count; i++) {
+        if (i == 0 || memcmp(pairs[i].code, pairs[i - 1].code, AUTH_CODE_LEN) != 0) {
+            card_count++;
+        }
+    }
+
+    uint32_t bucket_count = 16;
+    while (bucket_count < card_count * 2) {
+        bucket_count *= 2;
+    }
+
+    auth_bucket *buckets = calloc(bucket_count, sizeof(*buckets));
+    uint32_t *doors = malloc((pair_count ? pair_count : 1) * sizeof(*doors));
+    if (buckets == NULL || doors == NULL) {
+        perror("malloc()");
+        free(pairs);
+        free(buckets);
+        free(doors);
+        return -1;
+    }
+
+    uint32_t door_total = 0;
+    for (size_t i = 0; i < pair_count;) {
+        size_t run = i;
+        uint32_t first = door_total;
+        while (run < pair_count && memcmp(pairs[run].code, pairs[i].code, AUTH_CODE_LEN) == 0) {
+            if (run == i || pairs[run].door_id != pairs[run - 1].door_id) {
+                doors[door_total++] = pairs[run].door_id;
+            }
+            run++;
+        }
+
+        uint32_t slot = (uint32_t)hash_code(pairs[i].code) & (bucket_count - 1);
+        while (buckets[slot].code[0] != '\0') {
+            slot = (slot + 1) & (bucket_count - 1);
+        }
+        memcpy(buckets[slot].code, pairs[i].code, AUTH_CODE_LEN);
+        buckets[slot].doors_offset = first;
+        buckets[slot].door_count = door_total - first;
+        i = run;
+    }
+    free(pairs);
+
+    auth_index_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, auth_magic, sizeof(header.magic));
+    header.version = AUTH_INDEX_VERSION;
+    header.bucket_count = bucket_count;
+    header.card_count = card_count;
+    header.door_total = door_total;
+    header.source_mtime = source_mtime(&text_stat);
+    header.source_size = (int64_t)text_stat.st_size;
+
+    /* Write beside the destination and rename so readers never see a partial index */
+    char tmp_path[4096];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp.%d", index_path, (int)getpid());
+    FILE *out = fopen(tmp_path, "w");
+    int failed = out == NULL;
+    if (!failed) {
+        failed |= fwrite(&header, sizeof(header), 1, out) != 1;
+        failed |= fwrite(buckets, sizeof(*buckets), bucket_count, out) != bucket_count;
+        failed |= door_total > 0 && fwrite(doors, sizeof(*doors), door_total, out) != door_total;
+        failed |= fclose(out) != 0;
+    }
+    free(buckets);
+    free(doors);
+
+    if (failed || rename(tmp_path, index_path) == -1) {
+        perror("auth_index: writing index");
+        unlink(tmp_path);
+        return -1;
+    }
+    return 0;
+}
+
+int auth_index_open(const char *index_path, auth_index *idx)
+{
+    int fd = open(index_path, O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(auth_index_header)) {
+        close(fd);
+        return -1;
+    }
+
+    /* Populate up front so the first lookups do not take page faults */
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("mmap()");
+        return -1;
+    }
+
+    const auth_index_header *header = map;
+    size_t expected = sizeof(*header) + (size_t)header->bucket_count * sizeof(auth_bucket) + (size_t)header->door_total * sizeof(uint32_t);
+    if (memcmp(header->magic, auth_magic, sizeof(header->magic)) != 0 || header->version != AUTH_INDEX_VERSION
+        || header->bucket_count == 0 || (header->bucket_count & (header->bucket_count - 1)) != 0
+        || header->card_count >= header->bucket_count || expected != (size_t)st.st_size) {
+        fprintf(stderr, "auth_index: %s is not a valid index\n", index_path);
+        munmap(map, st.st_size);
+        return -1;
+    }
+
+    /* every door run has to lie inside the door id array, or a lookup would read past the end of the map, and at
+     * least one bucket has to be empty, or the probe for an absent card would never end. card_count in the header
+     * is not trusted for that: it may not match the buckets */
+    const auth_bucket *buckets = (const auth_bucket *)(header + 1);
+    uint32_t empty = 0;
+    for (uint32_t i = 0; i < header->bucket_count; i++) {
+        if (buckets[i].doors_offset > header->door_total || buckets[i].door_count > header->door_total - buckets[i].doors_offset) {
+            fprintf(stderr, "auth_index: %s has a door list outside the index\n", index_path);
+            munmap(map, st.st_size);
+            return -1;
+        }
+        empty += buckets[i].code[0] == '\0';
+    }
+    if (empty == 0) {
+        fprintf(stderr, "auth_index: %s has no empty bucket\n", index_path);
+        munmap(map, st.st_size);
+        return -1;
+    }
+
+    idx->map = map;
+    idx->size = st.st_size;
+    idx->header = header;
+    idx->buckets = (const auth_bucket *)(header + 1);
+    idx->doors = (const uint32_t *)(idx->buckets + header->bucket_count);
+    return 0;
+}
+
+void auth_index_close(auth_index *idx)
+{
+    if (idx->map != NULL) {
+        munmap(idx->map, idx->size);
+    }
+    memset(idx, 0, sizeof(*idx));
+}
+
+int auth_index_is_current(const char *text_path, const char *index_path)
+{
+    struct stat text_stat;
+    if (stat(text_path, &text_stat) == -1) {
+        return 0;
+    }
+    /* only the header is needed; mapping and populating the whole index here would be wasted work */
+    int fd = open(index_path, O_RDONLY);
+    if (fd == -1) {
+        return 0;
+    }
+    auth_index_header header;
+    ssize_t n = pread(fd, &header, sizeof(header), 0);
+    close(fd);
+    return n == (ssize_t)sizeof(header) && memcmp(header.magic, auth_magic, sizeof(header.magic)) == 0
+        && header.version == AUTH_INDEX_VERSION && header.source_mtime == source_mtime(&text_stat)
+        && header.source_size == (int64_t)text_stat.st_size;
+}
+
+int auth_index_allows(const auth_index *idx, const char *code, uint32_t door_id)
+{
+    size_t len = strnlen(code, AUTH_CODE_LEN + 1);
+    if (len == 0 || len > AUTH_CODE_LEN) {
+        return 0;
+    }
+
+    uint32_t mask = idx->header->bucket_count - 1;
+    for (uint32_t slot = (uint32_t)hash_code(code) & mask;; slot = (slot + 1) & mask) {
+        const auth_bucket *bucket = &idx->buckets[slot];
+        if (bucket->code[0] == '\0') {
+            return 0;
+        }
+        if (strncmp(bucket->code, code, AUTH_CODE_LEN) != 0) {
+            continue;
+        }
+
+        /* doors are sorted; cards rarely have more than a handful */
+        const uint32_t *doors = idx->doors + bucket->doors_offset;
+        uint32_t lo = 0, hi = bucket->door_count;
+        while (lo < hi) {
+            uint32_t mid = (lo + hi) / 2;
+            if (doors[mid] == door_id) {
+                return 1;
+            }
+            if (doors[mid] < door_id) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        return 0;
+    }
+}
@@ -0,0 +1,60 @@
+/*
+ * Precompiled authorisation index used by the overseer.
+ *
+ * The text authorisation file has one card per line: "{card code} DOOR:{id} DOOR:{id} ...".
+ * auth_index_compile() turns it into a flat binary file holding an open-addressing hash table of card codes,
+ * each pointing at a sorted run of permitted door ids. The overseer maps that file read-only at startup and
+ * answers each SCANNED message with a single probe sequence and no allocation.
+*/
+
+#ifndef AUTH_INDEX_H
+#define AUTH_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define AUTH_CODE_LEN 16
+#define AUTH_INDEX_VERSION 1
+
+/* On-disk header. All fields are host byte order; the index is built on the machine that uses it */
+typedef struct {
+    char magic[8];          /* "AUTHIDX" */
+    uint32_t version;
+    uint32_t bucket_count;  /* power of two, at least twice card_count */
+    uint32_t card_count;
+    uint32_t door_total;    /* length of the door id array */
+    int64_t source_mtime;   /* modification time (ns) and size of the text file this was built from */
+    int64_t source_size;
+} auth_index_header;
+
+/* Hash bucket. An empty bucket has code[0] == '\0' */
+typedef struct {
+    char code[AUTH_CODE_LEN];   /* not NUL terminated when the code is exactly AUTH_CODE_LEN long */
+    uint32_t doors_offset;      /* first permitted door in the door id array */
+    uint32_t door_count;
+} auth_bucket;
+
+/* A mapped index */
+typedef struct {
+    void *map;
+    size_t size;
+    const auth_index_header *header;
+    const auth_bucket *buckets;
+    const uint32_t *doors;
+} auth_index;
+
+/* Build index_path from text_path. Writes to a temporary file and renames it into place. Returns 0 or -1 */
+int auth_index_compile(const char *text_path, const char *index_path);
+
+/* Map an index. Returns 0, or -1 if the file is missing or malformed */
+int auth_index_open(const char *index_path, auth_index *idx);
+
+void auth_index_close(auth_index *idx);
+
+/* Returns 1 if index_path exists and was built from the current contents of text_path */
+int auth_index_is_current(const char *text_path, const char *index_path);
+
+/* Returns 1 if the card may open the door, 0 otherwise */
+int auth_index_allows(const auth_index *idx, const char *code, uint32_t door_id);
+
+#endif
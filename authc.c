@@ -0,0 +1,117 @@
+/*
+ * Build step for the overseer's authorisation index.
+ * Compiles a text authorisation file into the binary hash index that the overseer maps at startup, and
+ * optionally benchmarks lookups against the result.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "auth_index.h"
+
+#define BENCH_MISSES 16
+
+/* Returns 1 if code is one of the index's cards */
+static int card_present(const auth_index *idx, const char *code)
+{
+    for (uint32_t i = 0; i < idx->header->bucket_count; i++) {
+        if (strncmp(idx->buckets[i].code, code, AUTH_CODE_LEN) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Time random hits and misses against a mapped index and print lookups/sec */
+static void benchmark(const auth_index *idx, long lookups)
+{
+    const auth_bucket *buckets = idx->buckets;
+    uint32_t bucket_count = idx->header->bucket_count;
+
+    /* sample card codes straight out of the table, with one of their doors */
+    uint32_t sample_cap = idx->header->card_count < 65536 ? idx->header->card_count : 65536;
+    if (sample_cap == 0) {
+        fprintf(stderr, "authc: index is empty, nothing to benchmark\n");
+        return;
+    }
+    char (*codes)[AUTH_CODE_LEN + 1] = malloc(sample_cap * sizeof(*codes));
+    uint32_t *door_ids = malloc(sample_cap * sizeof(*door_ids));
+    if (codes == NULL || door_ids == NULL) {
+        perror("malloc()");
+        exit(1);
+    }
+    uint32_t samples = 0;
+    for (uint32_t i = 0; i < bucket_count && samples < sample_cap; i++) {
+        if (buckets[i].code[0] != '\0' && buckets[i].door_count > 0) {
+            memcpy(codes[samples], buckets[i].code, AUTH_CODE_LEN);
+            codes[samples][AUTH_CODE_LEN] = '\0';
+            door_ids[samples] = idx->doors[buckets[i].doors_offset];
+            samples++;
+        }
+    }
+
+    /* random card codes checked to be absent, so the misses really do probe to an empty bucket */
+    unsigned int seed = 12345;
+    char misses[BENCH_MISSES][AUTH_CODE_LEN + 1];
+    for (int i = 0; i < BENCH_MISSES; i++) {
+        do {
+            snprintf(misses[i], sizeof(misses[i]), "%08x%08x", (unsigned)rand_r(&seed), (unsigned)rand_r(&seed));
+        } while (card_present(idx, misses[i]));
+    }
+
+    struct timespec start, end;
+    long allowed = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (long i = 0; i < lookups; i++) {
+        uint32_t pick = rand_r(&seed) % samples;
+        /* every other lookup asks for a door the card has not been granted, or an unknown card */
+        if (i & 1) {
+            allowed += auth_index_allows(idx, codes[pick], door_ids[pick]);
+        } else if (i & 2) {
+            allowed += auth_index_allows(idx, codes[pick], door_ids[pick] + 1000000);
+        } else {
+            allowed += auth_index_allows(idx, misses[pick % BENCH_MISSES], door_ids[pick]);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("authc: %ld lookups (%ld allowed) in %.3fs, %.0f lookups/sec, %.1f ns/lookup\n",
+           lookups, allowed, seconds, lookups / seconds, seconds * 1e9 / lookups);
+
+    free(codes);
+    free(door_ids);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 3 && !(argc == 5 && strcmp(argv[3], "--bench") == 0)) {
+        fprintf(stderr, "usage: authc {authorisation file} {index file} [--bench {lookups}]\n");
+        exit(1);
+    }
+    const char *text_path = argv[1];
+    const char *index_path = argv[2];
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (auth_index_compile(text_path, index_path) == -1) {
+        exit(1);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    auth_index idx;
+    if (auth_index_open(index_path, &idx) == -1) {
+        fprintf(stderr, "authc: cannot open %s after building it\n", index_path);
+        exit(1);
+    }
+    printf("authc: %u cards, %u door grants, %u buckets, %zu bytes mapped, built in %.1fms\n",
+           idx.header->card_count, idx.header->door_total, idx.header->bucket_count, idx.size,
+           (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6);
+
+    if (argc == 5) {
+        benchmark(&idx, atol(argv[4]));
+    }
+    auth_index_close(&idx);
+    return 0;
+}
@@ -7,13 +7,21 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
-#include <arpa/inet.h>
 #include <netinet/in.h>
 #include "tcp_communication.h"
 
 #define BUFFER_SIZE 16
-#define RECEIVED_BUFFER_SIZE 1024
+#define CONNECT_TIMEOUT 1000 // milliseconds, when no {wait time} bounds it
+#define MAX_IN_FLIGHT 32
+#define RECONNECT_MIN_DELAY 50000   // microseconds
+#define RECONNECT_MAX_DELAY 1000000 // microseconds
+#define DECISION_CACHE_SIZE 256
+#define DECISION_CACHE_BUCKETS 512
 
 
 const char programName[] = "cardreader";
@@ -28,7 +36,431 @@ typedef struct {
     pthread_cond_t response_cond;
 } shm_cardreader;
 
-int main(int argc, char **argv) 
+// A scan that has been sent to the overseer and not yet answered
+typedef struct {
+    unsigned int seq; // 0 when the slot is free
+    long long deadline; // monotonic microseconds; answered from the cache or denied after this
+    char code[BUFFER_SIZE + 1];
+} pending_scan;
+
+// Recently seen decision, kept in an LRU list threaded through a fixed array
+typedef struct {
+    char code[BUFFER_SIZE + 1];
+    char response; // 'Y' or 'N'
+    int prev, next; // LRU neighbours, -1 at either end
+    int chain; // next entry in the same hash bucket + 1, 0 at the end
+} cache_entry;
+
+// Connection to the overseer, shared by the main thread (sending scans) and the I/O thread (connecting and reading)
+static int id;
+static int waitTime;
+static struct sockaddr_in overseerAddr;
+static shm_cardreader *shared;
+static int wakeFd; // eventfd used by the main thread to wake the I/O thread when a new scan has a deadline
+
+static pthread_mutex_t connMutex = PTHREAD_MUTEX_INITIALIZER;
+static tcp_conn *overseerConn; // NULL while disconnected
+static unsigned int nextSeq = 1;
+static pending_scan inFlight[MAX_IN_FLIGHT];
+
+// Decision cache. Only touched by the I/O thread, so it needs no lock
+static cache_entry cache[DECISION_CACHE_SIZE];
+static int cacheBuckets[DECISION_CACHE_BUCKETS]; // first entry in the bucket + 1, 0 when empty
+static int cacheHead = -1, cacheTail = -1, cacheUsed = 0;
+
+static long long nowUsec()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/***********************************
+LRU cache of ALLOWED/DENIED decisions
+***********************************/
+static unsigned int cacheBucket(const char *code)
+{
+    unsigned int hash = 2166136261u;
+    for (int i = 0; i < BUFFER_SIZE && code[i] != '\0'; i++) {
+        hash = (hash ^ (unsigned char)code[i]) * 16777619u;
+    }
+    return hash % DECISION_CACHE_BUCKETS;
+}
+
+static void cacheUnlink(int e)
+{
+    if (cache[e].prev != -1) {
+        cache[cache[e].prev].next = cache[e].next;
+    } else {
+        cacheHead = cache[e].next;
+    }
+    if (cache[e].next != -1) {
+        cache[cache[e].next].prev = cache[e].prev;
+    } else {
+        cacheTail = cache[e].prev;
+    }
+}
+
+static void cachePushFront(int e)
+{
+    cache[e].prev = -1;
+    cache[e].next = cacheHead;
+    if (cacheHead != -1) {
+        cache[cacheHead].prev = e;
+    }
+    cacheHead = e;
+    if (cacheTail == -1) {
+        cacheTail = e;
+    }
+}
+
+static int cacheFind(const char *code)
+{
+    for (int e = cacheBuckets[cacheBucket(code)] - 1; e != -1; e = cache[e].chain - 1) {
+        if (strcmp(cache[e].code, code) == 0) {
+            return e;
+        }
+    }
+    return -1;
+}
+
+// Remove an entry from its hash chain and the LRU list
+static void cacheRemove(int e)
+{
+    int *link = &cacheBuckets[cacheBucket(cache[e].code)];
+    while (*link - 1 != e) {
+        link = &cache[*link - 1].chain;
+    }
+    *link = cache[e].chain;
+    cacheUnlink(e);
+}
+
+// Returns the cached response for a card, or '\0' if there is none. A hit becomes most recently used
+static char cacheLookup(const char *code)
+{
+    int e = cacheFind(code);
+    if (e == -1) {
+        return '\0';
+    }
+    cacheUnlink(e);
+    cachePushFront(e);
+    return cache[e].response;
+}
+
+// Record a decision, evicting the least recently used entry when the cache is full
+static void cacheStore(const char *code, char response)
+{
+    int e = cacheFind(code);
+    if (e != -1) {
+        cacheUnlink(e);
+    } else {
+        if (cacheUsed < DECISION_CACHE_SIZE) {
+            e = cacheUsed++;
+        } else {
+            e = cacheTail;
+            cacheRemove(e);
+        }
+        snprintf(cache[e].code, sizeof(cache[e].code), "%s", code);
+        unsigned int bucket = cacheBucket(code);
+        cache[e].chain = cacheBuckets[bucket];
+        cacheBuckets[bucket] = e + 1;
+    }
+    cache[e].response = response;
+    cachePushFront(e);
+}
+
+// INVALIDATE# from the overseer empties the cache; INVALIDATE {code}# drops a single card
+static void cacheInvalidate(const char *code)
+{
+    if (code == NULL) {
+        memset(cacheBuckets, 0, sizeof(cacheBuckets));
+        cacheHead = cacheTail = -1;
+        cacheUsed = 0;
+        return;
+    }
+    int e = cacheFind(code);
+    if (e != -1) {
+        // keep the array dense by moving the last entry into the freed slot
+        cacheRemove(e);
+        int last = --cacheUsed;
+        if (e != last) {
+            cacheRemove(last);
+            cache[e] = cache[last];
+            unsigned int bucket = cacheBucket(cache[e].code);
+            cache[e].chain = cacheBuckets[bucket];
+            cacheBuckets[bucket] = e + 1;
+            cachePushFront(e);
+        }
+    }
+}
+
+/*********************
+Overseer communication
+*********************/
+
+// Queue one scan request and push it out without blocking. Caller holds connMutex
+static void sendScan(const pending_scan *scan)
+{
+    if (overseerConn == NULL) {
+        return; // the I/O thread resends everything in flight once it reconnects
+    }
+    char scannedMessage[64];
+    int len = snprintf(scannedMessage, sizeof(scannedMessage), "CARDREADER %d SCANNED %s %u#", id, scan->code, scan->seq);
+    if (tcp_conn_queue(overseerConn, scannedMessage, len) == -1 || tcp_conn_flush(overseerConn) == -1) {
+        // wake the I/O thread so it notices the broken connection and reconnects
+        shutdown(overseerConn->fd, SHUT_RDWR);
+    }
+}
+
+// Start a non-blocking connection to the overseer. Returns the connection, usually still in progress, or NULL
+static tcp_conn *startConnect()
+{
+    int sockfd = tcp_connect_start(&overseerAddr);
+    if (sockfd == -1) {
+        return NULL;
+    }
+    tcp_conn *conn = tcp_conn_new(sockfd);
+    if (conn == NULL) {
+        close(sockfd);
+    }
+    return conn;
+}
+
+// Once the socket is writable, check the connect went through and introduce this card reader. Returns 0 or -1
+static int finishConnect(tcp_conn *conn)
+{
+    if (tcp_connect_finish(conn->fd) == -1) {
+        return -1;
+    }
+
+    // Initialisation message to overseer
+    char helloMessage[50];
+    int len = snprintf(helloMessage, sizeof(helloMessage), "CARDREADER %d HELLO#", id);
+    if (tcp_conn_queue(conn, helloMessage, len) == -1 || tcp_conn_flush(conn) == -1) {
+        return -1;
+    }
+    return 0;
+}
+
+// Give the simulator its answer
+static void respond(char response)
+{
+    pthread_mutex_lock(&shared->mutex);
+    shared->response = response;
+    pthread_cond_signal(&shared->response_cond);
+    pthread_mutex_unlock(&shared->mutex);
+}
+
+// Hand a decision for an in-flight scan to the simulator and remember it. Replies for unknown sequence numbers
+// are stale (already answered from the cache or denied at the deadline) and dropped
+static void deliverReply(unsigned int seq, char response)
+{
+    char code[BUFFER_SIZE + 1];
+    int found = 0;
+    pthread_mutex_lock(&connMutex);
+    for (int i = 0; i < MAX_IN_FLIGHT; i++) {
+        if (inFlight[i].seq == seq) {
+            inFlight[i].seq = 0;
+            memcpy(code, inFlight[i].code, sizeof(code));
+            found = 1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&connMutex);
+    if (!found) {
+        return;
+    }
+    cacheStore(code, response);
+    respond(response);
+}
+
+// Answer every scan whose deadline has passed from the cache, or deny it. Returns microseconds until the next
+// deadline, or -1 if nothing is waiting
+static long long expireScans()
+{
+    char responses[MAX_IN_FLIGHT];
+    char codes[MAX_IN_FLIGHT][BUFFER_SIZE + 1];
+    int expired = 0;
+    long long now = nowUsec(), next = -1;
+
+    pthread_mutex_lock(&connMutex);
+    for (int i = 0; i < MAX_IN_FLIGHT; i++) {
+        if (inFlight[i].seq == 0 || waitTime <= 0) {
+            continue;
+        }
+        if (inFlight[i].deadline <= now) {
+            memcpy(codes[expired++], inFlight[i].code, BUFFER_SIZE + 1);
+            inFlight[i].seq = 0;
+        } else if (next == -1 || inFlight[i].deadline - now < next) {
+            next = inFlight[i].deadline - now;
+        }
+    }
+    pthread_mutex_unlock(&connMutex);
+
+    for (int i = 0; i < expired; i++) {
+        responses[i] = cacheLookup(codes[i]);
+        respond(responses[i] == 'Y' ? 'Y' : 'N');
+    }
+    return next;
+}
+
+// Parse "ALLOWED <seq>", "DENIED <seq>" and "INVALIDATE [<code>]" frames (already stripped of '#')
+static void handleReply(const char *frame)
+{
+    unsigned int seq;
+    char code[BUFFER_SIZE + 1];
+    if (sscanf(frame, "ALLOWED %u", &seq) == 1) {
+        deliverReply(seq, 'Y');
+    } else if (sscanf(frame, "DENIED %u", &seq) == 1) {
+        deliverReply(seq, 'N');
+    } else if (sscanf(frame, "INVALIDATE %16s", code) == 1) {
+        cacheInvalidate(code);
+    } else if (strcmp(frame, "INVALIDATE") == 0) {
+        cacheInvalidate(NULL);
+    }
+}
+
+/**************************************************
+I/O thread: keeps one connection to the overseer open,
+reconnects with backoff, reads replies and enforces the
+per-scan deadline
+**************************************************/
+static void *overseerIoThread(void *unused)
+{
+    (void)unused;
+    tcp_conn *conn = NULL;
+    int connecting = 0; // conn is a connect still in progress, polled for POLLOUT
+    long long connectDeadline = 0;
+    int reconnectDelay = RECONNECT_MIN_DELAY;
+    long long nextAttempt = 0;
+
+    // bound each connect so an unreachable overseer is retried with backoff
+    long long connectTimeout = waitTime > 0 ? waitTime : CONNECT_TIMEOUT * 1000LL;
+
+    for (;;) {
+        if (conn == NULL && nowUsec() >= nextAttempt) {
+            conn = startConnect();
+            if (conn == NULL) {
+                nextAttempt = nowUsec() + reconnectDelay;
+                reconnectDelay = reconnectDelay * 2 > RECONNECT_MAX_DELAY ? RECONNECT_MAX_DELAY : reconnectDelay * 2;
+            } else {
+                connecting = 1;
+                connectDeadline = nowUsec() + connectTimeout;
+            }
+        }
+
+        // sleep until a reply arrives, a new scan is queued, a deadline passes, the connect completes or times out,
+        // or it is time to reconnect. Deadlines keep being enforced while a connect is in flight
+        long long timeout = expireScans();
+        long long wake = -1;
+        if (conn == NULL) {
+            wake = nextAttempt;
+        } else if (connecting) {
+            wake = connectDeadline;
+        }
+        if (wake != -1) {
+            long long untilWake = wake - nowUsec();
+            if (untilWake < 0) {
+                untilWake = 0;
+            }
+            if (timeout == -1 || untilWake < timeout) {
+                timeout = untilWake;
+            }
+        }
+        struct pollfd fds[2] = { { .fd = wakeFd, .events = POLLIN }, { .fd = -1, .events = POLLIN } };
+        if (conn != NULL) {
+            fds[1].fd = conn->fd;
+            if (connecting) {
+                fds[1].events = POLLOUT;
+            } else {
+                pthread_mutex_lock(&connMutex);
+                if (tcp_conn_pending(conn) > 0) {
+                    fds[1].events |= POLLOUT;
+                }
+                pthread_mutex_unlock(&connMutex);
+            }
+        }
+        int ready = poll(fds, 2, timeout == -1 ? -1 : (int)((timeout + 999) / 1000));
+        if (ready < 0) {
+            continue;
+        }
+        if (fds[0].revents & POLLIN) {
+            uint64_t count;
+            if (read(wakeFd, &count, sizeof(count)) < 0) {
+                perror("read(eventfd)");
+            }
+        }
+        if (conn == NULL) {
+            continue;
+        }
+
+        int broken = 0;
+        if (connecting) {
+            if (fds[1].revents & (POLLOUT | POLLHUP | POLLERR)) {
+                if (finishConnect(conn) == -1) {
+                    broken = 1;
+                } else {
+                    connecting = 0;
+                    reconnectDelay = RECONNECT_MIN_DELAY;
+
+                    // decisions cached before the outage may be stale, and an INVALIDATE sent while the
+                    // connection was down never arrived
+                    cacheInvalidate(NULL);
+
+                    // publish the connection and resend whatever was in flight when the last one dropped
+                    pthread_mutex_lock(&connMutex);
+                    overseerConn = conn;
+                    for (int i = 0; i < MAX_IN_FLIGHT; i++) {
+                        if (inFlight[i].seq != 0) {
+                            sendScan(&inFlight[i]);
+                        }
+                    }
+                    pthread_mutex_unlock(&connMutex);
+                }
+            } else if (nowUsec() >= connectDeadline) {
+                broken = 1;
+            }
+            if (broken) {
+                tcp_conn_free(conn);
+                conn = NULL;
+                connecting = 0;
+                nextAttempt = nowUsec() + reconnectDelay;
+                reconnectDelay = reconnectDelay * 2 > RECONNECT_MAX_DELAY ? RECONNECT_MAX_DELAY : reconnectDelay * 2;
+            }
+            continue;
+        }
+
+        if (fds[1].revents & POLLOUT) {
+            // a scan was queued while the socket was backed up
+            pthread_mutex_lock(&connMutex);
+            broken = tcp_conn_flush(conn) == -1;
+            pthread_mutex_unlock(&connMutex);
+        }
+        if (fds[1].revents & (POLLIN | POLLHUP | POLLERR)) {
+            ssize_t n = tcp_conn_fill(conn);
+            if (n > 0) {
+                char *frame;
+                while ((frame = tcp_conn_next_frame(conn)) != NULL) {
+                    handleReply(frame);
+                }
+            } else if (n == 0 || (errno != EINTR && errno != EAGAIN)) {
+                // connection closed or failed, or no frame boundary in a full ring: resynchronise by reconnecting
+                broken = 1;
+            }
+        }
+        if (broken) {
+            pthread_mutex_lock(&connMutex);
+            overseerConn = NULL;
+            pthread_mutex_unlock(&connMutex);
+            tcp_conn_free(conn);
+            conn = NULL;
+            nextAttempt = nowUsec() + reconnectDelay;
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv)
 {
     // see if enough arguments were supplied for this program
     if (argc!=6) {
@@ -37,15 +469,17 @@ int main(int argc, char **argv)
     }
 
     // intialise parameters for system by converting from char[] to int when necessary
-    const int id = atoi(argv[1]);
-    const int waitTime = atoi(argv[2]);
+    id = atoi(argv[1]);
+    waitTime = atoi(argv[2]);
     const char *shm_path = argv[3];
     const off_t shm_offset = (off_t)atoi(argv[4]);
     const char *overseer_port = argv[5]; // temporary variable type
 
-    // Isolate port number from {ipAddress : port number}
-    const char *portString= strstr(overseer_port, ":");
-    const int portNumber = atoi(portString + 1);
+    // Split {ipAddress : port number}
+    if (tcp_parse_address(overseer_port, &overseerAddr) == -1) {
+        fprintf(stderr, "overseer address should be in the format ip:port\n");
+        exit(1);
+    }
 
     /*********************************************
     Code to connect to shared memory with simulator
@@ -67,7 +501,7 @@ int main(int argc, char **argv)
         exit(1);
     }
 
-    // mmap 
+    // mmap
     char *shm = mmap(NULL, shm_stat.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
 
     if (shm == MAP_FAILED) {
@@ -75,37 +509,23 @@ int main(int argc, char **argv)
         exit(1);
     }
 
-    shm_cardreader *shared = (shm_cardreader *)(shm+shm_offset);
+    shared = (shm_cardreader *)(shm+shm_offset);
 
     /**************************
     Code to connect to overseer
     **************************/
-     // Create socket
-    int sockfd = createSocket();
-    if (sockfd == 1) {
-        printf("socket creation failed");
+    // One long-lived connection, owned by the I/O thread. It connects, sends HELLO and reconnects as needed
+    wakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (wakeFd == -1) {
+        perror("eventfd()");
         exit(1);
     }
-
-    // Define server address and port
-    struct sockaddr_in serverAddr;
-    configureServerAddressForClient(serverAddr, "127.0.0.1");
-
-    // Establish connection and corresponding error handling
-    establishConnection(sockfd, serverAddr, portNumber);
-
-    // Initialisation message to overseer
-    char helloMessage[50];
-    sprintf(helloMessage, "CARDREADER %d HELLO#", id);
-    sendData(sockfd, helloMessage);
-
-    if (shutdown(sockfd, SHUT_RDWR) < 0) {
-        perror("Error in shutting down");
-        return 1; // Return an error code if shutdown fails
+    pthread_t ioThread;
+    if (pthread_create(&ioThread, NULL, overseerIoThread, NULL) != 0) {
+        perror("pthread_create()");
+        exit(1);
     }
 
-    close(sockfd);
-
     // mutex lock for normal operation
     pthread_mutex_lock(&shared->mutex);
     //printf("\n mutex lock done\n");
@@ -113,50 +533,40 @@ int main(int argc, char **argv)
 
     for(;;) {
         if (shared->scanned[0] != '\0') {
-
-            int sockfd2 = createSocket();
-
-            // Define server address and port
-            struct sockaddr_in serverAddr;
-            configureServerAddressForClient(serverAddr, "127.0.0.1");
-
-            // Establish connection and corresponding error handling
-            establishConnection(sockfd2, serverAddr, portNumber);
-
-            // Buffer to store scanned message
-            char scannedMessage[50];
-            sprintf(scannedMessage, "CARDREADER %d SCANNED %s#", id, shared->scanned);
-            sendData(sockfd2, scannedMessage);                                          // SEND SCANNED DATA
-
-            /*****************************************
-            ACT ACCORDING TO HOW OVERSEER RESPONDS
-            //****************************************/
-
-            // Logic to recieve data
-            char receiveBuf[RECEIVED_BUFFER_SIZE];
-            int messageReceived = receiveData(sockfd2, receiveBuf);
-            // Logic to see handle error or connection close
-            if (messageReceived == -1 || messageReceived == 0) {
-                shared->response = 'N';
-            }
-
-            // Logic to process data from server
-            else {
-                receiveBuf[messageReceived] = '\0'; // Null terminate received data
-                if (strcmp(receiveBuf, "ALLOWED#") == 0) {
-                    shared->response = 'Y';
+            // Tag the scan with a sequence number and send it on the shared connection. The reply is delivered
+            // by the I/O thread, so several scans can be outstanding and the shm mutex is never held across
+            // blocking I/O. If no reply arrives within {wait time}, the I/O thread answers from its cache or denies
+            pthread_mutex_lock(&connMutex);
+            pending_scan *slot = NULL;
+            for (int i = 0; i < MAX_IN_FLIGHT; i++) {
+                if (inFlight[i].seq == 0) {
+                    slot = &inFlight[i];
+                    break;
                 }
-                else {
-                    shared->response = 'N';
+            }
+            if (slot != NULL) {
+                slot->seq = nextSeq++;
+                if (nextSeq == 0) {
+                    nextSeq = 1;
                 }
+                slot->deadline = nowUsec() + waitTime;
+                memcpy(slot->code, shared->scanned, BUFFER_SIZE);
+                slot->code[BUFFER_SIZE] = '\0';
+                sendScan(slot);
             }
-            pthread_cond_signal(&shared->response_cond);
+            pthread_mutex_unlock(&connMutex);
 
-            if (shutdown(sockfd2, SHUT_RDWR) < 0) {
-                perror("Error in shutting down");
-            return 1; // Return an error code if shutdown fails
+            // let the I/O thread pick up the new deadline
+            uint64_t one = 1;
+            if (write(wakeFd, &one, sizeof(one)) < 0) {
+                perror("write(eventfd)");
+            }
+
+            if (slot == NULL) {
+                // too many unanswered scans: fail secure
+                shared->response = 'N';
+                pthread_cond_signal(&shared->response_cond);
             }
-            close(sockfd2);
         }
         pthread_cond_wait(&shared->scanned_cond, &shared->mutex);
     }
@@ -167,7 +577,7 @@ int main(int argc, char **argv)
     if (shm_unlink(shm_path) == -1) {
         perror("shm_unlink()");
         exit(1);
-    }   
+    }
 
     if(pthread_mutex_destroy(&shared->mutex) !=0) {
         perror("pthread_mutex_destroy()");
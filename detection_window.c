@@ -0,0 +1,113 @@
+/*
+ * Sliding detection window with per-sensor deduplication. See detection_window.h.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "detection_window.h"
+
+#define WINDOW_INITIAL_CAP 1024
+
+int detection_window_init(detection_window *window, long long period_usec)
+{
+    memset(window, 0, sizeof(*window));
+    window->period = period_usec;
+    window->cap = WINDOW_INITIAL_CAP;
+    window->ring = malloc(window->cap * sizeof(*window->ring));
+    window->newest = calloc(DETECTION_SENSORS, sizeof(*window->newest));
+    window->counted = calloc(DETECTION_SENSORS, sizeof(*window->counted));
+    if (window->ring == NULL || window->newest == NULL || window->counted == NULL) {
+        perror("detection_window_init");
+        detection_window_free(window);
+        return -1;
+    }
+    return 0;
+}
+
+void detection_window_free(detection_window *window)
+{
+    free(window->ring);
+    free(window->newest);
+    free(window->counted);
+    memset(window, 0, sizeof(*window));
+}
+
+/* Drop readings that have left the period. A sensor leaves the count with its newest reading; older readings of
+ * a sensor that has reported again since are stale and just discarded */
+static void expire(detection_window *window, long long now)
+{
+    size_t mask = window->cap - 1;
+    while (window->head != window->tail && now - window->ring[window->head & mask].usec > window->period) {
+        const detection *oldest = &window->ring[window->head & mask];
+        if (window->counted[oldest->sensor] && window->newest[oldest->sensor] == oldest->usec) {
+            window->counted[oldest->sensor] = 0;
+            window->distinct--;
+        }
+        window->head++;
+    }
+}
+
+/* Double the ring, unwrapping it so head starts at index 0 */
+static int grow(detection_window *window)
+{
+    size_t count = window->tail - window->head;
+    detection *ring = malloc(window->cap * 2 * sizeof(*ring));
+    if (ring == NULL) {
+        perror("detection_window");
+        return -1;
+    }
+    for (size_t i = 0; i < count; i++) {
+        ring[i] = window->ring[(window->head + i) & (window->cap - 1)];
+    }
+    free(window->ring);
+    window->ring = ring;
+    window->cap *= 2;
+    window->head = 0;
+    window->tail = count;
+    return 0;
+}
+
+int detection_window_add(detection_window *window, uint16_t sensor, long long timestamp, long long now)
+{
+    expire(window, now);
+    if (timestamp > now) {
+        /* a sensor whose clock runs ahead would otherwise become the newest reading and push every real one a
+         * period behind it; count it as taken now */
+        timestamp = now;
+    }
+    if (now - timestamp > window->period) {
+        /* already too old to count */
+        return window->distinct;
+    }
+
+    size_t mask = window->cap - 1;
+    if (window->head != window->tail && window->ring[(window->tail - 1) & mask].usec - timestamp > window->period) {
+        /* a full period behind the newest reading, so it could never share a window with it */
+        return window->distinct;
+    }
+    if (window->tail - window->head == window->cap) {
+        if (grow(window) == -1) {
+            return window->distinct;
+        }
+        mask = window->cap - 1;
+    }
+
+    /* keep the ring in timestamp order; a late reading moves the few newer ones up by one */
+    size_t slot = window->tail;
+    while (slot != window->head && window->ring[(slot - 1) & mask].usec > timestamp) {
+        window->ring[slot & mask] = window->ring[(slot - 1) & mask];
+        slot--;
+    }
+    window->ring[slot & mask] = (detection){ .usec = timestamp, .sensor = sensor };
+    window->tail++;
+
+    if (!window->counted[sensor]) {
+        window->counted[sensor] = 1;
+        window->distinct++;
+        window->newest[sensor] = timestamp;
+    } else if (timestamp > window->newest[sensor]) {
+        window->newest[sensor] = timestamp;
+    }
+    return window->distinct;
+}
@@ -0,0 +1,45 @@
+/*
+ * Sliding detection window used by the fire alarm unit to decide when enough temperature sensors agree.
+ *
+ * Readings over the threshold are kept in a ring sorted by timestamp and expire from its head once they fall out of
+ * the detection period. A table indexed directly by sensor id holds each sensor's newest reading, so a sensor that
+ * keeps reporting counts once, and the number of distinct sensors in the window is kept up to date as readings
+ * enter and leave. Both steps are O(1) amortised for readings that arrive in timestamp order; a late reading is
+ * slotted in at its own timestamp, moving only the newer readings after it. The ring grows as needed, so there is
+ * no cap on the number of readings in a window.
+*/
+
+#ifndef DETECTION_WINDOW_H
+#define DETECTION_WINDOW_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define DETECTION_SENSORS 65536 /* every possible 16-bit sensor id */
+
+typedef struct {
+    long long usec;     /* reading timestamp */
+    uint16_t sensor;
+} detection;
+
+typedef struct {
+    detection *ring;
+    size_t head, tail;  /* monotonic; entries are ring[head & (cap - 1)] .. ring[(tail - 1) & (cap - 1)] */
+    size_t cap;         /* power of two */
+    long long *newest;  /* per sensor: timestamp of its newest reading in the window, when counted */
+    uint8_t *counted;   /* per sensor: 1 while it has a reading in the window */
+    int distinct;       /* sensors with a reading in the window */
+    long long period;   /* usec */
+} detection_window;
+
+/* Returns 0, or -1 if memory is exhausted */
+int detection_window_init(detection_window *window, long long period_usec);
+
+void detection_window_free(detection_window *window);
+
+/* Record a reading taken at timestamp and return the number of distinct sensors with a reading in the period
+ * ending at now. A reading stamped after now is counted as taken at now. A reading already a full period older
+ * than now, or than the newest reading in the window, is dropped without being counted */
+int detection_window_add(detection_window *window, uint16_t sensor, long long timestamp, long long now);
+
+#endif
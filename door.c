@@ -1,9 +1,22 @@
-/* 
+/*
  * This is the main executable file for a door controller in safety-critical applications.
  * It maintains the door state and ensures communication with an overseer program.
  * The controller can handle commands to open or close the door and responds with the door's current state.
+ *
+ * Connections are served from a single epoll loop. Commands that must wait for the door to finish moving
+ * (OPEN_EMERG#, CLOSE_SECURE#) park their connection instead of blocking the loop; a watcher thread waits on the
+ * shared memory cond_end and wakes the loop through an eventfd, which then completes the parked replies. STATE#
+ * is therefore answered immediately even while the door is moving.
+ *
+ * A connection is a session: it stays open for any number of '#'-terminated commands until the client closes it.
+ * Commands on one connection are answered strictly in order, so a parked command also holds back the ones
+ * pipelined behind it.
+ *
+ * The connection opened to register with the overseer is kept as a session too. Every change of door state is
+ * pushed over it as STATE {status}#, so the overseer never has to poll.
 */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <pthread.h>
@@ -13,10 +26,20 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
+#include <stdint.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
+#include "tcp_communication.h"
+
+#define OVERSEER_TIMEOUT_MSEC 1000  /* bound on connecting and registering with the overseer */
+#define LISTEN_BACKLOG 128
+#define MAX_EVENTS 64
+#define MAX_REPLY 100               /* longest reply; a session stops taking commands while less room is queued */
 
 /* Shared memory structure */
 typedef struct {
@@ -26,9 +49,285 @@ typedef struct {
     pthread_cond_t cond_end;
 } shm_door;
 
+/* Per-client state, indexed by file descriptor */
+typedef struct {
+    int fd;
+    tcp_conn *io;
+    char awaiting;          /* 'O' or 'C' while a reply waits for the door to finish moving, else '\0' */
+    const char *deferred;   /* the reply to send once it has */
+    int closing;            /* the client has finished sending; close once every reply has been written */
+    uint32_t events;        /* epoll events currently registered */
+} client;
+
+static shm_door *shared;
+static int epoll_fd;
+static int motion_fd;       /* eventfd written by the watcher thread whenever cond_end is signalled */
+static client **clients;
+static int clients_cap;
+static int awaiting_count;  /* clients parked until the door stops */
+static client *overseer_session;    /* registration connection, used to push state changes; NULL once lost */
+static char reported_status;        /* last status pushed to the overseer */
+
 /* Function to send a message over a socket */
-void send_msg(int sockfd, const char* msg) {
-    send(sockfd, msg, strlen(msg), 0);
+void send_msg(client *c, const char* msg) {
+    if (tcp_conn_queue(c->io, msg, strlen(msg)) == -1) {
+        fprintf(stderr, "door: output buffer full for fd %d, dropping reply\n", c->fd);
+    }
+}
+
+/* Bridge the shared memory condition variable into the event loop. The mutex is only released inside
+ * pthread_cond_wait, so no signal of cond_end can be missed between two waits */
+static void *motion_watcher(void *unused) {
+    (void)unused;
+    pthread_mutex_lock(&shared->mutex);
+    for (;;) {
+        pthread_cond_wait(&shared->cond_end, &shared->mutex);
+        uint64_t one = 1;
+        if (write(motion_fd, &one, sizeof(one)) < 0) {
+            perror("write(eventfd)");
+        }
+    }
+    return NULL;
+}
+
+static void watch_fd(int fd) {
+    struct epoll_event ev = { .events = EPOLLIN, .data.fd = fd };
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        perror("epoll_ctl()");
+        exit(1);
+    }
+}
+
+static void close_client(client *c) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+    if (c->awaiting) {
+        awaiting_count--;
+    }
+    if (c == overseer_session) {
+        fprintf(stderr, "door: lost the overseer connection, state changes will no longer be pushed\n");
+        overseer_session = NULL;
+    }
+    clients[c->fd] = NULL;
+    tcp_conn_free(c->io);
+    free(c);
+}
+
+/* A session takes its next command only when no reply is parked and a reply is sure to fit */
+static int ready_for_command(const client *c) {
+    return !c->awaiting && TCP_RING_SIZE - tcp_conn_pending(c->io) >= MAX_REPLY;
+}
+
+/* Write queued output and adjust the registered events: input only while the session can take a command,
+ * output only while replies are pending. Closes a finished session. Returns -1 if the client was closed */
+static int flush_client(client *c) {
+    int pending = tcp_conn_flush(c->io);
+    if (pending < 0 || (pending == 0 && c->closing && !c->awaiting)) {
+        close_client(c);
+        return -1;
+    }
+    uint32_t events = (ready_for_command(c) && !c->closing ? EPOLLIN : 0) | (pending ? EPOLLOUT : 0);
+    if (events != c->events) {
+        struct epoll_event ev = { .events = events, .data.fd = c->fd };
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+        c->events = events;
+    }
+    return 0;
+}
+
+/* Start moving the door towards target ('O' or 'C') unless it is already there or on its way. Caller holds the mutex */
+static void start_motion(char target) {
+    char moving = target == 'O' ? 'o' : 'c';
+    if (shared->status != target && shared->status != moving) {
+        shared->status = moving;
+        pthread_cond_signal(&shared->cond_start);
+    }
+}
+
+/* Reply now if the door is already in state target, otherwise park the client until it gets there */
+static void reply_when(client *c, char target, const char *msg) {
+    pthread_mutex_lock(&shared->mutex);
+    int arrived = shared->status == target;
+    pthread_mutex_unlock(&shared->mutex);
+    if (arrived) {
+        send_msg(c, msg);
+    } else {
+        c->awaiting = target;
+        c->deferred = msg;
+        awaiting_count++;
+    }
+}
+
+static void handle_command(client *c, const char *command) {
+    char response[100]; /* Buffer to hold responses to send back */
+    if (strcmp(command, "STATE") == 0) {
+        /* Query door state */
+        pthread_mutex_lock(&shared->mutex);
+        snprintf(response, sizeof(response), "STATE %c#\n", shared->status);
+        pthread_mutex_unlock(&shared->mutex);
+        send_msg(c, response);
+    } else if (strcmp(command, "OPEN") == 0) {
+        /* Open door */
+        pthread_mutex_lock(&shared->mutex);
+        shared->status = 'o';
+        pthread_cond_signal(&shared->cond_start);
+        pthread_mutex_unlock(&shared->mutex);
+        send_msg(c, "OPENING#\n");
+    } else if (strcmp(command, "CLOSE") == 0) {
+        /* Close door */
+        pthread_mutex_lock(&shared->mutex);
+        shared->status = 'c';
+        pthread_cond_signal(&shared->cond_start);
+        pthread_mutex_unlock(&shared->mutex);
+        send_msg(c, "CLOSING#\n");
+    } else if (strcmp(command, "OPEN_EMERG") == 0) {
+        /* Emergency command to forcefully open the door; answered once it is fully open */
+        pthread_mutex_lock(&shared->mutex);
+        start_motion('O');
+        pthread_mutex_unlock(&shared->mutex);
+        reply_when(c, 'O', "EMERGENCY_MODE#\n");
+    } else if (strcmp(command, "CLOSE_SECURE") == 0) {
+        /* Command to close the door securely in response to a security protocol; answered once it is fully closed */
+        pthread_mutex_lock(&shared->mutex);
+        start_motion('C');
+        pthread_mutex_unlock(&shared->mutex);
+        reply_when(c, 'C', "SECURE_MODE#\n");
+    } else {
+        /* Handle unrecognized commands */
+        fprintf(stderr, "Invalid command: %s#\n", command);
+        send_msg(c, "ERROR Invalid command#\n");
+    }
+}
+
+/* Queue STATE {status}# to the overseer if the door state has changed since the last push. Only queues; the
+ * event loop flushes the overseer session once per batch of events */
+static void push_state(void) {
+    pthread_mutex_lock(&shared->mutex);
+    char status = shared->status;
+    pthread_mutex_unlock(&shared->mutex);
+    if (status == reported_status || overseer_session == NULL) {
+        return;
+    }
+    char event[16];
+    snprintf(event, sizeof(event), "STATE %c#", status);
+    send_msg(overseer_session, event);
+    reported_status = status;
+}
+
+/* Answer every buffered command, in order, until one has to wait for the door or for output room */
+static void process_commands(client *c) {
+    char *command;
+    while (ready_for_command(c) && (command = tcp_conn_next_frame(c->io)) != NULL) {
+        handle_command(c, command);
+        push_state();
+    }
+}
+
+/* The door stopped moving: complete every reply that was waiting for its new state */
+static void handle_motion(void) {
+    uint64_t count;
+    if (read(motion_fd, &count, sizeof(count)) < 0) {
+        return;
+    }
+    push_state();
+    if (awaiting_count == 0) {
+        return;
+    }
+    pthread_mutex_lock(&shared->mutex);
+    char status = shared->status;
+    pthread_mutex_unlock(&shared->mutex);
+
+    for (int fd = 0; fd < clients_cap && awaiting_count > 0; fd++) {
+        client *c = clients[fd];
+        if (c != NULL && c->awaiting == status) {
+            c->awaiting = '\0';
+            awaiting_count--;
+            send_msg(c, c->deferred);
+            /* carry on with whatever the client pipelined behind the parked command */
+            process_commands(c);
+            flush_client(c);
+        }
+    }
+}
+
+static void handle_readable(client *c) {
+    while (ready_for_command(c) && !c->closing) {
+        ssize_t bytes = tcp_conn_fill(c->io);
+        if (bytes > 0) {
+            process_commands(c);
+        } else if (bytes == 0) {
+            /* The client has sent its last command; answer what is buffered, then close */
+            c->closing = 1;
+        } else if (errno == EAGAIN || errno == EINTR) {
+            break;
+        } else {
+            /* Connection failed, or sent a command too long to frame */
+            close_client(c);
+            return;
+        }
+    }
+    flush_client(c);
+}
+
+/* Start a session on a connected socket. Returns NULL, with the socket closed, if it cannot be tracked */
+static client *add_client(int fd) {
+    if (fd >= clients_cap) {
+        int cap = clients_cap;
+        while (cap <= fd) {
+            cap *= 2;
+        }
+        client **grown = realloc(clients, cap * sizeof(*clients));
+        if (grown == NULL) {
+            perror("realloc()");
+            close(fd);
+            return NULL;
+        }
+        memset(grown + clients_cap, 0, (cap - clients_cap) * sizeof(*clients));
+        clients = grown;
+        clients_cap = cap;
+    }
+
+    client *c = calloc(1, sizeof(*c));
+    tcp_conn *io = c ? tcp_conn_new(fd) : NULL;
+    if (io == NULL) {
+        perror("calloc()");
+        free(c);
+        close(fd);
+        return NULL;
+    }
+    c->fd = fd;
+    c->io = io;
+    c->events = EPOLLIN;
+    clients[fd] = c;
+
+    struct epoll_event ev = { .events = EPOLLIN, .data.fd = fd };
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        perror("epoll_ctl()");
+        close_client(c);
+        return NULL;
+    }
+    return c;
+}
+
+static void accept_clients(int listen_fd) {
+    for (;;) {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("accept failed");
+            }
+            return;
+        }
+
+        client *c = add_client(fd);
+        if (c == NULL) {
+            continue;
+        }
+        /* the first command usually arrives with the connection */
+        handle_readable(c);
+    }
 }
 
 int main(int argc, char **argv) {
@@ -47,20 +346,21 @@ int main(int argc, char **argv) {
     char *overseer_addr_port = argv[6];
 
     /* Socket setup for the door controller's server */
-    int sockfd = socket(AF_INET, SOCK_STREAM, 0);   /* Create a socket for communication */
+    int sockfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);   /* Create a socket for communication */
     struct sockaddr_in servaddr;
-    servaddr.sin_family = AF_INET;
-    char *token = strtok(addr_port, ":");
-    servaddr.sin_addr.s_addr = inet_addr(token);
-    token = strtok(NULL, ":");
-    servaddr.sin_port = htons(atoi(token));         /* Assign port to this socket */
+    if (tcp_parse_address(addr_port, &servaddr) == -1) {
+        fprintf(stderr, "Error: Door address should be in the format ip:port\n");
+        exit(EXIT_FAILURE);
+    }
+    int reuse = 1;
+    setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
 
     /* Binding the socket to the server address */
     if (bind(sockfd, (struct sockaddr*)&servaddr, sizeof(servaddr)) < 0) {
         perror("bind failed");
         exit(EXIT_FAILURE);
     }
-    listen(sockfd, 10);
+    listen(sockfd, LISTEN_BACKLOG);
 
     /* Shared memory initialization */
     int shm_fd = shm_open(shm_path, O_RDWR, 0);
@@ -82,158 +382,94 @@ int main(int argc, char **argv) {
         exit(1);
     }
 
-    shm_door *shared = (shm_door *)(shm + shm_offset);  /* Pointer to the shared structure */
-    shared->status = 'C';                               /* Initially, the door is considered closed */
+    shared = (shm_door *)(shm + shm_offset);   /* Pointer to the shared structure */
+    shared->status = 'C';                      /* Initially, the door is considered closed */
 
     /* Connect to overseer and send initialization message */
     struct sockaddr_in overseer_addr;
-    memset(&overseer_addr, 0, sizeof(overseer_addr));
-    overseer_addr.sin_family = AF_INET;
-
-    /* Parsing overseer IP address and port */
-    char *overseer_ip = strtok(overseer_addr_port, ":");
-    char *overseer_port_str = strtok(NULL, ":");
-    if (!overseer_ip || !overseer_port_str) {
-        perror("Error: Overseer address should be in the format ip:port\n");
-        exit(EXIT_FAILURE);
-    }
-
-    int overseer_port = atoi(overseer_port_str);
-    if (overseer_port == 0) {
-        perror("Error: Invalid port number\n");
-        exit(EXIT_FAILURE);
-    }
-
-    if (inet_pton(AF_INET, overseer_ip, &overseer_addr.sin_addr) <= 0) {
-        perror( "Invalid overseer IP address\n");
+    if (tcp_parse_address(overseer_addr_port, &overseer_addr) == -1) {
+        fprintf(stderr, "Error: Overseer address should be in the format ip:port\n");
         exit(EXIT_FAILURE);
     }
-    overseer_addr.sin_port = htons(overseer_port);
 
     /* Communication setup with the overseer */
-    int overseer_sock = socket(AF_INET, SOCK_STREAM, 0);
+    int overseer_sock = tcp_connect_timeout(&overseer_addr, OVERSEER_TIMEOUT_MSEC);
     if (overseer_sock < 0) {
-        perror("Cannot create socket");
-        exit(EXIT_FAILURE);
-    }
-
-    if (connect(overseer_sock, (struct sockaddr*)&overseer_addr, sizeof(overseer_addr)) < 0) {
         perror("Connection to overseer failed");
-        close(overseer_sock);
         exit(EXIT_FAILURE);
     }
 
     /* Send an initialization message to the overseer */
     char init_msg[100];
     snprintf(init_msg, sizeof(init_msg), "DOOR %d %s:%d %s#\n", id, inet_ntoa(servaddr.sin_addr), ntohs(servaddr.sin_port), config);
-    ssize_t send_res = send(overseer_sock, init_msg, strlen(init_msg), 0);
-    if (send_res < 0) {
+    if (tcp_send_all(overseer_sock, init_msg, strlen(init_msg), OVERSEER_TIMEOUT_MSEC) == -1) {
         perror("Failed to send initialization message");
         close(overseer_sock);
         exit(EXIT_FAILURE);
-    } 
+    }
+
+    /* Event loop setup: the listening socket and the door-motion bridge */
+    clients_cap = 64;
+    clients = calloc(clients_cap, sizeof(*clients));
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    motion_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (clients == NULL || epoll_fd < 0 || motion_fd < 0) {
+        perror("event loop setup");
+        exit(1);
+    }
+    watch_fd(sockfd);
+    watch_fd(motion_fd);
+
+    /* Keep the registration connection as a session and report the initial state over it */
+    overseer_session = add_client(overseer_sock);
+    push_state();
+
+    pthread_t watcher;
+    if (pthread_create(&watcher, NULL, motion_watcher, NULL) != 0) {
+        perror("pthread_create()");
+        exit(1);
+    }
+    pthread_detach(watcher);
 
     /* Main operational loop starts */
+    struct epoll_event events[MAX_EVENTS];
     while (1) {
-        /* Accepting a client connection */
-        struct sockaddr_in client_addr;
-        socklen_t client_len = sizeof(client_addr);
-        int client = accept(sockfd, (struct sockaddr*)&client_addr, &client_len);
-        if (client < 0) {
-            perror("accept failed");
-            printf("Error occurred while accepting connection. sockfd: %d\n", sockfd);  
-            continue;                                                                   
-        }
-
-    char buffer[100];                                               /* Buffer to store client messages */
-        int bytes = recv(client, buffer, sizeof(buffer) - 1, 0);    /* Receive data from the client socket */
-        if (bytes <= 0) {
-            /* Handle errors or connection closure */
-            if (bytes == 0) {
-                /* Connection closed */
-                perror("Client disconnected\n");
-            } else {
-                perror("recv failed");
+        int ready = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+        if (ready < 0) {
+            if (errno == EINTR) {
+                continue;
             }
-            close(client);
-            continue;
+            perror("epoll_wait()");
+            exit(1);
         }
-        buffer[bytes] = '\0'; /* Null-terminate the string */
-
-        /* Lock the mutex before accessing the shared status */
-        pthread_mutex_lock(&shared->mutex);
-        char current_status = shared->status; 
-        pthread_mutex_unlock(&shared->mutex);
 
-        /* Processing client commands and preparing a response */
-        char response[100]; /* Buffer to hold responses to send back */
-        if (strncmp(buffer, "STATE#", 6) == 0) {
-            /* Query door state */
-            pthread_mutex_lock(&shared->mutex);                 
-            snprintf(response, sizeof(response), "STATE %c#\n", shared->status);
-            pthread_mutex_unlock(&shared->mutex);               
-        } else if (strncmp(buffer, "OPEN#", 5) == 0) {
-            /* Open door */
-            pthread_mutex_lock(&shared->mutex);
-            shared->status = 'o';
-            pthread_cond_signal(&shared->cond_start);  
-            pthread_mutex_unlock(&shared->mutex);
-            strncpy(response, "OPENING#\n", sizeof(response));
-        } else if (strncmp(buffer, "CLOSE#", 6) == 0) {
-            /* Close door */
-            pthread_mutex_lock(&shared->mutex);
-            shared->status = 'c';
-            pthread_cond_signal(&shared->cond_start);  
-            pthread_mutex_unlock(&shared->mutex);
-            strncpy(response, "CLOSING#\n", sizeof(response));
-        } else if (strncmp(buffer, "OPEN_EMERG#", 11) == 0) {
-            /* Emergency command to forcefully open the door */
-            if (shared->status == 'C' || shared->status == 'c') {  
-                pthread_mutex_lock(&shared->mutex);
-
-                shared->status = 'o';  
-                pthread_cond_signal(&shared->cond_start);  
-
-                while (shared->status != 'O') {
-                    pthread_cond_wait(&shared->cond_end, &shared->mutex);  
+        for (int i = 0; i < ready; i++) {
+            int fd = events[i].data.fd;
+            if (fd == sockfd) {
+                accept_clients(sockfd);
+            } else if (fd == motion_fd) {
+                handle_motion();
+            } else if (fd < clients_cap && clients[fd] != NULL) {
+                client *c = clients[fd];
+                if (events[i].events & (EPOLLHUP | EPOLLERR)) {
+                    /* nobody is left to read the replies */
+                    close_client(c);
+                } else if (events[i].events & EPOLLIN) {
+                    handle_readable(c);
+                } else if (events[i].events & EPOLLOUT && flush_client(c) == 0) {
+                    /* room for replies again: resume commands held back by a full output ring */
+                    process_commands(c);
+                    flush_client(c);
                 }
-
-                pthread_mutex_unlock(&shared->mutex);
-                strncpy(response, "EMERGENCY_MODE#\n", sizeof(response));
-            } else if (shared->status == 'O') {
-                strncpy(response, "EMERGENCY_MODE#\n", sizeof(response));
             }
-        } else if (strncmp(buffer, "CLOSE_SECURE#", 13) == 0) {
-            /* Command to close the door securely in response to a security protocol */
-            if (shared->status == 'O' || shared->status == 'o') {  
-                pthread_mutex_lock(&shared->mutex);
-
-                shared->status = 'c';  
-                pthread_cond_signal(&shared->cond_start);  
-
-                while (shared->status != 'C') {
-                    pthread_cond_wait(&shared->cond_end, &shared->mutex); 
-                }
-
-                pthread_mutex_unlock(&shared->mutex);
-                strncpy(response, "SECURE_MODE#\n", sizeof(response));
-            } else if (shared->status == 'C') {
-                strncpy(response, "SECURE_MODE#\n", sizeof(response));
-            }   
-        } else {
-            /* Handle unrecognized commands */
-            fprintf(stderr, "Invalid command: %s\n", buffer);
-            strncpy(response, "ERROR Invalid command#\n", sizeof(response)); 
         }
-
-        send_msg(client, response);
-        /*Close the client connection after handling the request*/
-        close(client);
+        if (overseer_session != NULL && tcp_conn_pending(overseer_session->io) > 0) {
+            flush_client(overseer_session);
+        }
     }
-    
+
     /* Clean up resources */
     munmap(shm, shm_stat.st_size);
-    close(overseer_sock);
     close(shm_fd);
     return 0;
-} 
\ No newline at end of file
+}
@@ -0,0 +1,137 @@
+/*
+ * Benchmark for the door controller protocol.
+ * Sends STATE# to one door and compares commands/sec for a connection per command, one persistent session
+ * answering a command at a time, and a session with a batch of commands pipelined behind each other. Finishes by
+ * checking that pipelined commands are answered in the order they were sent.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "tcp_communication.h"
+
+#define PIPELINE_DEPTH 64
+
+static struct sockaddr_in door_addr;
+
+static double now_sec(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static int open_session(void)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (fd < 0 || connect(fd, (struct sockaddr *)&door_addr, sizeof(door_addr)) < 0) {
+        perror("door_bench: connect()");
+        exit(1);
+    }
+    return fd;
+}
+
+static void send_all(int fd, const char *data, size_t len)
+{
+    if (send(fd, data, len, MSG_NOSIGNAL) != (ssize_t)len) {
+        perror("door_bench: send()");
+        exit(1);
+    }
+}
+
+/* Read until count replies have arrived. The replies themselves are not checked here */
+static void read_replies(int fd, int count)
+{
+    char buf[4096];
+    while (count > 0) {
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n <= 0) {
+            fprintf(stderr, "door_bench: door closed the connection\n");
+            exit(1);
+        }
+        for (ssize_t i = 0; i < n; i++) {
+            count -= buf[i] == '#';
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 3) {
+        fprintf(stderr, "usage: door_bench {door address:port} {commands}\n");
+        exit(1);
+    }
+    if (tcp_parse_address(argv[1], &door_addr) < 0) {
+        fprintf(stderr, "door_bench: address should be in the format ip:port\n");
+        exit(1);
+    }
+    int commands = atoi(argv[2]);
+    if (commands < PIPELINE_DEPTH) {
+        fprintf(stderr, "door_bench: need at least %d commands\n", PIPELINE_DEPTH);
+        exit(1);
+    }
+
+    double start = now_sec();
+    for (int i = 0; i < commands; i++) {
+        int fd = open_session();
+        send_all(fd, "STATE#", 6);
+        read_replies(fd, 1);
+        close(fd);
+    }
+    printf("door_bench: connection per command: %9.0f cmds/s\n", commands / (now_sec() - start));
+
+    int fd = open_session();
+    start = now_sec();
+    for (int i = 0; i < commands; i++) {
+        send_all(fd, "STATE#", 6);
+        read_replies(fd, 1);
+    }
+    printf("door_bench: persistent session:     %9.0f cmds/s\n", commands / (now_sec() - start));
+
+    char batch[6 * PIPELINE_DEPTH];
+    for (int i = 0; i < PIPELINE_DEPTH; i++) {
+        memcpy(batch + 6 * i, "STATE#", 6);
+    }
+    int batches = commands / PIPELINE_DEPTH;
+    start = now_sec();
+    for (int i = 0; i < batches; i++) {
+        send_all(fd, batch, sizeof(batch));
+        read_replies(fd, PIPELINE_DEPTH);
+    }
+    printf("door_bench: pipelined, %d deep:     %9.0f cmds/s\n", PIPELINE_DEPTH,
+           batches * PIPELINE_DEPTH / (now_sec() - start));
+
+    /* OPEN_EMERG# parks until the door is open, and has to hold back the STATE# behind it */
+    const char mixed[] = "OPEN_EMERG#STATE#CLOSE_SECURE#STATE#";
+    const char expected[] = "EMERGENCY_MODE#STATE O#SECURE_MODE#STATE C#";
+    char replies[128];
+    size_t got = 0;
+    int hashes = 0;
+    send_all(fd, mixed, sizeof(mixed) - 1);
+    while (hashes < 4) {
+        char buf[64];
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n <= 0) {
+            break;
+        }
+        /* the door ends each reply with "#\n" */
+        for (ssize_t i = 0; i < n && got < sizeof(replies) - 1; i++) {
+            if (buf[i] != '\n') {
+                replies[got++] = buf[i];
+                hashes += buf[i] == '#';
+            }
+        }
+    }
+    replies[got] = '\0';
+    close(fd);
+    int ordered = strcmp(replies, expected) == 0;
+    printf("door_bench: pipelined %s answered %s%s\n", mixed, replies, ordered ? ", in order" : ", OUT OF ORDER");
+    return ordered ? 0 : 1;
+}
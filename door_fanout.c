@@ -0,0 +1,240 @@
+/*
+ * Concurrent command fan-out to door controllers. See door_fanout.h.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include "door_fanout.h"
+#include "tcp_communication.h"
+
+#define FANOUT_EVENTS 256
+
+typedef enum {
+    DOOR_WAITING,       /* queued for its first attempt or a retry */
+    DOOR_CONNECTING,    /* connect started, or connected with part of the command still to send */
+    DOOR_DELIVERED,
+    DOOR_FAILED
+} door_phase;
+
+typedef struct {
+    door_phase phase;
+    int fd;
+    int attempts;
+    size_t sent;            /* bytes of the command written in the current attempt */
+    long long deadline;     /* end of the current attempt, usec */
+} door_attempt;
+
+/* Attempts are queued in the order they were started or failed, and every attempt gets the same timeout and
+ * every retry the same pause, so both queues are already sorted by due time */
+typedef struct {
+    int door;
+    long long due;          /* usec; an entry is stale if the door has since moved on */
+} queue_entry;
+
+typedef struct {
+    queue_entry *entries;
+    int head, tail, cap;    /* ring of cap entries */
+} door_queue;
+
+/* State of one fan-out */
+typedef struct {
+    door_attempt *doors;
+    door_queue pending;     /* doors waiting for an attempt, by due time */
+    door_queue in_flight;   /* started attempts, by deadline */
+    int connecting;
+    int finished;
+    fanout_report *report;
+} fanout_run;
+
+static long long now_usec(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static void queue_push(door_queue *queue, int door, long long due)
+{
+    queue->entries[queue->tail % queue->cap] = (queue_entry){ .door = door, .due = due };
+    queue->tail++;
+}
+
+static int queue_empty(const door_queue *queue)
+{
+    return queue->head == queue->tail;
+}
+
+static queue_entry *queue_front(door_queue *queue)
+{
+    return &queue->entries[queue->head % queue->cap];
+}
+
+/* Close out the current attempt on door i, queueing a retry if it has attempts left */
+static void end_attempt(fanout_run *run, int i, int delivered)
+{
+    door_attempt *door = &run->doors[i];
+    close(door->fd);
+    door->fd = -1;
+    run->connecting--;
+    if (delivered) {
+        door->phase = DOOR_DELIVERED;
+        run->report->delivered++;
+        run->finished++;
+    } else if (door->attempts < FANOUT_ATTEMPTS) {
+        door->phase = DOOR_WAITING;
+        queue_push(&run->pending, i, now_usec() + FANOUT_RETRY_MSEC * 1000LL);
+    } else {
+        door->phase = DOOR_FAILED;
+        run->report->failed++;
+        run->finished++;
+    }
+}
+
+/* Simultaneous connects allowed, keeping some descriptors back for the rest of the process */
+static int in_flight_limit(int count)
+{
+    struct rlimit limit;
+    int cap = FANOUT_MAX_IN_FLIGHT;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY && (long)limit.rlim_cur - 64 < cap) {
+        cap = (long)limit.rlim_cur > 128 ? (int)limit.rlim_cur - 64 : 64;
+    }
+    return count < cap ? count : cap;
+}
+
+int door_fanout(const fanout_target *targets, int count, const char *command, fanout_report *report)
+{
+    long long start = now_usec();
+    memset(report, 0, sizeof(*report));
+    if (count == 0) {
+        return 0;
+    }
+
+    size_t len = strlen(command);
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    fanout_run run = {
+        .doors = calloc(count, sizeof(door_attempt)),
+        /* a door waits for at most one attempt at a time, but a finished attempt's deadline entry stays queued
+         * until it falls due, so the deadline queue may hold one entry per attempt */
+        .pending = { .entries = malloc(count * sizeof(queue_entry)), .cap = count },
+        .in_flight = { .entries = malloc((size_t)count * FANOUT_ATTEMPTS * sizeof(queue_entry)), .cap = count * FANOUT_ATTEMPTS },
+        .report = report
+    };
+    door_attempt *doors = run.doors;
+    if (epoll_fd < 0 || doors == NULL || run.pending.entries == NULL || run.in_flight.entries == NULL) {
+        perror("door_fanout");
+        if (epoll_fd >= 0) {
+            close(epoll_fd);
+        }
+        free(doors);
+        free(run.pending.entries);
+        free(run.in_flight.entries);
+        return -1;
+    }
+    for (int i = 0; i < count; i++) {
+        doors[i].fd = -1;
+        queue_push(&run.pending, i, start);
+    }
+
+    int max_in_flight = in_flight_limit(count);
+
+    struct epoll_event events[FANOUT_EVENTS];
+    while (run.finished < count) {
+        long long now = now_usec();
+
+        /* Start every attempt that is due, as far as the descriptor budget allows */
+        while (!queue_empty(&run.pending) && run.connecting < max_in_flight && queue_front(&run.pending)->due <= now) {
+            int i = queue_front(&run.pending)->door;
+            run.pending.head++;
+            door_attempt *door = &doors[i];
+            if (door->attempts++ > 0) {
+                report->retries++;
+            }
+
+            struct sockaddr_in addr;
+            memset(&addr, 0, sizeof(addr));
+            addr.sin_family = AF_INET;
+            addr.sin_addr = targets[i].addr;
+            addr.sin_port = targets[i].port;
+            door->fd = tcp_connect_start(&addr);
+            door->sent = 0;
+            door->deadline = now + FANOUT_ATTEMPT_MSEC * 1000LL;
+            door->phase = DOOR_CONNECTING;
+            run.connecting++;
+
+            struct epoll_event ev = { .events = EPOLLOUT, .data.u32 = (uint32_t)i };
+            if (door->fd < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, door->fd, &ev) < 0) {
+                end_attempt(&run, i, 0);
+                continue;
+            }
+            queue_push(&run.in_flight, i, door->deadline);
+        }
+
+        /* Give up on attempts that have run past their deadline */
+        while (!queue_empty(&run.in_flight) && queue_front(&run.in_flight)->due <= now) {
+            int i = queue_front(&run.in_flight)->door;
+            long long due = queue_front(&run.in_flight)->due;
+            run.in_flight.head++;
+            if (doors[i].phase == DOOR_CONNECTING && doors[i].deadline == due) {
+                end_attempt(&run, i, 0);
+            }
+        }
+        if (run.finished == count) {
+            break;
+        }
+
+        /* Sleep until a socket is ready, the next deadline passes or the next retry is due */
+        long long wake = -1;
+        if (!queue_empty(&run.in_flight)) {
+            wake = queue_front(&run.in_flight)->due;
+        }
+        if (!queue_empty(&run.pending) && run.connecting < max_in_flight && (wake == -1 || queue_front(&run.pending)->due < wake)) {
+            wake = queue_front(&run.pending)->due;
+        }
+        int timeout = wake == -1 ? -1 : wake <= now ? 0 : (int)((wake - now + 999) / 1000);
+        int ready = epoll_wait(epoll_fd, events, FANOUT_EVENTS, timeout);
+        if (ready < 0 && errno != EINTR) {
+            perror("epoll_wait()");
+            break;
+        }
+
+        for (int e = 0; e < ready; e++) {
+            int i = (int)events[e].data.u32;
+            door_attempt *door = &doors[i];
+            if (door->phase != DOOR_CONNECTING) {
+                continue;
+            }
+            if (door->sent == 0 && tcp_connect_finish(door->fd) != 0) {
+                end_attempt(&run, i, 0);
+                continue;
+            }
+            ssize_t n = send(door->fd, command + door->sent, len - door->sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (n > 0) {
+                door->sent += n;
+            }
+            if (door->sent == len) {
+                end_attempt(&run, i, 1);
+            } else if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                end_attempt(&run, i, 0);
+            }
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (doors[i].fd >= 0) {
+            close(doors[i].fd);
+        }
+    }
+    close(epoll_fd);
+    free(doors);
+    free(run.pending.entries);
+    free(run.in_flight.entries);
+    report->elapsed_usec = (long)(now_usec() - start);
+    return 0;
+}
@@ -0,0 +1,37 @@
+/*
+ * Concurrent delivery of one command to many door controllers, used by the fire alarm unit for OPEN_EMERG#.
+ *
+ * Every door gets a non-blocking connect of its own, all driven from one private epoll set, so the time to command
+ * the whole building is bounded by the slowest door rather than by the sum over all doors. Each attempt has its own
+ * deadline; a door that refuses, resets or does not answer in time is retried after a short pause until its
+ * attempts run out.
+*/
+
+#ifndef DOOR_FANOUT_H
+#define DOOR_FANOUT_H
+
+#include <netinet/in.h>
+
+#define FANOUT_ATTEMPT_MSEC 250     /* deadline for one connect-and-send attempt */
+#define FANOUT_ATTEMPTS 3           /* attempts per door before it is given up */
+#define FANOUT_RETRY_MSEC 50        /* pause before retrying a door that failed */
+#define FANOUT_MAX_IN_FLIGHT 4096   /* upper bound on simultaneous connects, further limited by RLIMIT_NOFILE */
+
+/* A door controller. Both fields are in network byte order, as carried in DOOR datagrams */
+typedef struct {
+    struct in_addr addr;
+    in_port_t port;
+} fanout_target;
+
+typedef struct {
+    int delivered;      /* doors that accepted the whole command */
+    int failed;         /* doors given up after FANOUT_ATTEMPTS */
+    int retries;        /* attempts beyond the first, over all doors */
+    long elapsed_usec;  /* from the call until the last door was delivered or given up */
+} fanout_report;
+
+/* Send command to every target and return once each door has it or has run out of attempts.
+ * Returns 0, or -1 if the engine itself could not be set up */
+int door_fanout(const fanout_target *targets, int count, const char *command, fanout_report *report);
+
+#endif
@@ -0,0 +1,269 @@
+/*
+ * Fake door farm for timing the fire alarm unit's OPEN_EMERG# fan-out.
+ * Listens for door connections on {first port} .. {first port} + 99 on every local address, registers {doors} doors
+ * with a running fire alarm unit, spread over those ports and over 127.0.0.0/8, then sends FIRE and times how long
+ * it takes until every one of them has received OPEN_EMERG#. STATE# is answered with STATE C#, as a closed door
+ * would. With a {warm-up}, FIRE waits that long after the last door registers, so the unit can connect to every
+ * door and health-check it first.
+ *
+ * {unresponsive} more doors are registered on {first port} + 100, whose listen backlog is kept full so that their
+ * connects are never answered, and {refused} more on {first port} + 101, where nothing listens. They are not waited
+ * for; the fire alarm unit's own report shows how it dealt with them, and the farm stays up for a while after the
+ * last answering door so that report is complete.
+ *
+ * FIRE latches the unit's alarm, so each run needs a fire alarm unit with no alarm raised yet.
+*/
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "tcp_communication.h"
+
+#define FARM_PORTS 100              /* ports answering doors; the next two are for unresponsive and refused doors */
+#define FARM_BACKLOG 4096
+#define FULL_BACKLOG_CONNECTS 4     /* more than a backlog of 0 holds, so further SYNs are dropped */
+#define MAX_EVENTS 256
+#define GIVE_UP_USEC 10000000
+#define LINGER_USEC 2000000        /* keep answering after the last door, until the unit has given up on the rest */
+
+/* DOOR and DREG datagrams, as the fire alarm unit expects them */
+typedef struct {
+    char header[4];
+    struct in_addr door_addr;
+    in_port_t door_port;
+} door_datagram;
+
+static in_port_t first_port;
+static int healthy;                 /* doors that answer, numbered 0 .. healthy - 1 */
+static int epoll_fd;
+static int listeners[FARM_PORTS];   /* epoll data of a listener points here; of a connection, at its tcp_conn */
+
+static pthread_mutex_t farm_mutex = PTHREAD_MUTEX_INITIALIZER;
+static unsigned char *opened;       /* per answering door: OPEN_EMERG# received */
+static int opened_count;
+static long long last_open_usec;
+
+static long long now_usec(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/* Door number n of a group sits on its own loopback address. Answering doors share the farm's ports, FARM_PORTS to
+ * an address; unresponsive and refused doors have a port each and an address apiece */
+static void door_address(int n, int per_address, in_port_t port, struct sockaddr_in *addr)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK + n / per_address);
+    addr->sin_port = htons(port + n % per_address);
+}
+
+/* Which answering door a connection was made to, from the address it was dialled at, or -1 */
+static int door_number(int fd)
+{
+    struct sockaddr_in local;
+    socklen_t len = sizeof(local);
+    if (getsockname(fd, (struct sockaddr *)&local, &len) == -1) {
+        return -1;
+    }
+    long n = (long)(ntohl(local.sin_addr.s_addr) - INADDR_LOOPBACK) * FARM_PORTS + ntohs(local.sin_port) - first_port;
+    return n >= 0 && n < healthy ? (int)n : -1;
+}
+
+static int listen_on(in_port_t port, int backlog)
+{
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port) };
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, backlog) < 0) {
+        perror("door_farm: listen");
+        exit(1);
+    }
+    return fd;
+}
+
+static void handle_frames(tcp_conn *conn)
+{
+    char *frame;
+    while ((frame = tcp_conn_next_frame(conn)) != NULL) {
+        if (strcmp(frame, "STATE") == 0) {
+            tcp_conn_queue(conn, "STATE C#\n", 9);
+        } else if (strcmp(frame, "OPEN_EMERG") == 0) {
+            int n = door_number(conn->fd);
+            pthread_mutex_lock(&farm_mutex);
+            if (n >= 0 && !opened[n]) {
+                opened[n] = 1;
+                opened_count++;
+                last_open_usec = now_usec();
+            }
+            pthread_mutex_unlock(&farm_mutex);
+        }
+    }
+}
+
+/* Farm thread: accepts connections on every answering port and serves them from one epoll set */
+static void *farm_main(void *unused)
+{
+    struct epoll_event events[MAX_EVENTS];
+    for (;;) {
+        int ready = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+        for (int i = 0; i < ready; i++) {
+            int *listener = events[i].data.ptr;
+            if (listener >= listeners && listener < listeners + FARM_PORTS) {
+                int fd;
+                while ((fd = accept(*listener, NULL, NULL)) >= 0) {
+                    tcp_set_nonblocking(fd);
+                    tcp_conn *conn = tcp_conn_new(fd);
+                    struct epoll_event event = { .events = EPOLLIN, .data.ptr = conn };
+                    if (conn == NULL || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+                        close(fd);
+                    }
+                }
+                continue;
+            }
+            tcp_conn *conn = events[i].data.ptr;
+            ssize_t n;
+            while ((n = tcp_conn_fill(conn)) > 0) {
+                handle_frames(conn);
+            }
+            if (n == 0 || (n == -1 && errno != EAGAIN) || tcp_conn_flush(conn) == -1) {
+                tcp_conn_free(conn);
+            }
+        }
+    }
+    return NULL;
+}
+
+/* Register one door and wait for its DREG. Returns 0, or -1 if none came */
+static int register_door(int udp_fd, const struct sockaddr_in *firealarm, const struct sockaddr_in *door)
+{
+    door_datagram dgram;
+    memset(&dgram, 0, sizeof(dgram));
+    memcpy(dgram.header, "DOOR", 4);
+    dgram.door_addr = door->sin_addr;
+    dgram.door_port = door->sin_port;
+    sendto(udp_fd, &dgram, sizeof(dgram), 0, (const struct sockaddr *)firealarm, sizeof(*firealarm));
+    door_datagram reply;
+    while (recv(udp_fd, &reply, sizeof(reply), 0) >= (ssize_t)sizeof(reply)) {
+        if (memcmp(reply.header, "DREG", 4) == 0) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 6 && argc != 7) {
+        fprintf(stderr, "usage: door_farm {fire alarm address:port} {first port} {doors} {unresponsive} {refused} "
+                "[{warm-up (in seconds)}]\n");
+        exit(1);
+    }
+    struct sockaddr_in firealarm;
+    if (tcp_parse_address(argv[1], &firealarm) < 0) {
+        fprintf(stderr, "door_farm: address should be in the format ip:port\n");
+        exit(1);
+    }
+    int port = atoi(argv[2]);
+    healthy = atoi(argv[3]);
+    int unresponsive = atoi(argv[4]);
+    int refused = atoi(argv[5]);
+    double warm_up = argc == 7 ? atof(argv[6]) : 0;
+    if (port <= 0 || port + FARM_PORTS + 1 > 65535 || healthy < 1 || unresponsive < 0 || refused < 0 || warm_up < 0) {
+        fprintf(stderr, "door_farm: a port below %d, at least one door and no negative counts or warm-up\n",
+                65535 - FARM_PORTS - 1);
+        exit(1);
+    }
+    first_port = (in_port_t)port;
+    opened = calloc(healthy, 1);
+    if (opened == NULL) {
+        perror("door_farm");
+        exit(1);
+    }
+
+    epoll_fd = epoll_create1(0);
+    for (int i = 0; i < FARM_PORTS; i++) {
+        listeners[i] = listen_on(first_port + i, FARM_BACKLOG);
+        tcp_set_nonblocking(listeners[i]);
+        struct epoll_event event = { .events = EPOLLIN, .data.ptr = &listeners[i] };
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listeners[i], &event);
+    }
+
+    /* the unresponsive port: a listener that never accepts, with its backlog filled so later SYNs go unanswered */
+    in_port_t unresponsive_port = first_port + FARM_PORTS, refused_port = first_port + FARM_PORTS + 1;
+    listen_on(unresponsive_port, 0);
+    struct sockaddr_in backlog_addr;
+    door_address(0, 1, unresponsive_port, &backlog_addr);
+    for (int i = 0; i < FULL_BACKLOG_CONNECTS; i++) {
+        int fd = tcp_connect_start(&backlog_addr);
+        if (fd == -1) {
+            perror("door_farm: filling the backlog");
+            exit(1);
+        }
+    }
+
+    pthread_t farm;
+    if (pthread_create(&farm, NULL, farm_main, NULL) != 0) {
+        fprintf(stderr, "door_farm: could not start the farm thread\n");
+        exit(1);
+    }
+
+    int udp_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    struct timeval timeout = { 2, 0 };
+    setsockopt(udp_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    long long start = now_usec();
+    for (int i = 0; i < healthy + unresponsive + refused; i++) {
+        struct sockaddr_in door;
+        if (i < healthy) {
+            door_address(i, FARM_PORTS, first_port, &door);
+        } else if (i < healthy + unresponsive) {
+            door_address(i - healthy, 1, unresponsive_port, &door);
+        } else {
+            door_address(i - healthy - unresponsive, 1, refused_port, &door);
+        }
+        if (register_door(udp_fd, &firealarm, &door) == -1) {
+            fprintf(stderr, "door_farm: no DREG from the fire alarm unit for door %d\n", i);
+            exit(1);
+        }
+    }
+    printf("door_farm: registered %d doors (%d unresponsive, %d refused) in %.2fs\n",
+           healthy + unresponsive + refused, unresponsive, refused, (now_usec() - start) / 1e6);
+    usleep((useconds_t)(warm_up * 1e6));
+
+    start = now_usec();
+    sendto(udp_fd, "FIRE", 4, 0, (struct sockaddr *)&firealarm, sizeof(firealarm));
+    int done = 0;
+    while (!done && now_usec() - start < GIVE_UP_USEC) {
+        usleep(1000);
+        pthread_mutex_lock(&farm_mutex);
+        done = opened_count == healthy;
+        pthread_mutex_unlock(&farm_mutex);
+    }
+
+    pthread_mutex_lock(&farm_mutex);
+    if (done) {
+        printf("door_farm: OPEN_EMERG# reached all %d answering doors %.2fms after FIRE\n", healthy,
+               (last_open_usec - start) / 1000.0);
+    } else {
+        printf("door_farm: OPEN_EMERG# reached only %d of %d answering doors within %ds\n", opened_count, healthy,
+               GIVE_UP_USEC / 1000000);
+    }
+    pthread_mutex_unlock(&farm_mutex);
+
+    /* closing the farm now would turn the unit's remaining attempts at unresponsive doors into quick refusals */
+    usleep(LINGER_USEC);
+    return done ? 0 : 1;
+}
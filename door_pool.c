@@ -0,0 +1,321 @@
+/*
+ * Warm connection pool from the fire alarm unit to its doors. See door_pool.h.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include "door_pool.h"
+#include "tcp_communication.h"
+
+#define POOL_EVENTS 256
+#define POOL_TIMER_TAG UINT32_MAX       /* epoll tags for the timer and the wake-up eventfd; doors use their index */
+#define POOL_WAKE_TAG (UINT32_MAX - 1)
+
+typedef enum {
+    POOL_IDLE,          /* not connected; the next attempt is due at due */
+    POOL_CONNECTING,    /* connect in progress, must complete by due */
+    POOL_WARM           /* connected; next health check at due, or its reply is due by due */
+} pool_state;
+
+typedef struct {
+    fanout_target target;
+    pool_state state;
+    int fd;
+    int awaiting_reply;     /* a health check has been sent and not answered */
+    int failures;           /* consecutive failed connects or checks */
+    int reported_dead;
+    long long due;          /* usec */
+} pooled_door;
+
+/* Everything below is shared between the pool thread and the caller of door_pool_add/door_pool_broadcast */
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pooled_door *pool;
+static int pool_count, pool_cap;
+static int emergency;       /* set by door_pool_broadcast; no more health checks after that */
+static int connecting;      /* doors in POOL_CONNECTING */
+static int connects_held;   /* run_timers left due connects for later because too many were in progress */
+
+static int epoll_fd;
+static int wake_fd;         /* raised by door_pool_add so a new door is connected without waiting for a tick */
+static int timer_fd;
+
+static long long now_usec(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static void describe(const pooled_door *door, char *text, size_t len)
+{
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &door->target.addr, ip, sizeof(ip));
+    snprintf(text, len, "%s:%d", ip, ntohs(door->target.port));
+}
+
+static void door_failed(pooled_door *door, const char *why, long long now)
+{
+    if (door->fd >= 0) {
+        close(door->fd);
+        door->fd = -1;
+    }
+    if (door->state == POOL_CONNECTING) {
+        connecting--;
+    }
+    door->state = POOL_IDLE;
+    door->awaiting_reply = 0;
+    door->due = now + POOL_RETRY_MSEC * 1000LL;
+    if (++door->failures == POOL_DEAD_AFTER && !door->reported_dead) {
+        char name[32];
+        describe(door, name, sizeof(name));
+        fprintf(stderr, "firealarm: door %s is unreachable (%s)\n", name, why);
+        door->reported_dead = 1;
+    }
+}
+
+static void door_healthy(pooled_door *door)
+{
+    door->failures = 0;
+    if (door->reported_dead) {
+        char name[32];
+        describe(door, name, sizeof(name));
+        fprintf(stderr, "firealarm: door %s is reachable again\n", name);
+        door->reported_dead = 0;
+    }
+}
+
+static void start_connect(pooled_door *door, int index, long long now)
+{
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr = door->target.addr;
+    addr.sin_port = door->target.port;
+
+    door->fd = tcp_connect_start(&addr);
+    struct epoll_event ev = { .events = EPOLLOUT, .data.u32 = (uint32_t)index };
+    if (door->fd < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, door->fd, &ev) < 0) {
+        door_failed(door, "cannot connect", now);
+        return;
+    }
+    door->state = POOL_CONNECTING;
+    door->due = now + POOL_CONNECT_MSEC * 1000LL;
+    connecting++;
+}
+
+static void send_check(pooled_door *door, long long now)
+{
+    static const char check[] = "STATE#";
+    if (send(door->fd, check, sizeof(check) - 1, MSG_NOSIGNAL | MSG_DONTWAIT) != sizeof(check) - 1) {
+        door_failed(door, "connection lost", now);
+        return;
+    }
+    door->awaiting_reply = 1;
+    door->due = now + POOL_REPLY_MSEC * 1000LL;
+}
+
+/* Run every timer that is due: connects to start, connects and replies that are overdue, checks to send */
+static void run_timers(long long now)
+{
+    connects_held = 0;
+    for (int i = 0; i < pool_count; i++) {
+        pooled_door *door = &pool[i];
+        if (door->due > now) {
+            continue;
+        }
+        switch (door->state) {
+        case POOL_IDLE:
+            /* many doors at once, as after a restart, are connected a batch at a time rather than in one storm */
+            if (connecting < POOL_MAX_CONNECTING) {
+                start_connect(door, i, now);
+            } else {
+                connects_held = 1;
+            }
+            break;
+        case POOL_CONNECTING:
+            door_failed(door, "connect timed out", now);
+            break;
+        case POOL_WARM:
+            if (door->awaiting_reply) {
+                door_failed(door, "no reply to STATE#", now);
+            } else if (!emergency) {
+                send_check(door, now);
+            }
+            break;
+        }
+    }
+}
+
+static void handle_event(int index, uint32_t events, long long now)
+{
+    pooled_door *door = &pool[index];
+    if (door->state == POOL_CONNECTING) {
+        if (tcp_connect_finish(door->fd) != 0) {
+            door_failed(door, "connect refused", now);
+            return;
+        }
+        struct epoll_event ev = { .events = EPOLLIN, .data.u32 = (uint32_t)index };
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, door->fd, &ev);
+        door->state = POOL_WARM;
+        connecting--;
+        /* check straight away that a door controller, not just a socket, is listening */
+        send_check(door, now);
+        return;
+    }
+    if (door->state != POOL_WARM) {
+        return;
+    }
+
+    /* replies to health checks, and after an alarm the doors' answers to the emergency command */
+    char buffer[256];
+    ssize_t n = recv(door->fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR) || (events & (EPOLLHUP | EPOLLERR))) {
+        door_failed(door, "connection lost", now);
+        return;
+    }
+    if (n > 0 && memchr(buffer, '#', n) != NULL && door->awaiting_reply) {
+        door->awaiting_reply = 0;
+        door->due = now + POOL_CHECK_MSEC * 1000LL;
+        door_healthy(door);
+    }
+}
+
+static void *pool_main(void *unused)
+{
+    (void)unused;
+    struct epoll_event events[POOL_EVENTS];
+    for (;;) {
+        int ready = epoll_wait(epoll_fd, events, POOL_EVENTS, -1);
+        if (ready < 0) {
+            if (errno != EINTR) {
+                perror("epoll_wait()");
+            }
+            continue;
+        }
+
+        long long now = now_usec();
+        int timers_due = 0;
+        pthread_mutex_lock(&pool_mutex);
+        for (int i = 0; i < ready; i++) {
+            uint32_t tag = events[i].data.u32;
+            if (tag == POOL_TIMER_TAG || tag == POOL_WAKE_TAG) {
+                uint64_t count;
+                if (read(tag == POOL_TIMER_TAG ? timer_fd : wake_fd, &count, sizeof(count)) > 0) {
+                    timers_due = 1;
+                }
+            } else if ((int)tag < pool_count) {
+                handle_event((int)tag, events[i].events, now);
+            }
+        }
+        if (timers_due || (connects_held && connecting < POOL_MAX_CONNECTING)) {
+            run_timers(now);
+        }
+        pthread_mutex_unlock(&pool_mutex);
+    }
+    return NULL;
+}
+
+int door_pool_start(void)
+{
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (epoll_fd < 0 || wake_fd < 0 || timer_fd < 0) {
+        perror("door_pool_start");
+        return -1;
+    }
+    struct itimerspec tick = {
+        .it_interval = { .tv_sec = 0, .tv_nsec = POOL_TICK_MSEC * 1000000L },
+        .it_value = { .tv_sec = 0, .tv_nsec = POOL_TICK_MSEC * 1000000L }
+    };
+    struct epoll_event timer_ev = { .events = EPOLLIN, .data.u32 = POOL_TIMER_TAG };
+    struct epoll_event wake_ev = { .events = EPOLLIN, .data.u32 = POOL_WAKE_TAG };
+    if (timerfd_settime(timer_fd, 0, &tick, NULL) < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &timer_ev) < 0
+        || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &wake_ev) < 0) {
+        perror("door_pool_start");
+        return -1;
+    }
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, pool_main, NULL) != 0) {
+        perror("pthread_create()");
+        return -1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
+
+void door_pool_add(const fanout_target *door)
+{
+    door_pool_add_all(door, 1);
+}
+
+void door_pool_add_all(const fanout_target *doors, int count)
+{
+    pthread_mutex_lock(&pool_mutex);
+    if (pool_count + count > pool_cap) {
+        int cap = pool_cap ? pool_cap : 64;
+        while (cap < pool_count + count) {
+            cap *= 2;
+        }
+        pooled_door *grown = realloc(pool, cap * sizeof(*pool));
+        if (grown == NULL) {
+            perror("realloc()");
+            pthread_mutex_unlock(&pool_mutex);
+            return;
+        }
+        pool = grown;
+        pool_cap = cap;
+    }
+    for (int i = 0; i < count; i++) {
+        pooled_door *entry = &pool[pool_count++];
+        memset(entry, 0, sizeof(*entry));
+        entry->target = doors[i];
+        entry->state = POOL_IDLE;
+        entry->fd = -1;
+        entry->due = 0;     /* connect on the next pass of the pool thread */
+    }
+    pthread_mutex_unlock(&pool_mutex);
+
+    uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) < 0) {
+        perror("write(eventfd)");
+    }
+}
+
+void door_pool_broadcast(const char *command, door_pool_report *report)
+{
+    long long start = now_usec();
+    size_t len = strlen(command);
+    memset(report, 0, sizeof(*report));
+
+    pthread_mutex_lock(&pool_mutex);
+    emergency = 1;
+    fanout_target *cold = malloc((pool_count ? pool_count : 1) * sizeof(*cold));
+    int cold_count = 0;
+    for (int i = 0; i < pool_count; i++) {
+        pooled_door *door = &pool[i];
+        if (door->state == POOL_WARM && send(door->fd, command, len, MSG_NOSIGNAL | MSG_DONTWAIT) == (ssize_t)len) {
+            report->warm++;
+        } else if (cold != NULL) {
+            cold[cold_count++] = door->target;
+        }
+    }
+    report->warm_usec = (long)(now_usec() - start);
+    pthread_mutex_unlock(&pool_mutex);
+
+    /* doors without a usable connection get fresh connects, with retries */
+    door_fanout(cold, cold_count, command, &report->cold);
+    free(cold);
+}
@@ -0,0 +1,42 @@
+/*
+ * Warm emergency connections from the fire alarm unit to every registered door.
+ *
+ * A door is connected as soon as it registers and kept connected by a pool thread, which health-checks each
+ * session with STATE# and reconnects any that fail. A door that keeps failing is reported as unreachable while
+ * there is still no emergency. When the alarm goes off, door_pool_broadcast() only has to write the command on
+ * sockets that are already open; doors without a healthy connection fall back to a door_fanout() of fresh connects.
+*/
+
+#ifndef DOOR_POOL_H
+#define DOOR_POOL_H
+
+#include "door_fanout.h"
+
+#define POOL_TICK_MSEC 100          /* granularity of the pool thread's timers */
+#define POOL_CONNECT_MSEC 250       /* deadline for establishing a connection */
+#define POOL_CHECK_MSEC 1000        /* interval between health checks of a warm connection */
+#define POOL_REPLY_MSEC 250         /* deadline for the reply to a health check */
+#define POOL_RETRY_MSEC 500         /* pause before reconnecting a failed door */
+#define POOL_DEAD_AFTER 2           /* consecutive failures before a door is reported unreachable */
+#define POOL_MAX_CONNECTING 256     /* connects in progress at once; the rest wait for one to finish */
+
+typedef struct {
+    int warm;           /* doors commanded over an established connection */
+    long warm_usec;     /* from the call until the last of those writes */
+    fanout_report cold; /* doors that had to be connected on the spot */
+} door_pool_report;
+
+/* Start the pool thread. Returns 0 or -1 */
+int door_pool_start(void);
+
+/* Start keeping a connection to a newly registered door */
+void door_pool_add(const fanout_target *door);
+
+/* The same for many doors at once, such as every door known to a restarted unit */
+void door_pool_add_all(const fanout_target *doors, int count);
+
+/* Send command to every door in the pool: at once on warm connections, then by door_fanout() to the rest.
+ * Health checks stop from then on, as doors answer emergency commands only once they have moved */
+void door_pool_broadcast(const char *command, door_pool_report *report);
+
+#endif
@@ -0,0 +1,93 @@
+/*
+ * Hash-indexed door registry. See door_registry.h.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "door_registry.h"
+
+static unsigned int door_hash(const fanout_target *door)
+{
+    uint64_t key = (uint64_t)door->addr.s_addr << 16 | door->port;
+    key *= 0x9E3779B97F4A7C15ull;
+    return (unsigned int)(key >> 32);
+}
+
+static int same_door(const fanout_target *a, const fanout_target *b)
+{
+    return a->addr.s_addr == b->addr.s_addr && a->port == b->port;
+}
+
+static void index_door(door_registry *registry, int position)
+{
+    unsigned int mask = registry->slot_cap - 1;
+    unsigned int i = door_hash(&registry->doors[position]) & mask;
+    while (registry->slots[i] != 0) {
+        i = (i + 1) & mask;
+    }
+    registry->slots[i] = position + 1;
+}
+
+int door_registry_find(const door_registry *registry, const fanout_target *door)
+{
+    if (registry->slot_cap == 0) {
+        return -1;
+    }
+    unsigned int mask = registry->slot_cap - 1;
+    for (unsigned int i = door_hash(door) & mask; registry->slots[i] != 0; i = (i + 1) & mask) {
+        if (same_door(&registry->doors[registry->slots[i] - 1], door)) {
+            return registry->slots[i] - 1;
+        }
+    }
+    return -1;
+}
+
+int door_registry_add(door_registry *registry, const fanout_target *door, int *added)
+{
+    *added = 0;
+    int position = door_registry_find(registry, door);
+    if (position >= 0) {
+        return position;
+    }
+
+    if (registry->count == registry->cap) {
+        int cap = registry->cap ? registry->cap * 2 : 64;
+        fanout_target *grown = realloc(registry->doors, cap * sizeof(*grown));
+        if (grown == NULL) {
+            perror("realloc()");
+            return -1;
+        }
+        registry->doors = grown;
+        registry->cap = cap;
+    }
+    /* keep the index at most half full so probe sequences stay short */
+    if ((registry->count + 1) * 2 > registry->slot_cap) {
+        int cap = registry->slot_cap ? registry->slot_cap * 2 : 128;
+        int *slots = calloc(cap, sizeof(*slots));
+        if (slots == NULL) {
+            perror("calloc()");
+            return -1;
+        }
+        free(registry->slots);
+        registry->slots = slots;
+        registry->slot_cap = cap;
+        for (int i = 0; i < registry->count; i++) {
+            index_door(registry, i);
+        }
+    }
+
+    position = registry->count++;
+    registry->doors[position] = *door;
+    index_door(registry, position);
+    *added = 1;
+    return position;
+}
+
+void door_registry_free(door_registry *registry)
+{
+    free(registry->doors);
+    free(registry->slots);
+    memset(registry, 0, sizeof(*registry));
+}
@@ -0,0 +1,31 @@
+/*
+ * Registry of the doors known to a fire alarm unit.
+ *
+ * Doors are kept in a dense array in registration order, which is what the emergency fan-out walks, and indexed
+ * by an open-addressing hash on (address, port) so that a door registering again, as every door does after a
+ * network flap, is recognised with a single probe sequence instead of being added twice.
+*/
+
+#ifndef DOOR_REGISTRY_H
+#define DOOR_REGISTRY_H
+
+#include "door_fanout.h"
+
+typedef struct {
+    fanout_target *doors;   /* dense, in registration order */
+    int count;
+    int cap;
+    int *slots;             /* position in doors + 1, or 0 for an empty slot; at most half full */
+    int slot_cap;           /* power of two */
+} door_registry;
+
+/* Add a door unless it is already registered. Returns its position in doors, or -1 if memory is exhausted.
+ * *added is set to 1 for a door not seen before */
+int door_registry_add(door_registry *registry, const fanout_target *door, int *added);
+
+/* Position of a registered door, or -1 */
+int door_registry_find(const door_registry *registry, const fanout_target *door);
+
+void door_registry_free(door_registry *registry);
+
+#endif
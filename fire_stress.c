@@ -0,0 +1,201 @@
+/*
+ * Stress test for the fire alarm unit's FIRE/DOOR lane under a TEMP flood.
+ * Plays a door controller and a callpoint against a running fire alarm unit: the door registers, child processes
+ * then flood the unit with full-size TEMP datagrams below its threshold as fast as loopback takes them, and while
+ * the flood runs the door registers again and the callpoint starts sending FIRE every {resend delay}. It measures
+ * DOOR to DREG and first FIRE to OPEN_EMERG# arriving at the door, and fails if either is over the bound.
+ *
+ * FIRE latches the unit's alarm, so each run needs a fire alarm unit with no alarm raised yet.
+*/
+
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "temp_wire.h"
+#include "tcp_communication.h"
+
+#define MAX_FLOODERS 16
+#define FLOOD_WARMUP_USEC 500000    /* let the flood fill the unit's queues before measuring */
+#define GIVE_UP_USEC 10000000
+#define MAX_DOOR_CONNS 16
+
+/* DOOR and DREG datagrams, as the fire alarm unit expects them */
+typedef struct {
+    char header[4];
+    struct in_addr door_addr;
+    in_port_t door_port;
+} door_datagram;
+
+static struct sockaddr_in firealarm;
+static pid_t flooders[MAX_FLOODERS];
+static int flooder_count;
+
+static long long now_usec(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/* Child process: send cool full-size readings until killed */
+static void flood(void)
+{
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&firealarm, sizeof(firealarm)) < 0) {
+        perror("fire_stress: flood");
+        exit(1);
+    }
+    struct datagram_format reading;
+    memset(&reading, 0, sizeof(reading));
+    memcpy(reading.header, "TEMP", 4);
+    reading.temperature = 20;
+    reading.address_count = 1;
+    reading.address_list[0].sensor_addr.s_addr = htonl(INADDR_LOOPBACK);
+    reading.address_list[0].sensor_port = 3000;
+    for (unsigned int i = 0;; i++) {
+        reading.id = (uint16_t)i;
+        gettimeofday(&reading.timestamp, NULL);
+        send(fd, &reading, sizeof(reading), 0);
+    }
+}
+
+static void stop_flood(void)
+{
+    for (int i = 0; i < flooder_count; i++) {
+        kill(flooders[i], SIGKILL);
+        waitpid(flooders[i], NULL, 0);
+    }
+    flooder_count = 0;
+}
+
+/* Register the door and return the time until its DREG came back, or -1 */
+static long long register_door(int udp_fd, const struct sockaddr_in *door)
+{
+    door_datagram dgram;
+    memset(&dgram, 0, sizeof(dgram));
+    memcpy(dgram.header, "DOOR", 4);
+    dgram.door_addr = door->sin_addr;
+    dgram.door_port = door->sin_port;
+
+    long long start = now_usec();
+    sendto(udp_fd, &dgram, sizeof(dgram), 0, (struct sockaddr *)&firealarm, sizeof(firealarm));
+    door_datagram reply;
+    while (recv(udp_fd, &reply, sizeof(reply), 0) >= (ssize_t)sizeof(reply)) {
+        if (memcmp(reply.header, "DREG", 4) == 0) {
+            return now_usec() - start;
+        }
+    }
+    return -1;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 6) {
+        fprintf(stderr, "usage: fire_stress {fire alarm address:port} {door address:port} {flooders} "
+                "{resend delay (in microseconds)} {bound (in microseconds)}\n");
+        exit(1);
+    }
+    struct sockaddr_in door;
+    if (tcp_parse_address(argv[1], &firealarm) < 0 || tcp_parse_address(argv[2], &door) < 0) {
+        fprintf(stderr, "fire_stress: addresses should be in the format ip:port\n");
+        exit(1);
+    }
+    int count = atoi(argv[3]);
+    long long resend = atoll(argv[4]);
+    long long bound = atoll(argv[5]);
+    if (count < 1 || count > MAX_FLOODERS || resend <= 0) {
+        fprintf(stderr, "fire_stress: between 1 and %d flooders, and a positive resend delay\n", MAX_FLOODERS);
+        exit(1);
+    }
+
+    /* the door controller the unit will send OPEN_EMERG# to */
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(listen_fd, (struct sockaddr *)&door, sizeof(door)) < 0 || listen(listen_fd, MAX_DOOR_CONNS) < 0) {
+        perror("fire_stress: door");
+        exit(1);
+    }
+    int udp_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    struct timeval timeout = { 2, 0 };
+    setsockopt(udp_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (register_door(udp_fd, &door) < 0) {
+        fprintf(stderr, "fire_stress: no DREG from the fire alarm unit\n");
+        exit(1);
+    }
+
+    for (int i = 0; i < count; i++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            flood();
+        }
+        flooders[flooder_count++] = pid;
+    }
+    usleep(FLOOD_WARMUP_USEC);
+
+    /* a door registering again is DOOR traffic in the same lane as FIRE */
+    long long dreg = register_door(udp_fd, &door);
+
+    struct pollfd fds[1 + MAX_DOOR_CONNS] = { { .fd = listen_fd, .events = POLLIN } };
+    int nfds = 1;
+    int fires = 0;
+    long long start = now_usec(), next_fire = start, opened = -1;
+    while (opened == -1 && now_usec() - start < GIVE_UP_USEC) {
+        if (now_usec() >= next_fire) {
+            sendto(udp_fd, "FIRE", 4, 0, (struct sockaddr *)&firealarm, sizeof(firealarm));
+            fires++;
+            next_fire += resend;
+        }
+        int wait_ms = (int)((next_fire - now_usec()) / 1000);
+        poll(fds, nfds, wait_ms > 0 ? wait_ms : 0);
+        if ((fds[0].revents & POLLIN) && nfds < 1 + MAX_DOOR_CONNS) {
+            fds[nfds].fd = accept(listen_fd, NULL, NULL);
+            fds[nfds++].events = POLLIN;
+        }
+        for (int i = 1; i < nfds; i++) {
+            if (!(fds[i].revents & POLLIN)) {
+                continue;
+            }
+            char buf[512];
+            ssize_t n = recv(fds[i].fd, buf, sizeof(buf) - 1, 0);
+            if (n <= 0) {
+                close(fds[i].fd);
+                fds[i--] = fds[--nfds];
+                continue;
+            }
+            buf[n] = '\0';
+            /* the unit checks its warm connections with STATE# */
+            if (strstr(buf, "STATE#") != NULL) {
+                send(fds[i].fd, "STATE C#\n", 9, MSG_NOSIGNAL);
+            }
+            if (strstr(buf, "OPEN_EMERG#") != NULL) {
+                opened = now_usec() - start;
+                send(fds[i].fd, "EMERGENCY_MODE#\n", 16, MSG_NOSIGNAL);
+            }
+        }
+    }
+    stop_flood();
+
+    if (dreg < 0) {
+        printf("fire_stress: DOOR -> DREG: no DREG\n");
+    } else {
+        printf("fire_stress: DOOR -> DREG: %.3fms\n", dreg / 1e3);
+    }
+    if (opened < 0) {
+        printf("fire_stress: FIRE -> OPEN_EMERG#: none after %ds (%d FIRE sent)\n", GIVE_UP_USEC / 1000000, fires);
+    } else {
+        printf("fire_stress: FIRE -> OPEN_EMERG#: %.3fms (%d FIRE sent)\n", opened / 1e3, fires);
+    }
+    int within = dreg >= 0 && dreg <= bound && opened >= 0 && opened <= bound;
+    printf("fire_stress: %s the %.3fms bound under %d TEMP flooders\n", within ? "within" : "OVER", bound / 1e3, count);
+    return within ? 0 : 1;
+}
@@ -6,6 +6,7 @@
  * with an overseer program while operating autonomously to guarantee redundancy.
 */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <pthread.h>
@@ -20,10 +21,27 @@
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <sys/time.h>
+#include <errno.h>
+#include <poll.h>
+#include <linux/filter.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <signal.h>
+#include <sys/signalfd.h>
+#include "door_fanout.h"
+#include "door_pool.h"
+#include "door_registry.h"
+#include "detection_window.h"
+#include "tcp_communication.h"
+#include "spsc_queue.h"
+#include "firealarm_state.h"
+#include "temp_wire.h"
 
 #define BUFFER_SIZE 256
-#define MAX_DOORS 100
-#define MAX_DETECTIONS 50
+#define OVERSEER_TIMEOUT_MSEC 1000
+#define RECV_BATCH 64               /* datagrams taken per recvmmsg() call */
+#define EVENT_QUEUE_SIZE 1024       /* FIRE and over-threshold readings waiting for the decision thread */
+#define REGISTRATION_QUEUE_SIZE 4096    /* doors waiting for the actuation thread */
 
 /* Shared memory structure */
 typedef struct {
@@ -39,26 +57,6 @@ typedef struct {
     in_port_t door_port;
 } door_datagram;
 
-/* Temperature sensor controller datagrams */
-struct addr_entry {
-  struct in_addr sensor_addr;
-  in_port_t sensor_port;
-};
-
-struct datagram_format {
-  char header[4]; /* {'T', 'E', 'M', 'P'} */
-  struct timeval timestamp;
-  float temperature;
-  uint16_t id;
-  uint8_t address_count;
-  struct addr_entry address_list[50];
-};
-
-typedef struct {
-    struct in_addr door_addr;
-    in_port_t door_port;
-} ListDoor;
-
 /* Door confirmation datagram structure */
 typedef struct {
     char header[4]; /* {'D', 'R', 'E', 'G'} */
@@ -66,34 +64,426 @@ typedef struct {
     in_port_t door_port;
 } door_confirmation;
 
-/* Door list */
-ListDoor list_door[MAX_DOORS];
-int door_count = 0;
+/* Registered doors, owned by the actuation thread */
+door_registry doors;
 
-/* Detection timestamps list */
-long long detection_timestamps[MAX_DETECTIONS];
-int detection_count = 0;
+/* Recent over-threshold readings, counted once per sensor; owned by the decision thread */
+detection_window detections;
 
 /* Fire emergency datagram */
 typedef struct  {
     char header[4]; /* {'F', 'I', 'R', 'E'} */
 } fire_alarmdata;
 
+/* One receive slot, large enough for the biggest datagram that is sent to us */
+typedef union {
+    char header[4];
+    door_datagram door;
+    fire_alarmdata fire;
+    unsigned char temp[TEMP_WIRE_MAX_SIZE];     /* TEMP reading in either layout or a batch, see temp_wire.h */
+} datagram;
+
+/* Work handed from the receive thread to the decision thread */
+typedef struct {
+    char kind;              /* 'F' for a call point, 'T' for a temperature reading over the threshold */
+    uint16_t sensor;
+    long long taken;        /* usec, the sensor's timestamp */
+    long long received;     /* usec */
+} alarm_event;
+
 /* Global variables */
 int overseer_sock; 
 struct sockaddr_in overseer_addr;
-int fire_alarm_triggered = 0;
+int temp_threshold;
+int min_detections;
+
+/* The unit runs as a pipeline of three threads joined by lock-free queues, so no stage waits on another:
+ *   receive (main):  takes datagrams off the sockets, confirms doors with DREG, filters readings by threshold
+ *   decision:        owns the detection window and the alarm in shared memory
+ *   actuation:       owns the door registry and every connection to the doors
+ * A consumer that finds its queues empty sleeps on its eventfd; producers raise it once per batch */
+static spsc_queue events;           /* receive -> decision */
+static spsc_queue registrations;    /* receive -> actuation: fanout_target of each door that registered */
+static spsc_queue alarms;           /* decision -> actuation: one entry when the alarm goes off */
+static int decision_wake, actuation_wake;
+static int decision_pending, actuation_pending;    /* receive thread: items pushed since the last wake-up */
+
+/* Doors and alarm latch kept across a crash; NULL if the state segment is unavailable */
+static firealarm_state *state;
+static char state_name[64];
+
+/* Decision thread state */
+static int fire_alarm_triggered = 0;
+static shm_alarm *shared;           /* alarm flag in shared memory */
+
+static void wake(int eventfd) {
+    uint64_t one = 1;
+    if (write(eventfd, &one, sizeof(one)) < 0) {
+        perror("write(eventfd)");
+    }
+}
+
+/* Sleep until a producer raises eventfd */
+static void wait_for(int eventfd) {
+    uint64_t count;
+    while (read(eventfd, &count, sizeof(count)) < 0 && errno == EINTR) {
+    }
+}
+
+static int start_thread(void *(*run)(void *)) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, run, NULL) != 0) {
+        perror("pthread_create()");
+        return -1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
+
+/* Remember a door that has registered, so it is opened on a fire, and start keeping a connection to it.
+ * A door registering again is already known and keeps its existing connection */
+static void add_door(const fanout_target *door) {
+    int added;
+    if (door_registry_add(&doors, door, &added) >= 0 && added) {
+        door_pool_add(door);
+        firealarm_state_add_door(state, door);
+    }
+}
+
+/* Send OPEN_EMERG# to a set of doors concurrently and report how it went */
+static void open_doors(const fanout_target *targets, int count) {
+    fanout_report report;
+    if (door_fanout(targets, count, "OPEN_EMERG#", &report) == -1) {
+        return;
+    }
+    printf("OPEN_EMERG# delivered to %d of %d doors in %.1fms (%d failed, %d retries)\n",
+           report.delivered, count, report.elapsed_usec / 1000.0, report.failed, report.retries);
+    fflush(stdout);
+}
+
+/* Send OPEN_EMERG# to every registered door, over the warm connections where possible */
+static void open_all_doors(void) {
+    door_pool_report report;
+    door_pool_broadcast("OPEN_EMERG#", &report);
+    printf("OPEN_EMERG# written to %d warm doors in %.3fms; %d of %d other doors reached in %.1fms (%d failed, %d retries)\n",
+           report.warm, report.warm_usec / 1000.0, report.cold.delivered, doors.count - report.warm,
+           report.cold.elapsed_usec / 1000.0, report.cold.failed, report.cold.retries);
+    fflush(stdout);
+}
+
+/* Actuation thread: registers doors and opens them. However long a door takes to answer, only this thread waits */
+static void *actuation_main(void *unused) {
+    (void)unused;
+    int doors_opened = 0;
+    fanout_target late[256];
+    for (;;) {
+        wait_for(actuation_wake);
+
+        char alarm;
+        while (spsc_queue_pop(&alarms, &alarm) == 0) {
+            if (!doors_opened) {
+                doors_opened = 1;
+                open_all_doors();
+            }
+        }
+
+        /* During an alarm, doors that register late are opened straight away, together */
+        int late_count = 0;
+        fanout_target door;
+        while (spsc_queue_pop(&registrations, &door) == 0) {
+            add_door(&door);
+            if (doors_opened) {
+                late[late_count++] = door;
+                if (late_count == sizeof(late) / sizeof(late[0])) {
+                    open_doors(late, late_count);
+                    late_count = 0;
+                }
+            }
+        }
+        if (late_count > 0) {
+            open_doors(late, late_count);
+        }
+    }
+    return NULL;
+}
+
+/* Raise the alarm in shared memory and have every door opened, once */
+static void raise_alarm(void) {
+    fire_alarm_triggered = 1;
+    firealarm_state_latch_alarm(state);
+
+    /* Lock the mutex before modifying the shared data */
+    pthread_mutex_lock(&shared->mutex);
+
+    /* Set 'alarm' to 'A' */
+    shared->alarm = 'A';
+
+    /* Unlock the mutex */
+    pthread_mutex_unlock(&shared->mutex);
+
+    /* Signal the condition variable */
+    pthread_cond_signal(&shared->cond);
+
+    /* Send OPEN_EMERG# command to every registered door at once */
+    char alarm = 'A';
+    if (spsc_queue_push(&alarms, &alarm) == 0) {
+        wake(actuation_wake);
+    }
+}
+
+/* A call point has been activated */
+static void handle_fire(void) {
+    if (!fire_alarm_triggered) {        /* Proceed only if the alarm has not already been triggered */
+        raise_alarm();
+    }
+    else {
+        printf("Fire alarm already triggered. Ignoring repeated alert.\n");
+    }
+}
+
+/* A temperature reading over the threshold, possibly one of several sensors */
+static void handle_reading(const alarm_event *reading) {
+    /* Count the distinct sensors over the threshold within the detection period, this one included */
+    int sensors = detection_window_add(&detections, reading->sensor, reading->taken, reading->received);
+
+    /* Check if sufficient detections are met to trigger an alarm */
+    if (sensors >= min_detections && !fire_alarm_triggered) {
+        raise_alarm();
+    }
+}
+
+/* Decision thread */
+static void *decision_main(void *unused) {
+    (void)unused;
+    for (;;) {
+        wait_for(decision_wake);
+        alarm_event event;
+        while (spsc_queue_pop(&events, &event) == 0) {
+            if (event.kind == 'F') {
+                handle_fire();
+            } else {
+                handle_reading(&event);
+            }
+        }
+    }
+    return NULL;
+}
+
+/* A door registering: pass it on to the actuation thread and confirm with DREG. If that thread has fallen so far
+ * behind that its queue is full, the door gets no DREG rather than a confirmation that was not honoured */
+static void receive_door(int udp_sockfd, const door_datagram *door_data, const struct sockaddr_in *remote_addr) {
+    fanout_target door = { .addr = door_data->door_addr, .port = door_data->door_port };
+    if (spsc_queue_push(&registrations, &door) == -1) {
+        fprintf(stderr, "firealarm: registration queue full, door not confirmed\n");
+        return;
+    }
+    actuation_pending = 1;
+
+    door_confirmation confirmation;
+    memcpy(confirmation.header, "DREG", 4);         /* Copy the DREG to the header */
+    confirmation.door_addr = door_data->door_addr;  /* Copy the Door IP and port */
+    confirmation.door_port = door_data->door_port;
+
+    /* Send the DREG through the UDP*/
+    if (sendto(udp_sockfd, &confirmation, sizeof(confirmation), 0, (const struct sockaddr *)remote_addr, sizeof(*remote_addr)) < 0) {
+        perror("sendto(overseer) failed");
+    }
+}
+
+/* A call point has been activated. This is never dropped: if the decision queue is full, wait for room */
+static void receive_fire(void) {
+    alarm_event fire = { .kind = 'F' };
+    while (spsc_queue_push(&events, &fire) == -1) {
+        wake(decision_wake);
+        sched_yield();
+    }
+    decision_pending = 1;
+}
+
+/* A temperature reading, decoded where it lies in the receive slot. Only readings over the threshold go on to the
+ * decision thread; if it has fallen behind, they are dropped like readings lost in the network */
+static void receive_reading(const unsigned char *datagram, size_t len, long long received) {
+    temp_reading temp;
+    if (temp_wire_decode(datagram, len, &temp) == -1 || temp.temperature < temp_threshold) {
+        return;
+    }
+    alarm_event reading = { .kind = 'T', .sensor = temp.id, .taken = temp.timestamp, .received = received };
+    if (spsc_queue_push(&events, &reading) == 0) {
+        decision_pending = 1;
+    }
+}
+
+/* A TEMP datagram, holding one reading or a batch of them from a sensor passing readings on */
+static void receive_temp(const unsigned char *datagram, unsigned int len, long long received) {
+    if (!temp_wire_is_batch(datagram, len)) {
+        receive_reading(datagram, len, received);
+        return;
+    }
+    size_t offset = TEMP_WIRE_BATCH_HEADER, reading_len;
+    const unsigned char *reading;
+    while ((reading = temp_wire_batch_next(datagram, len, &offset, &reading_len)) != NULL) {
+        receive_reading(reading, reading_len, received);
+    }
+}
+
+/* Route one received datagram by its header. Datagrams too short for their type are dropped */
+static void dispatch(int udp_sockfd, const datagram *data, unsigned int len, const struct sockaddr_in *remote_addr,
+                     long long received) {
+    if (len < sizeof(data->header)) {
+        return;
+    }
+    if (memcmp(data->header, "DOOR", 4) == 0) {
+        if (len >= sizeof(door_datagram)) {
+            receive_door(udp_sockfd, &data->door, remote_addr);
+        }
+    }
+    else if (memcmp(data->header, "FIRE", 4) == 0) {
+        receive_fire();
+    }
+    else if (memcmp(data->header, "TEMP", 4) == 0) {
+        receive_temp(data->temp, len, received);
+    }
+}
+
+/* Receive slab, set up once in main: each recvmmsg() fills up to RECV_BATCH slots */
+static datagram slots[RECV_BATCH];
+static struct sockaddr_in senders[RECV_BATCH];
+static struct iovec iovecs[RECV_BATCH];
+static struct mmsghdr messages[RECV_BATCH];
+
+/* Take whatever is queued on a socket, up to one batch, and dispatch it. Returns the number of datagrams */
+static int receive_batch(int sockfd) {
+    for (int i = 0; i < RECV_BATCH; i++) {
+        messages[i].msg_hdr.msg_namelen = sizeof(senders[i]);
+    }
+    int received = recvmmsg(sockfd, messages, RECV_BATCH, MSG_DONTWAIT, NULL);
+    if (received < 0) {
+        if (errno != EAGAIN && errno != EINTR) {
+            perror("recvmmsg() failed");
+        }
+        return 0;
+    }
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    long long received_usec = (long long)now.tv_sec * 1000000 + now.tv_usec;
+    for (int i = 0; i < received; i++) {
+        dispatch(sockfd, &slots[i], messages[i].msg_len, &senders[i], received_usec);
+    }
+
+    /* one wake-up per batch for each thread that has been given work */
+    if (decision_pending) {
+        decision_pending = 0;
+        wake(decision_wake);
+    }
+    if (actuation_pending) {
+        actuation_pending = 0;
+        wake(actuation_wake);
+    }
+    return received;
+}
+
+/* A UDP socket bound to the fire alarm's address. Every socket bound there joins one SO_REUSEPORT group */
+static int open_udp_socket(const struct sockaddr_in *addr) {
+    int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sockfd < 0) {
+        perror("Cannot create UDP socket");
+        return -1;
+    }
+    int on = 1;
+    if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0) {
+        perror("setsockopt(SO_REUSEPORT)");
+    }
+
+    /* Binding the UDP socket to the local address and port */
+    if (bind(sockfd, (const struct sockaddr *)addr, sizeof(*addr)) < 0) {
+        perror("bind failed for UDP socket");
+        close(sockfd);
+        return -1;
+    }
+    return sockfd;
+}
+
+/* Subscribe to the multicast group a sensor network sends its readings to, given as group:port, on the interface
+ * with the unit's own address. The socket is bound to the group, so only its datagrams arrive there */
+static int open_group_socket(const char *group_addr_port, struct in_addr interface) {
+    struct sockaddr_in group;
+    if (tcp_parse_address(group_addr_port, &group) == -1 || !IN_MULTICAST(ntohl(group.sin_addr.s_addr))) {
+        fprintf(stderr, "Error: FIREALARM_GROUP should be a multicast group:port\n");
+        return -1;
+    }
+    int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+    int on = 1;
+    struct ip_mreq membership = { .imr_multiaddr = group.sin_addr, .imr_interface = interface };
+    if (sockfd < 0 || setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0
+        || bind(sockfd, (const struct sockaddr *)&group, sizeof(group)) < 0
+        || setsockopt(sockfd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership)) < 0) {
+        perror("Cannot join multicast group");
+        if (sockfd >= 0) {
+            close(sockfd);
+        }
+        return -1;
+    }
+    return sockfd;
+}
+
+/* Have the kernel deliver TEMP datagrams to the second socket of the group and everything else to the first, so
+ * a flood of sensor readings never queues in front of a callpoint's FIRE or a door registering. The filter sees
+ * the UDP payload; a datagram too short to load a header from goes to the first socket */
+static int steer_temp(int sockfd) {
+    struct sock_filter code[] = {
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 0),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x54454D50, 0, 1),     /* "TEMP" */
+        BPF_STMT(BPF_RET | BPF_K, 1),
+        BPF_STMT(BPF_RET | BPF_K, 0)
+    };
+    struct sock_fprog program = { .len = sizeof(code) / sizeof(code[0]), .filter = code };
+    return setsockopt(sockfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &program, sizeof(program));
+}
+
+/* Pick up where a previous run of this unit left off if it crashed: every door it knew is registered and warmed
+ * again, and an alarm that had gone off is raised again, which re-sends OPEN_EMERG# to all of them. A run that shut
+ * down in an orderly way removed its segment, so there is nothing to pick up; FIREALARM_RESET discards it anyway */
+static void restore_state(const char *udp_ip, int udp_port) {
+    struct timeval start, end;
+    gettimeofday(&start, NULL);
+
+    snprintf(state_name, sizeof(state_name), "/firealarm-%s-%d", udp_ip, udp_port);
+    const char *reset = getenv("FIREALARM_RESET");
+    state = firealarm_state_open(state_name, reset != NULL && reset[0] != '\0');
+    if (state == NULL) {
+        return;
+    }
+    unsigned int count = atomic_load_explicit(&state->door_count, memory_order_acquire);
+    for (unsigned int i = 0; i < count; i++) {
+        int added;
+        door_registry_add(&doors, &state->doors[i], &added);
+    }
+    door_pool_add_all(doors.doors, doors.count);
+    int latched = atomic_load(&state->alarm);
+    if (latched) {
+        raise_alarm();
+    }
+
+    gettimeofday(&end, NULL);
+    if (count > 0 || latched) {
+        printf("Restored %u doors%s in %.3fms\n", count, latched ? " and the alarm" : "",
+               ((end.tv_sec - start.tv_sec) * 1000000 + (end.tv_usec - start.tv_usec)) / 1000.0);
+        fflush(stdout);
+    }
+}
 
 /* Main function */
 int main(int argc, char **argv) {
     if (argc != 9) {
-        fprintf(stderr, "Usage: firealarm {address:port} {temperature threshold} {min detections} {detection period (in microseconds)} {reserved argument} {shared memory path} {shared memory offset} {overseer address:port}\n");
+        fprintf(stderr, "Usage: firealarm {address:port} {temperature threshold} {min detections} {detection period (in microseconds)} {reserved argument} {shared memory path} {shared memory offset} {overseer address:port}\n"
+                        "environment: FIREALARM_GROUP {multicast group:port} to also take readings sent to a group\n"
+                        "             FIREALARM_RESET=1 to forget the doors and alarm left by a run that crashed\n");
         return 1;
     }
 
     /* Initialisation of variables from arguments */
-    int temp_threshold = atoi(argv[2]);
-    int min_detections = atoi(argv[3]);
+    temp_threshold = atoi(argv[2]);
+    min_detections = atoi(argv[3]);
     int detection_period = atoi(argv[4]);
     char *shm_path = argv[6]; 
     int shm_offset = atoi(argv[7]); 
@@ -121,7 +511,7 @@ int main(int argc, char **argv) {
         exit(1);
     }
 
-    shm_alarm *shared = (shm_alarm *)(shm + shm_offset);    /* Pointer to the shared structure */
+    shared = (shm_alarm *)(shm + shm_offset);               /* Pointer to the shared structure */
     shared->alarm = '-';                                    /* Initially, the door is considered closed */
         
     /* Network setup for UDP */
@@ -145,53 +535,35 @@ int main(int argc, char **argv) {
         return EXIT_FAILURE;
     }
 
-    /* UDP socket creation */
-    int udp_sockfd = socket(AF_INET, SOCK_DGRAM, 0); 
+    /* UDP sockets: FIRE and DOOR datagrams arrive on udp_sockfd, TEMP on temp_sockfd when steering is available */
+    int udp_sockfd = open_udp_socket(&udp_servaddr);
     if (udp_sockfd < 0) {
-        perror("Cannot create UDP socket");
-        return EXIT_FAILURE;
-    }
-
-    /* Binding the UDP socket to the local address and port */
-    if (bind(udp_sockfd, (struct sockaddr*)&udp_servaddr, sizeof(udp_servaddr)) < 0) {
-        perror("bind failed for UDP socket");
         exit(EXIT_FAILURE);
     }
-
-    /* Connect to overseer and send initialisation message */
-    memset(&overseer_addr, 0, sizeof(overseer_addr));
-    overseer_addr.sin_family = AF_INET;
-
-    /* Parsing overseer IP address and port */
-    char *overseer_ip = strtok(overseer_addr_port, ":");
-    char *overseer_port_str = strtok(NULL, ":");
-    if (!overseer_ip || !overseer_port_str) {
-        perror("Error: Overseer address should be in the format ip:port\n");
-        exit(EXIT_FAILURE);
+    int temp_sockfd = open_udp_socket(&udp_servaddr);
+    if (temp_sockfd >= 0 && steer_temp(udp_sockfd) == -1) {
+        perror("Cannot steer TEMP datagrams to their own socket");
+        close(temp_sockfd);
+        temp_sockfd = -1;
     }
 
-    int overseer_port = atoi(overseer_port_str);
-    if (overseer_port == 0) {
-        perror("Error: Invalid port number\n");
+    /* Optionally also TEMP from sensors that multicast their readings to a group */
+    const char *group_addr_port = getenv("FIREALARM_GROUP");
+    int group_sockfd = -1;
+    if (group_addr_port != NULL && (group_sockfd = open_group_socket(group_addr_port, udp_servaddr.sin_addr)) < 0) {
         exit(EXIT_FAILURE);
     }
 
-    if (inet_pton(AF_INET, overseer_ip, &overseer_addr.sin_addr) <= 0) {
-        perror("Invalid overseer IP address\n");
+    /* Connect to overseer and send initialisation message */
+    if (tcp_parse_address(overseer_addr_port, &overseer_addr) == -1) {
+        fprintf(stderr, "Error: Overseer address should be in the format ip:port\n");
         exit(EXIT_FAILURE);
     }
-    overseer_addr.sin_port = htons(overseer_port);
 
     /* Communication setup with the overseer */
-    overseer_sock = socket(AF_INET, SOCK_STREAM, 0);
+    overseer_sock = tcp_connect_timeout(&overseer_addr, OVERSEER_TIMEOUT_MSEC);
     if (overseer_sock < 0) {
-        perror("Cannot create socket");
-        exit(EXIT_FAILURE);
-    }
-
-    if (connect(overseer_sock, (struct sockaddr*)&overseer_addr, sizeof(overseer_addr)) < 0) {
         perror("Connection to overseer failed");
-        close(overseer_sock);
         exit(EXIT_FAILURE);
     }
 
@@ -200,254 +572,110 @@ int main(int argc, char **argv) {
     snprintf(init_message, sizeof(init_message), "FIREALARM %s:%d HELLO#", udp_ip, udp_port);
     
     /* Send the initialisation message to the overseer */
-    ssize_t bytes_sent = send(overseer_sock, init_message, strlen(init_message), 0);
-    if (bytes_sent < 0) {
+    if (tcp_send_all(overseer_sock, init_message, strlen(init_message), OVERSEER_TIMEOUT_MSEC) == -1) {
         perror("Failed to send initialisation message to overseer");
         close(overseer_sock);  /* Close the overseer socket */
         exit(EXIT_FAILURE);
     }
  
-    /* Main Loop */
-    while (1) {
-        char buffer[BUFFER_SIZE];       /* Buffer for incoming data */
-        memset(buffer, 0, BUFFER_SIZE); /* Clear the buffer */
-
-        struct sockaddr_in remote_addr;             /* Address the structure for the sender */
-        socklen_t addr_len = sizeof(remote_addr);   /* Address length */
-
-        /* Receiving a datagram */
-        ssize_t rec_size = recvfrom(udp_sockfd, buffer, BUFFER_SIZE, 0, (struct sockaddr*)&remote_addr, &addr_len);
-        if (rec_size < 0) {
-            perror("recvfrom() failed");
-            continue; 
-        }  
-        
-        /* Check if data is received */
-        else if (rec_size == 0) {
-            perror("No data received.\n");
-            continue; 
-        }
+    /* Temperature detection window */
+    if (detection_window_init(&detections, detection_period) == -1) {
+        exit(EXIT_FAILURE);
+    }
 
-        /* Received bytes in the buffer */
-        door_datagram *door_data = (door_datagram *)buffer;
-        /* Check if its the door datagram */
-        if (memcmp(door_data->header, "DOOR", 4) == 0) { 
-            struct in_addr door_addr = door_data->door_addr; 
-            in_port_t door_port = door_data->door_port;    
-
-            door_confirmation confirmation;
-            memcpy(confirmation.header, "DREG", 4);         /* Copy the DREG to the header */
-            confirmation.door_addr = door_addr;             /* Copy the Door IP and port */
-            confirmation.door_port = door_port; 
-
-            /* Send the DREG through the UDP*/
-            ssize_t sent_size = sendto(udp_sockfd, &confirmation, sizeof(confirmation), 0, (struct sockaddr*)&remote_addr, sizeof(remote_addr));
-            if (sent_size < 0) {
-                perror("sendto(overseer) failed");
-                continue; 
-            }
-        } 
-        
-        
-        /* Check if it's a FIRE datagram */
-        else if (memcmp(buffer, "FIRE", 4) == 0) {             
-            if (!fire_alarm_triggered) {        /* Proceed only if the alarm has not already been triggered */               
-                fire_alarm_triggered = 1;       /* Set the flag so this block won't execute again unnecessarily */
-                /* Lock the mutex before modifying the shared data */
-                pthread_mutex_lock(&shared->mutex);
-
-                /* Set 'alarm' to 'A' */
-                shared->alarm = 'A';
-
-                /* Unlock the mutex */
-                pthread_mutex_unlock(&shared->mutex);
-
-                /* Signal the condition variable */
-                pthread_cond_signal(&shared->cond);
-
-                /* Send OPEN_EMERG# command to the door */
-                const char* command = "OPEN_EMERG#";
-
-                /* Communicate with each registered door */
-                for (int i = 0; i < door_count; i++) {                   
-                    struct sockaddr_in door_addr;
-                    door_addr.sin_family = AF_INET;
-                    door_addr.sin_addr = list_door[i].door_addr;
-                    door_addr.sin_port = list_door[i].door_port;
-
-                    /* Create a new socket for TCP connection */
-                    int door_sock = socket(AF_INET, SOCK_STREAM, 0);
-                    if (door_sock < 0) {
-                        perror("Cannot create socket");
-                        continue;  /* If a socket fails, continue to try the others */
-                    }
-
-                    /* Connect to the door */
-                    if (connect(door_sock, (struct sockaddr*)&door_addr, sizeof(door_addr)) < 0) {
-                        perror("Connection to door failed");
-                        close(door_sock);
-                        continue;  /* If a connection fails, continue to try the others */
-                    }
-
-                    ssize_t sent_bytes = send(door_sock, command, strlen(command), 0);
-                    if (sent_bytes < 0) {
-                        perror("Failed to send command to door");
-                    }
-
-                    /* Close the connection */
-                    close(door_sock);
-                }
+    /* SIGINT and SIGTERM end the receive loop through a signalfd; blocked before any thread starts, so every
+     * thread inherits the mask and none of them takes the signal instead */
+    sigset_t stop_signals;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop_signals, NULL);
+    int stop_fd = signalfd(-1, &stop_signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (stop_fd < 0) {
+        perror("signalfd()");
+        exit(EXIT_FAILURE);
+    }
 
-                while (fire_alarm_triggered) {  /* Loop to keep checking for DOOR registration */
-                    char door_buffer[BUFFER_SIZE];
-                    memset(door_buffer, 0, BUFFER_SIZE);
-
-                    struct sockaddr_in door_remote_addr;
-                    socklen_t door_addr_len = sizeof(door_remote_addr);
-
-                    /* Receiving a door datagram */
-                    ssize_t door_rec_size = recvfrom(udp_sockfd, door_buffer, BUFFER_SIZE, 0, (struct sockaddr*)&door_remote_addr, &door_addr_len);
-                    if (door_rec_size < 0) {
-                        perror("recvfrom() failed");
-                        continue;
-                    }
-
-                    /* Check if it's a DOOR datagram */
-                    if (memcmp(door_buffer, "DOOR", 4) == 0) {
-                        /* Extracting door information from the received datagram */
-                        door_datagram *new_door_data = (door_datagram *)door_buffer;
-
-                         /* Preparing the address of the new door based on the received data */
-                        struct sockaddr_in new_door_addr;
-                        memset(&new_door_addr, 0, sizeof(new_door_addr));
-                        new_door_addr.sin_family = AF_INET;
-                        new_door_addr.sin_addr = new_door_data->door_addr; /* assuming door_addr is in network byte order */
-                        new_door_addr.sin_port = new_door_data->door_port;
-
-                         /* Create a new socket for TCP connection to the new door */
-                        int new_door_sock = socket(AF_INET, SOCK_STREAM, 0);
-                        if (new_door_sock < 0) {
-                            perror("Cannot create socket for new door");
-                        } else {
-                            /* Connect to the new door. */
-                            if (connect(new_door_sock, (struct sockaddr*)&new_door_addr, sizeof(new_door_addr)) < 0) {
-                                perror("Connection to new door failed");
-                            } else {
-                                /* Send OPEN_EMERG# command to the new door */
-                                char emergency_command[] = "OPEN_EMERG#";
-                                ssize_t sent_emergency_bytes = send(new_door_sock, emergency_command, strlen(emergency_command), 0);
-                                if (sent_emergency_bytes < 0) {
-                                    perror("Failed to send OPEN_EMERG# command to new door");
-                                } else {
-                                    printf("OPEN_EMERG# command sent to new door.\n");
-                                }
-                            }
-                            close(new_door_sock); /* Close the socket whether or not the send was successful */
-                        }
-
-                        door_confirmation confirmation;
-                        memcpy(confirmation.header, "DREG", 4);
-                        confirmation.door_addr = door_data->door_addr;
-                        confirmation.door_port = door_data->door_port;
-
-                        ssize_t sent_size = sendto(udp_sockfd, &confirmation, sizeof(confirmation), 0, (struct sockaddr*)&overseer_addr, sizeof(overseer_addr));
-                        if (sent_size < 0) {
-                            perror("sendto(overseer) failed");
-                            continue;
-                        }
-                    }
+    /* Keep warm connections to doors as they register */
+    if (door_pool_start() == -1) {
+        exit(EXIT_FAILURE);
+    }
 
-                }
-            }
-            else { 
-                printf("Fire alarm already triggered. Ignoring repeated alert.\n");
-            }
+    /* Decision and actuation threads, fed by the receive loop below */
+    decision_wake = eventfd(0, EFD_CLOEXEC);
+    actuation_wake = eventfd(0, EFD_CLOEXEC);
+    if (decision_wake < 0 || actuation_wake < 0) {
+        perror("eventfd()");
+        exit(EXIT_FAILURE);
+    }
+    if (spsc_queue_init(&events, EVENT_QUEUE_SIZE, sizeof(alarm_event)) == -1
+        || spsc_queue_init(&registrations, REGISTRATION_QUEUE_SIZE, sizeof(fanout_target)) == -1
+        || spsc_queue_init(&alarms, 4, sizeof(char)) == -1) {
+        exit(EXIT_FAILURE);
+    }
+
+    /* Doors and alarm left by a previous run, before either thread starts using them */
+    restore_state(udp_ip, udp_port);
+
+    if (start_thread(decision_main) == -1 || start_thread(actuation_main) == -1) {
+        exit(EXIT_FAILURE);
+    }
+
+    /* Point each receive slot's message at its buffer and sender address */
+    for (int i = 0; i < RECV_BATCH; i++) {
+        iovecs[i].iov_base = &slots[i];
+        iovecs[i].iov_len = sizeof(slots[i]);
+        messages[i].msg_hdr.msg_iov = &iovecs[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+        messages[i].msg_hdr.msg_name = &senders[i];
+    }
+
+    /* Main Loop */
+    struct pollfd sockets[4] = { { .fd = stop_fd, .events = POLLIN }, { .fd = udp_sockfd, .events = POLLIN } };
+    int socket_count = 2;
+    if (temp_sockfd >= 0) {
+        sockets[socket_count++].fd = temp_sockfd;
+    }
+    if (group_sockfd >= 0) {
+        sockets[socket_count++].fd = group_sockfd;
+    }
+    for (int i = 2; i < socket_count; i++) {
+        sockets[i].events = POLLIN;
+    }
+    while (1) {
+        /* FIRE and DOOR go first, every time round: at most one batch of TEMP is handled between two looks */
+        int received = 0, batch;
+        while ((batch = receive_batch(udp_sockfd)) > 0) {
+            received += batch;
         }
-      
-        else if (memcmp(buffer, "TEMP", 4) == 0) {
-            /* Parse the datagram content */
-            struct datagram_format *temp_datagram = (struct datagram_format *)buffer;
-            
-            /* Check if the temperature is above the threshold and the data is recent */
-            if (temp_datagram->temperature >= temp_threshold) {
-                /* Get current time */
-                struct timeval current_time;
-                gettimeofday(&current_time, NULL);
-                long long current_timestamp = (long long)current_time.tv_sec * 1000000 + current_time.tv_usec;
-
-                /* Check the age of the detection */
-                if ((current_timestamp - (long long)temp_datagram->timestamp.tv_sec * 1000000 - temp_datagram->timestamp.tv_usec) <= detection_period) {
-                    int i = 0;
-                    while (i < detection_count) {
-                        if ((current_timestamp - detection_timestamps[i]) > detection_period) {
-                            /* Remove the old detection by shifting the later entries forward */
-                            for (int j = i; j < detection_count - 1; j++) {
-                                detection_timestamps[j] = detection_timestamps[j + 1];
-                            }
-                            detection_count--;
-                        } else {
-                            i++;
-                        }
-                    }
-
-                    /* Add new detection timestamp */
-                    if (detection_count < MAX_DETECTIONS) {
-                        detection_timestamps[detection_count++] = (long long)temp_datagram->timestamp.tv_sec * 1000000 + temp_datagram->timestamp.tv_usec;
-                    }
-
-                    /* Check if sufficient detections are met to trigger an alarm */
-                    if (detection_count >= min_detections) {
-                        /* Lock the mutex before modifying the shared data */
-                        pthread_mutex_lock(&shared->mutex);
-
-                        /* Set 'alarm' to 'A' */
-                        shared->alarm = 'A';
-
-                        /* Unlock the mutex */
-                        pthread_mutex_unlock(&shared->mutex);
-
-                        /* Signal the condition variable */
-                        pthread_cond_signal(&shared->cond);
-
-                        /* Send OPEN_EMERG# command to the door */
-                        const char* command = "OPEN_EMERG#";
-
-                        /* Communicate with each registered door */
-                        for (int i = 0; i < door_count; i++) {
-                            struct sockaddr_in door_addr;
-                            door_addr.sin_family = AF_INET;
-                            door_addr.sin_addr = list_door[i].door_addr;
-                            door_addr.sin_port = list_door[i].door_port;
-
-                            /* Create a new socket for TCP connection */
-                            int door_sock = socket(AF_INET, SOCK_STREAM, 0);
-                            if (door_sock < 0) {
-                                perror("Cannot create socket");
-                                continue;  /* If a socket fails, continue to try the others */
-                            }
-
-                            /* Connect to the door */
-                            if (connect(door_sock, (struct sockaddr *)&door_addr, sizeof(door_addr)) < 0) {
-                                perror("Connection to door failed");
-                                close(door_sock);
-                                continue;  /* If a connection fails, continue to try the others */
-                            }
-
-                            ssize_t sent_bytes = send(door_sock, command, strlen(command), 0);
-                            if (sent_bytes < 0) {
-                                perror("Failed to send command to door");
-                            }
-
-                            /* Close the connection */
-                            close(door_sock);
-                        }
-                    }
-                }
+        if (temp_sockfd >= 0) {
+            received += receive_batch(temp_sockfd);
+        }
+        if (group_sockfd >= 0) {
+            received += receive_batch(group_sockfd);
+        }
+
+        /* wait only when every socket is empty, but look for a stop signal even under a flood */
+        if (poll(sockets, socket_count, received == 0 ? -1 : 0) < 0) {
+            if (errno != EINTR) {
+                perror("poll() failed");
             }
+        } else if (sockets[0].revents & POLLIN) {
+            break;
         }
     }
+
+    /* an orderly shutdown: the next run starts afresh */
+    firealarm_state_remove(state, state_name);
     munmap(shm, shm_stat.st_size);
     close(udp_sockfd); /* UDP socket for fire alarm system */
+    if (temp_sockfd >= 0) {
+        close(temp_sockfd);
+    }
+    if (group_sockfd >= 0) {
+        close(group_sockfd);
+    }
     close(overseer_sock); /* TCP socket for communication with the overseer */
+    close(stop_fd);
     return 0;  /* Successful exit */
 }
\ No newline at end of file
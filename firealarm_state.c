@@ -0,0 +1,74 @@
+/*
+ * Fire alarm unit state kept in shared memory across restarts. See firealarm_state.h.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "firealarm_state.h"
+
+firealarm_state *firealarm_state_open(const char *name, int reset)
+{
+    int fd = shm_open(name, O_RDWR | O_CREAT, 0600);
+    if (fd == -1) {
+        perror("shm_open(state)");
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (st.st_size != sizeof(firealarm_state) && ftruncate(fd, sizeof(firealarm_state)) == -1)) {
+        perror("firealarm_state_open");
+        close(fd);
+        return NULL;
+    }
+    firealarm_state *state = mmap(NULL, sizeof(firealarm_state), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (state == MAP_FAILED) {
+        perror("mmap(state)");
+        return NULL;
+    }
+
+    /* a new segment, one left by an incompatible build, or one being reset starts out empty; the door table is
+     * only ever read up to door_count, so the rest of it is left untouched */
+    if (reset || st.st_size != sizeof(firealarm_state) || state->magic != STATE_MAGIC || state->version != STATE_VERSION
+        || atomic_load(&state->door_count) > STATE_MAX_DOORS) {
+        atomic_store(&state->alarm, 0);
+        atomic_store(&state->door_count, 0);
+        state->version = STATE_VERSION;
+        state->magic = STATE_MAGIC;
+    }
+    return state;
+}
+
+void firealarm_state_remove(firealarm_state *state, const char *name)
+{
+    if (state == NULL) {
+        return;
+    }
+    munmap(state, sizeof(firealarm_state));
+    if (shm_unlink(name) == -1) {
+        perror("shm_unlink(state)");
+    }
+}
+
+void firealarm_state_add_door(firealarm_state *state, const fanout_target *door)
+{
+    if (state == NULL) {
+        return;
+    }
+    unsigned int count = atomic_load_explicit(&state->door_count, memory_order_relaxed);
+    if (count == STATE_MAX_DOORS) {
+        return;
+    }
+    state->doors[count] = *door;
+    atomic_store_explicit(&state->door_count, count + 1, memory_order_release);
+}
+
+void firealarm_state_latch_alarm(firealarm_state *state)
+{
+    if (state != NULL) {
+        atomic_store(&state->alarm, 1);
+    }
+}
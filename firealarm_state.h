@@ -0,0 +1,46 @@
+/*
+ * State a fire alarm unit keeps across a restart.
+ *
+ * The doors that have registered and whether the alarm has gone off live in a shared memory segment of their own,
+ * named after the unit's UDP address, so they outlive the process but not the machine. Doors are appended as they
+ * register and published by bumping a counter after the entry is written, so a unit killed at any point leaves a
+ * consistent list behind. A unit restarted after a crash reloads the list and latch before it receives anything,
+ * and is ready to open every door without waiting for them to register again.
+ *
+ * A unit shut down in an orderly way, by SIGINT or SIGTERM, removes its segment on the way out, so the next run
+ * starts afresh rather than raising an alarm that was dealt with or opening doors that may be gone. Setting
+ * FIREALARM_RESET discards whatever a crashed run left behind.
+*/
+
+#ifndef FIREALARM_STATE_H
+#define FIREALARM_STATE_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include "door_fanout.h"
+
+#define STATE_MAGIC 0x46414c53u     /* "FALS" */
+#define STATE_VERSION 1
+#define STATE_MAX_DOORS 65536       /* doors registering beyond this still work, they are just not remembered */
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    atomic_uint alarm;              /* 1 once the alarm has gone off */
+    atomic_uint door_count;         /* entries of doors that are complete */
+    fanout_target doors[STATE_MAX_DOORS];
+} firealarm_state;
+
+/* Map the state segment called name, creating it empty if it does not exist, is not a valid state segment, or
+ * reset is set. Returns NULL on failure, in which case the unit runs without remembering anything */
+firealarm_state *firealarm_state_open(const char *name, int reset);
+
+/* Unmap the segment and remove it, on an orderly shutdown */
+void firealarm_state_remove(firealarm_state *state, const char *name);
+
+/* Remember a door that has registered for the first time. Only the thread that owns the door registry calls this */
+void firealarm_state_add_door(firealarm_state *state, const fanout_target *door);
+
+void firealarm_state_latch_alarm(firealarm_state *state);
+
+#endif
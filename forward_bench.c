@@ -0,0 +1,154 @@
+/*
+ * Forwarding benchmark for tempsensor.
+ * Stops a running tempsensor, queues compact TEMP readings on its UDP port that have already been through
+ * {route address:port}, lets it run again and times how long it takes to pass them all on, from /proc/net/udp, and
+ * how much CPU that took, from /proc/{pid}/stat. Every reading is passed on to each of the sensor's receivers except
+ * the one on its route, so with r receivers the sensor sends r - 1 datagrams per reading.
+ *
+ * Each reading has its own timestamp, so none is dropped as already seen. How many can be queued is bounded by the
+ * socket's receive buffer; raise net.core.rmem_default before starting the tempsensor to queue more. Readings the
+ * kernel dropped are left out of the count. A {wire version} of 2 sends readings without the hop count, for
+ * tempsensors from before it was added.
+*/
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "temp_wire.h"
+#include "tcp_communication.h"
+
+#define READING_SENSOR 5    /* a sensor id other than the benchmarked one's */
+
+/* Bytes queued and datagrams dropped over every socket bound to port */
+static void udp_port_stats(in_port_t port, long *queued, long *drops)
+{
+    *queued = *drops = 0;
+    FILE *udp = fopen("/proc/net/udp", "r");
+    if (udp == NULL) {
+        perror("forward_bench: /proc/net/udp");
+        exit(1);
+    }
+    char line[512];
+    char local[64];
+    unsigned int tx, rx;
+    long line_drops;
+    if (fgets(line, sizeof(line), udp) == NULL) {    /* column headings */
+        fclose(udp);
+        return;
+    }
+    while (fgets(line, sizeof(line), udp) != NULL) {
+        char *last = strrchr(line, ' ');
+        if (sscanf(line, "%*d: %63s %*s %*x %x:%x", local, &tx, &rx) != 3 || last == NULL) {
+            continue;
+        }
+        line_drops = atol(last + 1);
+        char *colon = strchr(local, ':');
+        if (colon != NULL && strtoul(colon + 1, NULL, 16) == port) {
+            *queued += rx;
+            *drops += line_drops;
+        }
+    }
+    fclose(udp);
+}
+
+/* User plus system CPU time of a process, in clock ticks */
+static long cpu_ticks(pid_t pid)
+{
+    char path[64], stat[1024];
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    FILE *file = fopen(path, "r");
+    if (file == NULL || fgets(stat, sizeof(stat), file) == NULL) {
+        perror("forward_bench: /proc/{pid}/stat");
+        exit(1);
+    }
+    fclose(file);
+    /* the command name may hold spaces; the fields counted here start after its closing parenthesis */
+    long utime, stime;
+    if (sscanf(strrchr(stat, ')') + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %ld %ld", &utime, &stime) != 2) {
+        return 0;
+    }
+    return utime + stime;
+}
+
+static double now_sec(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 5 && argc != 6) {
+        fprintf(stderr, "usage: forward_bench {tempsensor pid} {tempsensor address:port} {route address:port} "
+                "{readings} [{wire version}]\n");
+        exit(1);
+    }
+    pid_t pid = (pid_t)atoi(argv[1]);
+    struct sockaddr_in sensor, route;
+    if (tcp_parse_address(argv[2], &sensor) < 0 || tcp_parse_address(argv[3], &route) < 0) {
+        fprintf(stderr, "forward_bench: addresses should be in the format ip:port\n");
+        exit(1);
+    }
+    long count = atol(argv[4]);
+    int version = argc == 6 ? atoi(argv[5]) : TEMP_WIRE_VERSION;
+    if (version != 2 && version != TEMP_WIRE_VERSION) {
+        fprintf(stderr, "forward_bench: wire version should be 2 or %d\n", TEMP_WIRE_VERSION);
+        exit(1);
+    }
+
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&sensor, sizeof(sensor)) < 0) {
+        perror("forward_bench: socket");
+        exit(1);
+    }
+
+    temp_wire_address sender = { .addr = route.sin_addr, .port = ntohs(route.sin_port) };
+    struct timeval start_time;
+    gettimeofday(&start_time, NULL);
+    long long timestamp = (long long)start_time.tv_sec * 1000000 + start_time.tv_usec;
+    unsigned char encoded[TEMP_WIRE_COMPACT_MAX];
+
+    in_port_t port = ntohs(sensor.sin_port);
+    long queued, drops_before, drops_after;
+    if (kill(pid, SIGSTOP) == -1) {
+        perror("forward_bench: kill()");
+        exit(1);
+    }
+    udp_port_stats(port, &queued, &drops_before);
+    for (long i = 0; i < count; i++) {
+        size_t len = temp_wire_encode(encoded, TEMP_WIRE_HOP_LIMIT - 1, timestamp - count + i, 20, READING_SENSOR,
+                                      &sender, 1);
+        if (version == 2) {
+            /* version 2 is the same without the hop byte after the version */
+            encoded[4] = 2;
+            memmove(encoded + 5, encoded + 6, len - 6);
+            len--;
+        }
+        send(fd, encoded, len, 0);
+    }
+    udp_port_stats(port, &queued, &drops_after);
+    long received = count - (drops_after - drops_before);
+
+    long ticks = cpu_ticks(pid);
+    double start = now_sec();
+    kill(pid, SIGCONT);
+    while (queued > 0) {
+        usleep(1000);
+        udp_port_stats(port, &queued, &drops_after);
+    }
+    double wall = now_sec() - start;
+    double cpu = (double)(cpu_ticks(pid) - ticks) / sysconf(_SC_CLK_TCK);
+
+    printf("forward_bench: passed on %ld readings in %.0fms wall, %.2fs CPU: %.0f/s wall, %.0f/s per core\n",
+           received, wall * 1e3, cpu, received / wall, cpu > 0 ? received / cpu : 0);
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,148 @@
+/*
+ * Datagram ingestion benchmark for the fire alarm unit.
+ * Stops a running fire alarm unit, queues TEMP datagrams below its threshold on its UDP port, lets it run again and
+ * times how long it takes to drain its receive queue, from /proc/net/udp, and how much CPU that took, from
+ * /proc/{pid}/stat. The result is datagrams/sec per core for the receive path alone.
+ *
+ * How many datagrams can be queued is bounded by the socket's receive buffer; raise net.core.rmem_default before
+ * starting the fire alarm unit to queue more. Datagrams the kernel dropped are left out of the count.
+*/
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "temp_wire.h"
+#include "tcp_communication.h"
+
+/* Bytes queued and datagrams dropped over every socket bound to port */
+static void udp_port_stats(in_port_t port, long *queued, long *drops)
+{
+    *queued = *drops = 0;
+    FILE *udp = fopen("/proc/net/udp", "r");
+    if (udp == NULL) {
+        perror("ingest_bench: /proc/net/udp");
+        exit(1);
+    }
+    char line[512];
+    char local[64];
+    unsigned int tx, rx;
+    long line_drops;
+    if (fgets(line, sizeof(line), udp) == NULL) {    /* column headings */
+        fclose(udp);
+        return;
+    }
+    while (fgets(line, sizeof(line), udp) != NULL) {
+        char *last = strrchr(line, ' ');
+        if (sscanf(line, "%*d: %63s %*s %*x %x:%x", local, &tx, &rx) != 3 || last == NULL) {
+            continue;
+        }
+        line_drops = atol(last + 1);
+        char *colon = strchr(local, ':');
+        if (colon != NULL && strtoul(colon + 1, NULL, 16) == port) {
+            *queued += rx;
+            *drops += line_drops;
+        }
+    }
+    fclose(udp);
+}
+
+/* User plus system CPU time of a process, in clock ticks */
+static long cpu_ticks(pid_t pid)
+{
+    char path[64], stat[1024];
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    FILE *file = fopen(path, "r");
+    if (file == NULL || fgets(stat, sizeof(stat), file) == NULL) {
+        perror("ingest_bench: /proc/{pid}/stat");
+        exit(1);
+    }
+    fclose(file);
+    /* the command name may hold spaces; the fields counted here start after its closing parenthesis */
+    long utime, stime;
+    if (sscanf(strrchr(stat, ')') + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %ld %ld", &utime, &stime) != 2) {
+        return 0;
+    }
+    return utime + stime;
+}
+
+static double now_sec(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 5 || (strcmp(argv[4], "compact") != 0 && strcmp(argv[4], "legacy") != 0)) {
+        fprintf(stderr, "usage: ingest_bench {fire alarm pid} {fire alarm address:port} {datagrams} {compact | legacy}\n");
+        exit(1);
+    }
+    pid_t pid = (pid_t)atoi(argv[1]);
+    struct sockaddr_in firealarm;
+    if (tcp_parse_address(argv[2], &firealarm) < 0) {
+        fprintf(stderr, "ingest_bench: address should be in the format ip:port\n");
+        exit(1);
+    }
+    long count = atol(argv[3]);
+    int compact = strcmp(argv[4], "compact") == 0;
+
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&firealarm, sizeof(firealarm)) < 0) {
+        perror("ingest_bench: socket");
+        exit(1);
+    }
+
+    /* a cool reading from sensor 1, which the fire alarm unit receives and discards */
+    struct datagram_format legacy;
+    memset(&legacy, 0, sizeof(legacy));
+    memcpy(legacy.header, "TEMP", 4);
+    gettimeofday(&legacy.timestamp, NULL);
+    legacy.temperature = 20;
+    legacy.id = 1;
+    legacy.address_count = 1;
+    legacy.address_list[0].sensor_addr.s_addr = htonl(INADDR_LOOPBACK);
+    legacy.address_list[0].sensor_port = 3000;
+    temp_wire_address sender = { .addr = legacy.address_list[0].sensor_addr, .port = 3000 };
+    unsigned char encoded[TEMP_WIRE_COMPACT_MAX];
+    long long timestamp = (long long)legacy.timestamp.tv_sec * 1000000 + legacy.timestamp.tv_usec;
+    size_t encoded_len = temp_wire_encode(encoded, TEMP_WIRE_HOP_LIMIT, timestamp, 20, 1, &sender, 1);
+
+    in_port_t port = ntohs(firealarm.sin_port);
+    long queued, drops_before, drops_after;
+    if (kill(pid, SIGSTOP) == -1) {
+        perror("ingest_bench: kill()");
+        exit(1);
+    }
+    udp_port_stats(port, &queued, &drops_before);
+    for (long i = 0; i < count; i++) {
+        if (compact) {
+            send(fd, encoded, encoded_len, 0);
+        } else {
+            send(fd, &legacy, sizeof(legacy), 0);
+        }
+    }
+    udp_port_stats(port, &queued, &drops_after);
+    long received = count - (drops_after - drops_before);
+
+    long ticks = cpu_ticks(pid);
+    double start = now_sec();
+    kill(pid, SIGCONT);
+    while (queued > 0) {
+        usleep(1000);
+        udp_port_stats(port, &queued, &drops_after);
+    }
+    double wall = now_sec() - start;
+    double cpu = (double)(cpu_ticks(pid) - ticks) / sysconf(_SC_CLK_TCK);
+
+    printf("ingest_bench: drained %ld %s datagrams in %.0fms wall, %.2fs CPU: %.0f/s wall, %.0f/s per core\n",
+           received, argv[4], wall * 1e3, cpu, received / wall, cpu > 0 ? received / cpu : 0);
+    close(fd);
+    return 0;
+}
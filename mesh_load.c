@@ -0,0 +1,160 @@
+/*
+ * Load generator for a network of relaying tempsensors.
+ * Emulates LOAD_SENSORS leaf sensors sending {readings per second} between them, below or over a threshold as
+ * {temperature} says, for {seconds}. Readings are spread over {relays} tempsensors listening on 127.0.0.1 from
+ * {first relay port} on, which pass them on to each other and to the fire alarm unit as they are configured to.
+ *
+ * Afterwards it reports, from /proc/net/snmp, the UDP datagrams the relays sent per second (every datagram sent on
+ * the host, less its own) and the datagrams dropped for want of receive buffer space anywhere on the host, and,
+ * from /proc/{pid}/stat, the CPU used by each {pid} given, as a share of one core. Run it on an otherwise quiet
+ * host; everything else sending UDP is counted as relay traffic.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "temp_wire.h"
+
+#define LOAD_SENSORS 1000
+#define LOAD_FIRST_ID 1000          /* leaf sensor n has id LOAD_FIRST_ID + n and port LOAD_LEAF_PORT + n */
+#define LOAD_LEAF_PORT 20000
+#define LOAD_TICK_NSEC 1000000
+#define LOAD_SETTLE_USEC 300000     /* let the relays finish with the last readings before counting */
+#define MAX_PIDS 64
+
+typedef struct {
+    long out_datagrams;
+    long rcvbuf_errors;
+} udp_counters;
+
+static void read_udp_counters(udp_counters *counters)
+{
+    FILE *snmp = fopen("/proc/net/snmp", "r");
+    if (snmp == NULL) {
+        perror("mesh_load: /proc/net/snmp");
+        exit(1);
+    }
+    /* a line of Udp: column names, then a line of Udp: values */
+    char names[1024], values[1024];
+    int found = 0;
+    while (!found && fgets(names, sizeof(names), snmp) != NULL) {
+        found = strncmp(names, "Udp:", 4) == 0 && fgets(values, sizeof(values), snmp) != NULL;
+    }
+    fclose(snmp);
+    if (!found) {
+        fprintf(stderr, "mesh_load: no Udp counters in /proc/net/snmp\n");
+        exit(1);
+    }
+    counters->out_datagrams = counters->rcvbuf_errors = 0;
+    char *name_save, *value_save;
+    char *name = strtok_r(names, " \n", &name_save), *value = strtok_r(values, " \n", &value_save);
+    while (name != NULL && value != NULL) {
+        if (strcmp(name, "OutDatagrams") == 0) {
+            counters->out_datagrams = atol(value);
+        } else if (strcmp(name, "RcvbufErrors") == 0) {
+            counters->rcvbuf_errors = atol(value);
+        }
+        name = strtok_r(NULL, " \n", &name_save);
+        value = strtok_r(NULL, " \n", &value_save);
+    }
+}
+
+/* User plus system CPU time of a process, in clock ticks */
+static long cpu_ticks(pid_t pid)
+{
+    char path[64], stat[1024];
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    FILE *file = fopen(path, "r");
+    if (file == NULL || fgets(stat, sizeof(stat), file) == NULL) {
+        perror("mesh_load: /proc/{pid}/stat");
+        exit(1);
+    }
+    fclose(file);
+    /* the command name may hold spaces; the fields counted here start after its closing parenthesis */
+    long utime, stime;
+    if (sscanf(strrchr(stat, ')') + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %ld %ld", &utime, &stime) != 2) {
+        return 0;
+    }
+    return utime + stime;
+}
+
+static long long now_usec(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (long long)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 6 || argc - 6 > MAX_PIDS) {
+        fprintf(stderr, "usage: mesh_load {readings per second} {seconds} {first relay port} {relays} {temperature} "
+                "[{pid}...]\n");
+        exit(1);
+    }
+    long rate = atol(argv[1]);
+    double seconds = atof(argv[2]);
+    int first_port = atoi(argv[3]);
+    int relays = atoi(argv[4]);
+    float temperature = atof(argv[5]);
+    int pid_count = argc - 6;
+    if (rate <= 0 || seconds <= 0 || first_port <= 0 || relays < 1 || first_port + relays > 65536) {
+        fprintf(stderr, "mesh_load: a positive rate and duration, and relay ports that fit below 65536\n");
+        exit(1);
+    }
+
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        perror("mesh_load: socket");
+        exit(1);
+    }
+    struct sockaddr_in relay = { .sin_family = AF_INET };
+    relay.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    temp_wire_address leaf = { .port = LOAD_LEAF_PORT };
+    inet_pton(AF_INET, "10.0.0.1", &leaf.addr);
+    unsigned char reading[TEMP_WIRE_COMPACT_MAX];
+
+    udp_counters before, after;
+    long ticks_before[MAX_PIDS];
+    read_udp_counters(&before);
+    for (int i = 0; i < pid_count; i++) {
+        ticks_before[i] = cpu_ticks((pid_t)atoi(argv[6 + i]));
+    }
+
+    /* send whatever the rate says is due, once a millisecond, the leaf sensors taking turns */
+    long long start = now_usec(), end = start + (long long)(seconds * 1e6);
+    long sent = 0;
+    int sensor = 0;
+    struct timespec tick = { 0, LOAD_TICK_NSEC };
+    for (long long now = start; now < end; now = now_usec()) {
+        long long due = (now - start) * rate / 1000000;
+        for (; sent < due; sent++) {
+            leaf.port = LOAD_LEAF_PORT + sensor;
+            size_t len = temp_wire_encode(reading, TEMP_WIRE_HOP_LIMIT, now, temperature,
+                                          (uint16_t)(LOAD_FIRST_ID + sensor), &leaf, 1);
+            relay.sin_port = htons(first_port + sensor % relays);
+            sendto(fd, reading, len, 0, (struct sockaddr *)&relay, sizeof(relay));
+            sensor = (sensor + 1) % LOAD_SENSORS;
+        }
+        nanosleep(&tick, NULL);
+    }
+    usleep(LOAD_SETTLE_USEC);
+
+    read_udp_counters(&after);
+    double ticks_per_sec = sysconf(_SC_CLK_TCK);
+    printf("mesh_load: %.0f readings/s from %d sensors; relays sent %.0f datagrams/s; %ld receive buffer drops\n",
+           sent / seconds, LOAD_SENSORS, (after.out_datagrams - before.out_datagrams - sent) / seconds,
+           after.rcvbuf_errors - before.rcvbuf_errors);
+    for (int i = 0; i < pid_count; i++) {
+        pid_t pid = (pid_t)atoi(argv[6 + i]);
+        printf("mesh_load: pid %d used %.1f%% CPU\n", (int)pid,
+               100.0 * (cpu_ticks(pid) - ticks_before[i]) / ticks_per_sec / seconds);
+    }
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,160 @@
+/*
+ * Flooding simulation for tempsensor networks.
+ * Passes one reading through 500 simulated sensors wired as a ring, a 25 x 20 grid or a full mesh, each sensor
+ * sending to all of its neighbours, and counts the datagrams it takes. Every hop runs the real temp_wire and
+ * seen_cache code: "after" drops readings a sensor has already seen or that have no hops left, as tempsensor does,
+ * while "before" only skips receivers already in the address list, as tempsensor did before the seen-cache.
+ *
+ * Flooding "before" may never stop; the simulation gives up at SIM_MAX_DATAGRAMS, or when the datagrams in flight
+ * outgrow its queue, and says so.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include "temp_wire.h"
+#include "seen_cache.h"
+
+#define SIM_SENSORS 500
+#define SIM_GRID_WIDTH 25
+#define SIM_FIRST_PORT 10000            /* sensor n listens on 127.0.0.1:SIM_FIRST_PORT + n */
+#define SIM_MAX_DATAGRAMS 20000000LL
+#define SIM_QUEUE_SIZE (1 << 22)        /* datagrams in flight */
+#define SIM_TIMESTAMP 1700000000000000LL
+
+typedef struct {
+    int to;
+    size_t len;
+    unsigned char data[TEMP_WIRE_COMPACT_MAX];
+} sim_datagram;
+
+static int neighbours[SIM_SENSORS][SIM_SENSORS];
+static int neighbour_count[SIM_SENSORS];
+static seen_cache caches[SIM_SENSORS];
+static char reached[SIM_SENSORS];
+
+static sim_datagram *queue;
+static long long queue_head, queue_tail;
+
+static void link_one_way(int from, int to)
+{
+    neighbours[from][neighbour_count[from]++] = to;
+}
+
+static void link_both_ways(int a, int b)
+{
+    link_one_way(a, b);
+    link_one_way(b, a);
+}
+
+/* Returns 0, or -1 if the topology is not known */
+static int build(const char *topology)
+{
+    if (strcmp(topology, "ring") == 0) {
+        for (int i = 0; i < SIM_SENSORS; i++) {
+            link_both_ways(i, (i + 1) % SIM_SENSORS);
+        }
+    } else if (strcmp(topology, "grid") == 0) {
+        for (int i = 0; i < SIM_SENSORS; i++) {
+            if ((i + 1) % SIM_GRID_WIDTH != 0) {
+                link_both_ways(i, i + 1);
+            }
+            if (i + SIM_GRID_WIDTH < SIM_SENSORS) {
+                link_both_ways(i, i + SIM_GRID_WIDTH);
+            }
+        }
+    } else if (strcmp(topology, "mesh") == 0) {
+        for (int i = 0; i < SIM_SENSORS; i++) {
+            for (int j = 0; j < SIM_SENSORS; j++) {
+                if (i != j) {
+                    link_one_way(i, j);
+                }
+            }
+        }
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+static void push(int to, const unsigned char *data, size_t len)
+{
+    sim_datagram *datagram = &queue[queue_tail++ % SIM_QUEUE_SIZE];
+    datagram->to = to;
+    datagram->len = len;
+    memcpy(datagram->data, data, len);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 3 || (strcmp(argv[2], "before") != 0 && strcmp(argv[2], "after") != 0) || build(argv[1]) == -1) {
+        fprintf(stderr, "usage: mesh_sim {ring | grid | mesh} {before | after}\n");
+        exit(1);
+    }
+    int after = strcmp(argv[2], "after") == 0;
+    queue = malloc(SIM_QUEUE_SIZE * sizeof(*queue));
+    if (queue == NULL) {
+        perror("mesh_sim");
+        exit(1);
+    }
+    for (int i = 0; i < SIM_SENSORS; i++) {
+        seen_cache_init(&caches[i]);
+    }
+
+    /* sensor 0 takes a reading and sends it to its neighbours */
+    temp_wire_address origin = { .port = SIM_FIRST_PORT };
+    origin.addr.s_addr = htonl(INADDR_LOOPBACK);
+    unsigned char reading[TEMP_WIRE_COMPACT_MAX];
+    size_t len = temp_wire_encode(reading, TEMP_WIRE_HOP_LIMIT, SIM_TIMESTAMP, 25, 0, &origin, 1);
+    seen_cache_add(&caches[0], 0, SIM_TIMESTAMP);
+    long long sent = 0;
+    reached[0] = 1;
+    for (int j = 0; j < neighbour_count[0]; j++) {
+        push(neighbours[0][j], reading, len);
+        sent++;
+    }
+
+    /* each sensor in turn takes the next datagram addressed to it and passes it on */
+    int gave_up = 0;
+    while (queue_head < queue_tail) {
+        if (sent >= SIM_MAX_DATAGRAMS || queue_tail - queue_head > SIM_QUEUE_SIZE - SIM_SENSORS) {
+            gave_up = 1;
+            break;
+        }
+        sim_datagram *datagram = &queue[queue_head++ % SIM_QUEUE_SIZE];
+        int sensor = datagram->to;
+        reached[sensor] = 1;
+        unsigned char passed_on[TEMP_WIRE_COMPACT_MAX];
+        memcpy(passed_on, datagram->data, datagram->len);
+        temp_reading decoded;
+        if (temp_wire_decode(passed_on, datagram->len, &decoded) == -1) {
+            continue;
+        }
+        if (after && (decoded.hops <= 0 || seen_cache_add(&caches[sensor], decoded.id, decoded.timestamp))) {
+            continue;
+        }
+        if (!after && decoded.hops <= 0) {
+            /* before the hop count, nothing stopped a reading */
+            decoded.hops = TEMP_WIRE_HOP_LIMIT;
+        }
+        temp_wire_address self = { .addr = origin.addr, .port = SIM_FIRST_PORT + sensor };
+        size_t passed_len = temp_wire_append_address(passed_on, &decoded, &self);
+        for (int j = 0; j < neighbour_count[sensor]; j++) {
+            int to = neighbours[sensor][j];
+            if (!temp_wire_contains(&decoded, origin.addr, SIM_FIRST_PORT + to)) {
+                push(to, passed_on, passed_len);
+                sent++;
+            }
+        }
+    }
+
+    int reached_count = 0;
+    for (int i = 0; i < SIM_SENSORS; i++) {
+        reached_count += reached[i];
+    }
+    printf("mesh_sim: %s %s: %s%lld datagrams%s, %d of %d sensors reached\n", argv[1], argv[2], gave_up ? ">" : "",
+           sent, gave_up ? " and still going, gave up" : "", reached_count, SIM_SENSORS);
+    free(queue);
+    return 0;
+}
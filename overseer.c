@@ -1,3 +1,13 @@
+/*
+ * This is the main executable file for the overseer, the central controller of the access control system.
+ * Card readers, doors and fire alarm units connect to it over TCP and exchange '#'-terminated messages.
+ * All device connections are served by a single non-blocking epoll loop, so thousands of devices can be
+ * registered at once without a thread per connection. Work that has to block (a command and its reply from a
+ * door controller) is handed to a small pool of worker threads; the wait while a door stands open is a timer on the
+ * event loop, so it holds no worker.
+*/
+
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <pthread.h>
@@ -7,11 +17,34 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/time.h>
 #include <time.h>
+#include "auth_index.h"
+#include "tcp_communication.h"
+#include "topology.h"
+
+#define MAX_EVENTS 256
+#define LISTEN_BACKLOG 4096
+#define DOOR_REPLY_SIZE 128
+#define WORKER_COUNT 4
+#define DOOR_TIMEOUT_MSEC 500
+#define DOOR_SESSION_BUCKETS 256
+#define LATENCY_BUCKETS 10000 /* one bucket per microsecond up to 10ms, plus an overflow bucket */
+#define RELOAD_SETTLE_MSEC 50   /* quiet period after the last file change before rebuilding */
 
 typedef struct {
     char security_alarm; // '-' if inactive, 'A' if active
@@ -19,19 +52,1148 @@ typedef struct {
     pthread_cond_t cond;
 } shm_sensor;
 
+/* Door registration datagram sent to fire alarm units for every fail-safe door */
+typedef struct {
+    char header[4]; /* {'D', 'O', 'O', 'R'} or {'D', 'R', 'E', 'G'} */
+    struct in_addr door_addr;
+    in_port_t door_port;
+} door_datagram;
+
+typedef enum {
+    DEVICE_UNKNOWN,
+    DEVICE_CARDREADER,
+    DEVICE_DOOR,
+    DEVICE_FIREALARM
+} device_kind;
+
+/* Per-connection state, indexed by file descriptor */
+typedef struct {
+    int fd;
+    device_kind kind;
+    int id;
+    int want_output;            /* EPOLLOUT is registered because output is pending */
+    struct timespec accepted;   /* used to measure accept-to-registration latency */
+    tcp_conn *io;
+} connection;
+
+/* A registered door, as announced with DOOR {id} {address:port} {FAIL_SAFE | FAIL_SECURE}# */
+typedef struct {
+    int id;
+    struct sockaddr_in addr;
+    int fail_safe;
+    int confirmed;  /* set once every fire alarm unit has answered with DREG */
+    char state;     /* last STATE pushed by the door: 'O', 'C', 'o', 'c', or '?' before its first report */
+    unsigned int resend_pass;   /* last resend_unconfirmed_doors() pass that sent this door */
+} door_record;
+
+/* Persistent command connection to one door controller, shared by the workers. Sessions are never freed, so a
+ * worker may keep a pointer after dropping sessions_mutex */
+typedef struct door_session {
+    struct sockaddr_in addr;
+    int fd;                     /* -1 while disconnected */
+    pthread_mutex_t lock;       /* one command in flight at a time keeps each reply matched to its command */
+    struct door_session *next;  /* hash chain */
+} door_session;
+
+/* Unit of blocking work executed by the worker pool */
+typedef struct job {
+    void (*run)(void *arg);
+    void *arg;
+    struct job *next;
+} job;
+
+/* A door that answered OPENING#, waiting for its CLOSE# */
+typedef struct pending_close {
+    struct sockaddr_in addr;
+    struct timespec due;
+    struct pending_close *next;
+} pending_close;
+
+/* Settings from the command line */
+static int doorOpenDuration;
+static int dGramResendDelay;
+
+/* Everything derived from the authorisation, connections and layout files. Built off the event loop and
+ * published as a whole, so a decision only ever sees one complete snapshot */
+typedef struct {
+    auth_index auth;    /* mapped from "{authorisation file}.idx" */
+    topology topo;      /* card reader -> doors and fire zone -> doors */
+} site_policy;
+
+static const char *auth_path;
+static const char *connections_path;
+static const char *layout_path;
+
+static _Atomic(site_policy *) current_policy;
+
+/* Quiescent-state counter for the event loop: odd while it is handling events and may hold a policy pointer */
+static atomic_ulong loop_epoch;
+
+static int epoll_fd;
+static int udp_sockfd;
+static int reload_fd;   /* eventfd raised by the reload thread after each swap */
+static shm_sensor *shared;
+
+/* Connection table indexed by fd */
+static connection **conns;
+static int conns_cap;
+
+/* Door registry. doors is dense, door_slots is an open-addressing index from door id to doors[] position + 1,
+   door_addr_slots the same from a door's address and port, for matching DREG confirmations */
+static door_record *doors;
+static int door_count, door_cap;
+static int *door_slots;
+static int *door_addr_slots;
+static int door_slot_cap;
+
+/* Fire alarm units that have registered, which receive a DOOR datagram for every fail-safe door */
+static struct sockaddr_in *firealarms;
+static int firealarm_count, firealarm_cap;
+
+/* Accept-to-registration latency histogram */
+static unsigned int latency_hist[LATENCY_BUCKETS + 1];
+static unsigned long latency_count;
+static long latency_max;
+
+/* Door sessions, hashed on address and port */
+static pthread_mutex_t sessions_mutex = PTHREAD_MUTEX_INITIALIZER;
+static door_session *sessions[DOOR_SESSION_BUCKETS];
+
+/* Worker pool queue */
+static pthread_mutex_t work_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cond = PTHREAD_COND_INITIALIZER;
+static job *work_head, *work_tail;
+
+/* Doors waiting to be closed, in due order: every door stays open for the same duration, so appending keeps the
+ * queue sorted and no timer heap is needed. close_timer_fd is armed for the head */
+static pthread_mutex_t close_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pending_close *close_head, *close_tail;
+static int close_timer_fd;
+
+/*****************
+Worker thread pool
+*****************/
+
+static void submit_job(void (*run)(void *), void *arg)
+{
+    job *j = malloc(sizeof(*j));
+    if (j == NULL) {
+        perror("malloc()");
+        free(arg);
+        return;
+    }
+    j->run = run;
+    j->arg = arg;
+    j->next = NULL;
+
+    pthread_mutex_lock(&work_mutex);
+    if (work_tail) {
+        work_tail->next = j;
+    } else {
+        work_head = j;
+    }
+    work_tail = j;
+    pthread_cond_signal(&work_cond);
+    pthread_mutex_unlock(&work_mutex);
+}
+
+static void *worker_main(void *unused)
+{
+    (void)unused;
+    for (;;) {
+        pthread_mutex_lock(&work_mutex);
+        while (work_head == NULL) {
+            pthread_cond_wait(&work_cond, &work_mutex);
+        }
+        job *j = work_head;
+        work_head = j->next;
+        if (work_head == NULL) {
+            work_tail = NULL;
+        }
+        pthread_mutex_unlock(&work_mutex);
+
+        j->run(j->arg);
+        free(j->arg);
+        free(j);
+    }
+    return NULL;
+}
+
+/* The session for a door address, created on first use */
+static door_session *door_session_for(const struct sockaddr_in *addr)
+{
+    unsigned int bucket = (addr->sin_addr.s_addr * 2654435761u ^ addr->sin_port) % DOOR_SESSION_BUCKETS;
+    pthread_mutex_lock(&sessions_mutex);
+    door_session *session = sessions[bucket];
+    while (session != NULL && (session->addr.sin_addr.s_addr != addr->sin_addr.s_addr
+                               || session->addr.sin_port != addr->sin_port)) {
+        session = session->next;
+    }
+    if (session == NULL && (session = calloc(1, sizeof(*session))) != NULL) {
+        session->addr = *addr;
+        session->fd = -1;
+        pthread_mutex_init(&session->lock, NULL);
+        session->next = sessions[bucket];
+        sessions[bucket] = session;
+    }
+    pthread_mutex_unlock(&sessions_mutex);
+    return session;
+}
+
+/* One command and its '#'-terminated reply over the session's connection, connecting first if needed.
+ * Any failure drops the connection, so a late reply can never be mistaken for the next command's. Caller holds
+ * session->lock */
+static int session_exchange(door_session *session, const char *command, char *reply, size_t reply_len)
+{
+    if (session->fd < 0 && (session->fd = tcp_connect_timeout(&session->addr, DOOR_TIMEOUT_MSEC)) < 0) {
+        perror("connect(door)");
+        return -1;
+    }
+    if (tcp_send_all(session->fd, command, strlen(command), DOOR_TIMEOUT_MSEC) == 0) {
+        size_t used = 0;
+        while (used < reply_len - 1) {
+            ssize_t n = tcp_recv_timeout(session->fd, reply + used, reply_len - 1 - used, DOOR_TIMEOUT_MSEC);
+            if (n <= 0) {
+                break;
+            }
+            used += n;
+            reply[used] = '\0';
+            if (strchr(reply, '#') != NULL) {
+                /* doors end replies with "#\n"; skip the newline left over from the previous one */
+                size_t skip = strspn(reply, " \t\r\n");
+                memmove(reply, reply + skip, used - skip + 1);
+                return 0;
+            }
+        }
+    }
+    close(session->fd);
+    session->fd = -1;
+    return -1;
+}
+
+/* Send one command to a door controller and wait for its reply. Blocking, so only called from workers.
+ * Commands reuse a kept-alive session; a session that went stale while idle is retried once on a new connection */
+static int door_command(const struct sockaddr_in *addr, const char *command, char *reply, size_t reply_len)
+{
+    door_session *session = door_session_for(addr);
+    if (session == NULL) {
+        perror("calloc()");
+        return -1;
+    }
+    pthread_mutex_lock(&session->lock);
+    int reused = session->fd >= 0;
+    int result = session_exchange(session, command, reply, reply_len);
+    if (result < 0 && reused) {
+        result = session_exchange(session, command, reply, reply_len);
+    }
+    pthread_mutex_unlock(&session->lock);
+    return result;
+}
+
+static void arm_close_timer(const struct timespec *due)
+{
+    struct itimerspec timer = { { 0, 0 }, *due };
+    timerfd_settime(close_timer_fd, TFD_TIMER_ABSTIME, &timer, NULL);
+}
+
+/* Queue a door's CLOSE# for when its open duration has passed. Called from workers */
+static void schedule_close(const struct sockaddr_in *addr)
+{
+    pending_close *pending = malloc(sizeof(*pending));
+    if (pending == NULL) {
+        perror("malloc()");
+        return;
+    }
+    pending->addr = *addr;
+    pending->next = NULL;
+
+    pthread_mutex_lock(&close_mutex);
+    /* taken under the lock, so due times are appended in order */
+    clock_gettime(CLOCK_MONOTONIC, &pending->due);
+    pending->due.tv_sec += doorOpenDuration / 1000000;
+    pending->due.tv_nsec += (long)(doorOpenDuration % 1000000) * 1000;
+    if (pending->due.tv_nsec >= 1000000000) {
+        pending->due.tv_sec++;
+        pending->due.tv_nsec -= 1000000000;
+    }
+    if (close_tail) {
+        close_tail->next = pending;
+    } else {
+        close_head = pending;
+        arm_close_timer(&pending->due);
+    }
+    close_tail = pending;
+    pthread_mutex_unlock(&close_mutex);
+}
+
+/* Worker job: open a door and schedule its CLOSE# */
+static void open_door_job(void *arg)
+{
+    struct sockaddr_in *addr = arg;
+    char reply[DOOR_REPLY_SIZE];
+
+    if (door_command(addr, "OPEN#", reply, sizeof(reply)) < 0 || strncmp(reply, "OPENING#", 8) != 0) {
+        return;
+    }
+    schedule_close(addr);
+}
+
+/* Worker job: close a door whose open duration has passed */
+static void close_door_job(void *arg)
+{
+    char reply[DOOR_REPLY_SIZE];
+    door_command(arg, "CLOSE#", reply, sizeof(reply));
+}
+
+/* Hand every door that is due to the workers, and re-arm the timer for the next one. Called from the event loop */
+static void close_due_doors(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    pthread_mutex_lock(&close_mutex);
+    pending_close *due = close_head, *last = NULL;
+    while (close_head != NULL && (close_head->due.tv_sec < now.tv_sec || (close_head->due.tv_sec == now.tv_sec
+                                                                          && close_head->due.tv_nsec <= now.tv_nsec))) {
+        last = close_head;
+        close_head = close_head->next;
+    }
+    if (close_head == NULL) {
+        close_tail = NULL;
+    } else {
+        arm_close_timer(&close_head->due);
+    }
+    pthread_mutex_unlock(&close_mutex);
+    if (last == NULL) {
+        return;
+    }
+    last->next = NULL;
+
+    while (due != NULL) {
+        pending_close *next = due->next;
+        /* the job frees its argument, and addr is the first member */
+        submit_job(close_door_job, due);
+        due = next;
+    }
+}
+
+/***********************
+Door and firealarm state
+***********************/
+
+static door_record *find_door(int id)
+{
+    if (door_slot_cap == 0) {
+        return NULL;
+    }
+    unsigned int mask = door_slot_cap - 1;
+    for (unsigned int i = (unsigned int)id * 2654435761u & mask; door_slots[i] != 0; i = (i + 1) & mask) {
+        if (doors[door_slots[i] - 1].id == id) {
+            return &doors[door_slots[i] - 1];
+        }
+    }
+    return NULL;
+}
+
+static void index_door(int position)
+{
+    unsigned int mask = door_slot_cap - 1;
+    unsigned int i = (unsigned int)doors[position].id * 2654435761u & mask;
+    while (door_slots[i] != 0) {
+        i = (i + 1) & mask;
+    }
+    door_slots[i] = position + 1;
+}
+
+static unsigned int door_addr_hash(struct in_addr addr, in_port_t port)
+{
+    return (addr.s_addr ^ (unsigned int)port * 40503u) * 2654435761u;
+}
+
+static void index_door_addr(int position)
+{
+    unsigned int mask = door_slot_cap - 1;
+    unsigned int i = door_addr_hash(doors[position].addr.sin_addr, doors[position].addr.sin_port) & mask;
+    while (door_addr_slots[i] != 0) {
+        i = (i + 1) & mask;
+    }
+    door_addr_slots[i] = position + 1;
+}
+
+static void rebuild_door_addr_index(void)
+{
+    memset(door_addr_slots, 0, door_slot_cap * sizeof(*door_addr_slots));
+    for (int i = 0; i < door_count; i++) {
+        index_door_addr(i);
+    }
+}
+
+/* Insert or refresh a door. Re-registration after a reconnect updates the existing record in place */
+static door_record *register_door(int id, const struct sockaddr_in *addr, int fail_safe)
+{
+    door_record *door = find_door(id);
+    if (door == NULL) {
+        if (door_count == door_cap) {
+            int cap = door_cap ? door_cap * 2 : 64;
+            door_record *grown = realloc(doors, cap * sizeof(*doors));
+            if (grown == NULL) {
+                perror("realloc()");
+                return NULL;
+            }
+            doors = grown;
+            door_cap = cap;
+        }
+        /* keep the index at most half full */
+        if ((door_count + 1) * 2 > door_slot_cap) {
+            int cap = door_slot_cap ? door_slot_cap * 2 : 128;
+            int *slots = calloc(cap, sizeof(*slots));
+            int *addr_slots = calloc(cap, sizeof(*addr_slots));
+            if (slots == NULL || addr_slots == NULL) {
+                perror("calloc()");
+                free(slots);
+                free(addr_slots);
+                return NULL;
+            }
+            free(door_slots);
+            free(door_addr_slots);
+            door_slots = slots;
+            door_addr_slots = addr_slots;
+            door_slot_cap = cap;
+            for (int i = 0; i < door_count; i++) {
+                index_door(i);
+                index_door_addr(i);
+            }
+        }
+        door = &doors[door_count];
+        door->id = id;
+        door->addr = *addr;
+        door->resend_pass = 0;
+        index_door(door_count);
+        index_door_addr(door_count++);
+    } else if (door->addr.sin_addr.s_addr != addr->sin_addr.s_addr || door->addr.sin_port != addr->sin_port) {
+        /* a door that comes back on a new address is rare enough to rebuild the address index for */
+        door->addr = *addr;
+        rebuild_door_addr_index();
+    }
+    door->addr = *addr;
+    door->fail_safe = fail_safe;
+    door->confirmed = 0;
+    door->state = '?';
+    return door;
+}
+
+/* Tell every fire alarm unit about a fail-safe door. Resent on each timer tick until DREG comes back */
+static void send_door_datagram(const door_record *door)
+{
+    door_datagram dgram;
+    memcpy(dgram.header, "DOOR", 4);
+    dgram.door_addr = door->addr.sin_addr;
+    dgram.door_port = door->addr.sin_port;
+
+    for (int i = 0; i < firealarm_count; i++) {
+        if (sendto(udp_sockfd, &dgram, sizeof(dgram), 0, (struct sockaddr *)&firealarms[i], sizeof(firealarms[i])) < 0) {
+            perror("sendto(firealarm)");
+        }
+    }
+}
+
+/* Send each unconfirmed fail-safe door once. Doors in the layout's fire zones go first, in zone order, then any
+   door no zone lists; a door in several zones is still sent once */
+static void resend_unconfirmed_doors(void)
+{
+    static unsigned int pass;
+    pass++;
+
+    const site_policy *policy = atomic_load_explicit(&current_policy, memory_order_acquire);
+    const csr_graph *zones = &policy->topo.zone_doors;
+    for (uint32_t i = 0; i < zones->edge_count; i++) {
+        door_record *door = find_door((int)zones->targets[i]);
+        if (door && door->fail_safe && !door->confirmed && door->resend_pass != pass) {
+            door->resend_pass = pass;
+            send_door_datagram(door);
+        }
+    }
+    for (int i = 0; i < door_count; i++) {
+        if (doors[i].fail_safe && !doors[i].confirmed && doors[i].resend_pass != pass) {
+            doors[i].resend_pass = pass;
+            send_door_datagram(&doors[i]);
+        }
+    }
+}
+
+static void handle_datagram(void)
+{
+    door_datagram dgram;
+    ssize_t n;
+    while ((n = recv(udp_sockfd, &dgram, sizeof(dgram), MSG_DONTWAIT)) > 0) {
+        if (n < (ssize_t)sizeof(dgram) || memcmp(dgram.header, "DREG", 4) != 0) {
+            continue;
+        }
+        if (door_slot_cap == 0) {
+            continue;
+        }
+        /* more than one door id may have registered the same address; confirm them all */
+        unsigned int mask = door_slot_cap - 1;
+        for (unsigned int i = door_addr_hash(dgram.door_addr, dgram.door_port) & mask; door_addr_slots[i] != 0; i = (i + 1) & mask) {
+            door_record *door = &doors[door_addr_slots[i] - 1];
+            if (door->addr.sin_addr.s_addr == dgram.door_addr.s_addr && door->addr.sin_port == dgram.door_port) {
+                door->confirmed = 1;
+            }
+        }
+    }
+}
+
+/***********************
+Registration latency stats
+***********************/
+
+static void record_registration(connection *conn)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long usec = (now.tv_sec - conn->accepted.tv_sec) * 1000000 + (now.tv_nsec - conn->accepted.tv_nsec) / 1000;
+
+    latency_hist[usec < LATENCY_BUCKETS ? usec : LATENCY_BUCKETS]++;
+    latency_count++;
+    if (usec > latency_max) {
+        latency_max = usec;
+    }
+}
+
+static long latency_percentile(double fraction)
+{
+    unsigned long target = (unsigned long)(latency_count * fraction);
+    unsigned long seen = 0;
+    for (int i = 0; i <= LATENCY_BUCKETS; i++) {
+        seen += latency_hist[i];
+        if (seen > target) {
+            return i;
+        }
+    }
+    return LATENCY_BUCKETS;
+}
+
+/* Printed on SIGUSR1 */
+static void report_latency(void)
+{
+    fprintf(stderr, "overseer: %lu registrations, accept-to-registration p50 %ldus p99 %ldus max %ldus\n",
+            latency_count, latency_percentile(0.50), latency_percentile(0.99), latency_max);
+
+    /* door states as last pushed by the doors themselves */
+    int open = 0, closed = 0, moving = 0, unknown = 0;
+    for (int i = 0; i < door_count; i++) {
+        switch (doors[i].state) {
+        case 'O': open++; break;
+        case 'C': closed++; break;
+        case 'o': case 'c': moving++; break;
+        default: unknown++; break;
+        }
+    }
+    fprintf(stderr, "overseer: %d doors, %d open, %d closed, %d moving, %d not yet reported\n",
+            door_count, open, closed, moving, unknown);
+}
+
+/*****************
+Connection handling
+*****************/
+
+static void close_connection(connection *conn)
+{
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    conns[conn->fd] = NULL;
+    tcp_conn_free(conn->io);
+    free(conn);
+}
+
+/* Write as much of the pending output as the socket accepts. Returns -1 if the peer has gone away */
+static int flush_connection(connection *conn)
+{
+    int pending = tcp_conn_flush(conn->io);
+    if (pending < 0) {
+        return -1;
+    }
+
+    /* only ask for EPOLLOUT while there is something left to write */
+    if (pending != conn->want_output) {
+        struct epoll_event ev = { .events = EPOLLIN | (pending ? EPOLLOUT : 0), .data.fd = conn->fd };
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev);
+        conn->want_output = pending;
+    }
+    return 0;
+}
+
+static void queue_reply(connection *conn, const char *msg)
+{
+    if (tcp_conn_queue(conn->io, msg, strlen(msg)) < 0) {
+        fprintf(stderr, "overseer: output buffer full for fd %d, dropping reply\n", conn->fd);
+    }
+}
+
+/* Push INVALIDATE# to every connected card reader so none keeps answering from a stale decision cache */
+static void invalidate_reader_caches(void)
+{
+    for (int fd = 0; fd < conns_cap; fd++) {
+        connection *conn = conns[fd];
+        if (conn == NULL || conn->kind != DEVICE_CARDREADER) {
+            continue;
+        }
+        queue_reply(conn, "INVALIDATE#");
+        if (flush_connection(conn) < 0) {
+            close_connection(conn);
+        }
+    }
+}
+
+/* Card decisions: a single probe of the mapped authorisation index, no allocation */
+static int authorise(const site_policy *policy, const char *code, int door_id)
+{
+    return auth_index_allows(&policy->auth, code, (uint32_t)door_id);
+}
+
+/* A scan is allowed if the card may open any registered door behind the reader; only those doors are opened.
+ * Readers on a persistent connection tag each scan with a sequence number, which is echoed in the reply */
+static void handle_scan(connection *conn, int reader_id, const char *code, const char *seq)
+{
+    const site_policy *policy = atomic_load_explicit(&current_policy, memory_order_acquire);
+    uint32_t count;
+    const uint32_t *door_ids = csr_neighbours(&policy->topo.reader_doors, (uint32_t)reader_id, &count);
+    int allowed = 0;
+
+    for (uint32_t i = 0; i < count; i++) {
+        door_record *door = find_door((int)door_ids[i]);
+        if (door == NULL || !authorise(policy, code, door->id)) {
+            continue;
+        }
+        allowed = 1;
+
+        struct sockaddr_in *addr = malloc(sizeof(*addr));
+        if (addr == NULL) {
+            perror("malloc()");
+            continue;
+        }
+        *addr = door->addr;
+        submit_job(open_door_job, addr);
+    }
+    if (seq == NULL) {
+        queue_reply(conn, allowed ? "ALLOWED#" : "DENIED#");
+        return;
+    }
+    char reply[48];
+    snprintf(reply, sizeof(reply), "%s %s#", allowed ? "ALLOWED" : "DENIED", seq);
+    queue_reply(conn, reply);
+}
+
+static void handle_message(connection *conn, char *msg)
+{
+    int id, fields;
+    char word[32], extra[32];
+
+    if (sscanf(msg, "CARDREADER %d %31s", &id, word) == 2) {
+        if (strcmp(word, "HELLO") == 0) {
+            conn->kind = DEVICE_CARDREADER;
+            conn->id = id;
+            record_registration(conn);
+        } else if (strcmp(word, "SCANNED") == 0 && (fields = sscanf(msg, "CARDREADER %*d SCANNED %31s %20[0-9]", word, extra)) >= 1) {
+            handle_scan(conn, id, word, fields == 2 ? extra : NULL);
+        } else {
+            fprintf(stderr, "overseer: invalid card reader message: %s\n", msg);
+        }
+    } else if (sscanf(msg, "DOOR %d %31s %31s", &id, word, extra) == 3) {
+        struct sockaddr_in addr;
+        if (tcp_parse_address(word, &addr) < 0) {
+            fprintf(stderr, "overseer: invalid door address: %s\n", msg);
+            return;
+        }
+        conn->kind = DEVICE_DOOR;
+        conn->id = id;
+        record_registration(conn);
+
+        door_record *door = register_door(id, &addr, strcmp(extra, "FAIL_SAFE") == 0);
+        if (door && door->fail_safe) {
+            send_door_datagram(door);
+        }
+    } else if (conn->kind == DEVICE_DOOR && sscanf(msg, "STATE %c", word) == 1) {
+        /* pushed by the door whenever its state changes */
+        door_record *door = find_door(conn->id);
+        if (door != NULL) {
+            door->state = word[0];
+        }
+    } else if (sscanf(msg, "FIREALARM %31s HELLO", word) == 1) {
+        struct sockaddr_in addr;
+        if (tcp_parse_address(word, &addr) < 0) {
+            fprintf(stderr, "overseer: invalid fire alarm address: %s\n", msg);
+            return;
+        }
+        if (firealarm_count == firealarm_cap) {
+            int cap = firealarm_cap ? firealarm_cap * 2 : 4;
+            struct sockaddr_in *grown = realloc(firealarms, cap * sizeof(*firealarms));
+            if (grown == NULL) {
+                perror("realloc()");
+                return;
+            }
+            firealarms = grown;
+            firealarm_cap = cap;
+        }
+        firealarms[firealarm_count++] = addr;
+        conn->kind = DEVICE_FIREALARM;
+        record_registration(conn);
+
+        /* a new fire alarm unit has to learn about every fail-safe door registered so far */
+        for (int i = 0; i < door_count; i++) {
+            doors[i].confirmed = 0;
+        }
+        resend_unconfirmed_doors();
+    } else {
+        fprintf(stderr, "overseer: invalid message: %s\n", msg);
+    }
+}
+
+static void handle_readable(connection *conn)
+{
+    for (;;) {
+        ssize_t n = tcp_conn_fill(conn->io);
+        if (n > 0) {
+            /* messages are handled in place in the input ring */
+            char *msg;
+            while ((msg = tcp_conn_next_frame(conn->io)) != NULL) {
+                handle_message(conn, msg);
+            }
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        if (n < 0 && errno == ENOBUFS) {
+            fprintf(stderr, "overseer: message too long on fd %d, closing\n", conn->fd);
+        }
+        /* peer closed or hard error; send anything still pending first */
+        flush_connection(conn);
+        close_connection(conn);
+        return;
+    }
+    if (flush_connection(conn) < 0) {
+        close_connection(conn);
+    }
+}
+
+static void accept_connections(int listen_fd)
+{
+    for (;;) {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("accept4()");
+            }
+            return;
+        }
+
+        if (fd >= conns_cap) {
+            int cap = conns_cap;
+            while (cap <= fd) {
+                cap *= 2;
+            }
+            connection **grown = realloc(conns, cap * sizeof(*conns));
+            if (grown == NULL) {
+                perror("realloc()");
+                close(fd);
+                continue;
+            }
+            memset(grown + conns_cap, 0, (cap - conns_cap) * sizeof(*conns));
+            conns = grown;
+            conns_cap = cap;
+        }
+
+        connection *conn = calloc(1, sizeof(*conn));
+        tcp_conn *io = conn ? tcp_conn_new(fd) : NULL;
+        if (io == NULL) {
+            perror("calloc()");
+            free(conn);
+            close(fd);
+            continue;
+        }
+        conn->fd = fd;
+        conn->io = io;
+        clock_gettime(CLOCK_MONOTONIC, &conn->accepted);
+        conns[fd] = conn;
+
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        struct epoll_event ev = { .events = EPOLLIN, .data.fd = fd };
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            perror("epoll_ctl()");
+            close_connection(conn);
+            continue;
+        }
+        /* devices usually send their HELLO straight after connecting */
+        handle_readable(conn);
+    }
+}
+
+/**************************
+Policy loading and live reload
+**************************/
+
+static double elapsed_msec(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e3 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+static void free_policy(site_policy *policy)
+{
+    auth_index_close(&policy->auth);
+    topology_free(&policy->topo);
+    free(policy);
+}
+
+/* Build a complete policy from the source files. Returns NULL and leaves nothing behind on failure */
+static site_policy *load_policy(void)
+{
+    site_policy *policy = calloc(1, sizeof(*policy));
+    if (policy == NULL) {
+        perror("calloc()");
+        return NULL;
+    }
+
+    /* The index is normally built ahead of time with authc; it is only recompiled here if missing or stale */
+    char index_path[4096];
+    snprintf(index_path, sizeof(index_path), "%s.idx", auth_path);
+    if (!auth_index_is_current(auth_path, index_path)) {
+        fprintf(stderr, "overseer: %s is missing or out of date, compiling it\n", index_path);
+        if (auth_index_compile(auth_path, index_path) == -1) {
+            free(policy);
+            return NULL;
+        }
+    }
+    if (auth_index_open(index_path, &policy->auth) == -1) {
+        fprintf(stderr, "overseer: cannot open authorisation index %s\n", index_path);
+        free(policy);
+        return NULL;
+    }
+    if (topology_load(connections_path, layout_path, &policy->topo) == -1) {
+        fprintf(stderr, "overseer: cannot load connections and layout files\n");
+        auth_index_close(&policy->auth);
+        free(policy);
+        return NULL;
+    }
+    return policy;
+}
+
+/* Wait until the event loop can no longer be holding a policy pointer it loaded before the swap */
+static void wait_for_loop_quiescence(void)
+{
+    unsigned long epoch = atomic_load(&loop_epoch);
+    if ((epoch & 1) == 0) {
+        return;
+    }
+    while (atomic_load(&loop_epoch) == epoch) {
+        usleep(100);
+    }
+}
+
+static int is_watched_name(const char *name)
+{
+    const char *paths[] = { auth_path, connections_path, layout_path };
+    for (int i = 0; i < 3; i++) {
+        const char *slash = strrchr(paths[i], '/');
+        if (strcmp(name, slash ? slash + 1 : paths[i]) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Watch the directories holding the source files, since editors usually replace a file rather than write it */
+static int watch_policy_files(int inotify_fd)
+{
+    const char *paths[] = { auth_path, connections_path, layout_path };
+    for (int i = 0; i < 3; i++) {
+        char dir[4096];
+        const char *slash = strrchr(paths[i], '/');
+        if (slash == NULL) {
+            strcpy(dir, ".");
+        } else {
+            snprintf(dir, sizeof(dir), "%.*s", (int)(slash - paths[i]) + (slash == paths[i]), paths[i]);
+        }
+        if (inotify_add_watch(inotify_fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) == -1) {
+            perror("inotify_add_watch()");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Background thread: rebuild the policy whenever a source file changes and swap it in RCU style */
+static void *reload_main(void *unused)
+{
+    (void)unused;
+
+    /* Rebuilding is bulk work; keep it from competing with the event loop for a core */
+    struct sched_param batch = { 0 };
+    pthread_setschedparam(pthread_self(), SCHED_BATCH, &batch);
+    setpriority(PRIO_PROCESS, gettid(), 10);
+
+    int inotify_fd = inotify_init1(IN_CLOEXEC);
+    if (inotify_fd == -1 || watch_policy_files(inotify_fd) == -1) {
+        fprintf(stderr, "overseer: live reload disabled\n");
+        return NULL;
+    }
+
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    for (;;) {
+        ssize_t len = read(inotify_fd, events, sizeof(events));
+        if (len <= 0) {
+            if (len < 0 && errno == EINTR) {
+                continue;
+            }
+            perror("read(inotify)");
+            return NULL;
+        }
+
+        int changed = 0;
+        for (char *p = events; p < events + len;) {
+            struct inotify_event *event = (struct inotify_event *)p;
+            if (event->len > 0 && is_watched_name(event->name)) {
+                changed = 1;
+            }
+            p += sizeof(*event) + event->len;
+        }
+        if (!changed) {
+            continue;
+        }
+
+        /* let a burst of writes settle before rebuilding */
+        struct pollfd pfd = { .fd = inotify_fd, .events = POLLIN };
+        while (poll(&pfd, 1, RELOAD_SETTLE_MSEC) > 0) {
+            if (read(inotify_fd, events, sizeof(events)) <= 0) {
+                break;
+            }
+        }
+
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        site_policy *fresh = load_policy();
+        if (fresh == NULL) {
+            fprintf(stderr, "overseer: reload failed, keeping the current authorisation and topology\n");
+            continue;
+        }
+        double build_msec = elapsed_msec(&start);
+
+        site_policy *old = atomic_exchange(&current_policy, fresh);
+        wait_for_loop_quiescence();
+        free_policy(old);
+
+        /* card readers cache decisions; tell the event loop to have them drop their caches */
+        uint64_t one = 1;
+        if (write(reload_fd, &one, sizeof(one)) < 0) {
+            perror("write(eventfd)");
+        }
+        fprintf(stderr, "overseer: reloaded %u cards, %u reader links, %u zone links in %.1fms (swap complete after %.1fms)\n",
+                fresh->auth.header->card_count, fresh->topo.reader_doors.edge_count, fresh->topo.zone_doors.edge_count,
+                build_msec, elapsed_msec(&start));
+    }
+    return NULL;
+}
+
+static void watch_fd(int fd)
+{
+    struct epoll_event ev = { .events = EPOLLIN, .data.fd = fd };
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        perror("epoll_ctl()");
+        exit(1);
+    }
+}
+
 int main(int argc, char **argv)
 {
-    if (argc < 8)
+    if (argc != 9)
     {
-        fprintf(stderr, "usage: {address:port} {door open duration (in microseconds)} {datagram resend delay (in microseconds)} {authorisation file} {connections file} {layout file} {shared memory path} {shared memory offset}");
+        fprintf(stderr, "usage: {address:port} {door open duration (in microseconds)} {datagram resend delay (in microseconds)} {authorisation file} {connections file} {layout file} {shared memory path} {shared memory offset}\n");
         exit(1);
     }
     const char *overseer_addr = argv[1];
-    int doorOpenDuration = atoi(argv[2]);
-    int dGramResendDelay = atoi(argv[3]);
-    const char *shm_path = argv[5];
-    off_t shm_offset = (off_t)atoi(argv[6]);
-}
+    doorOpenDuration = atoi(argv[2]);
+    dGramResendDelay = atoi(argv[3]);
+    auth_path = argv[4];
+    connections_path = argv[5];
+    layout_path = argv[6];
+    const char *shm_path = argv[7];
+    off_t shm_offset = (off_t)atoi(argv[8]);
 
+    struct sockaddr_in servaddr;
+    if (tcp_parse_address(overseer_addr, &servaddr) < 0) {
+        fprintf(stderr, "Error: Overseer address should be in the format ip:port\n");
+        exit(1);
+    }
 
+    struct timespec load_start;
+    clock_gettime(CLOCK_MONOTONIC, &load_start);
+    site_policy *policy = load_policy();
+    if (policy == NULL) {
+        exit(1);
+    }
+    atomic_store(&current_policy, policy);
+    fprintf(stderr, "overseer: loaded %u cards, %u reader links, %u zone links in %.1fms\n",
+            policy->auth.header->card_count, policy->topo.reader_doors.edge_count, policy->topo.zone_doors.edge_count,
+            elapsed_msec(&load_start));
 
+    /* Shared memory initialisation */
+    int shm_fd = shm_open(shm_path, O_RDWR, 0);
+    if (shm_fd == -1) {
+        perror("shm_open()");
+        exit(1);
+    }
+    struct stat shm_stat;
+    if (fstat(shm_fd, &shm_stat) == -1) {
+        perror("fstat()");
+        exit(1);
+    }
+    char *shm = mmap(NULL, shm_stat.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+    if (shm == MAP_FAILED) {
+        perror("mmap()");
+        exit(1);
+    }
+    shared = (shm_sensor *)(shm + shm_offset);
+
+    /* TCP listener for device connections */
+    int listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0) {
+        perror("socket()");
+        exit(1);
+    }
+    int one = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(listen_fd, (struct sockaddr *)&servaddr, sizeof(servaddr)) < 0) {
+        perror("bind()");
+        exit(1);
+    }
+    if (listen(listen_fd, LISTEN_BACKLOG) < 0) {
+        perror("listen()");
+        exit(1);
+    }
+
+    /* UDP socket on the same address for DOOR datagrams and DREG confirmations */
+    udp_sockfd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (udp_sockfd < 0) {
+        perror("socket()");
+        exit(1);
+    }
+    if (bind(udp_sockfd, (struct sockaddr *)&servaddr, sizeof(servaddr)) < 0) {
+        perror("bind(udp)");
+        exit(1);
+    }
+
+    /* Periodic resend of unconfirmed DOOR datagrams */
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    struct itimerspec resend = { { 0, 0 }, { 0, 0 } };
+    if (dGramResendDelay > 0) {
+        resend.it_interval.tv_sec = dGramResendDelay / 1000000;
+        resend.it_interval.tv_nsec = (dGramResendDelay % 1000000) * 1000;
+        resend.it_value = resend.it_interval;
+    }
+    timerfd_settime(timer_fd, 0, &resend, NULL);
+
+    /* Doors held open, closed by the event loop when their time is up */
+    close_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+    /* SIGUSR1 dumps registration latency statistics */
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+    int signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    reload_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    signal(SIGPIPE, SIG_IGN);
+
+    /* workers inherit the blocked signal mask */
+    for (int i = 0; i < WORKER_COUNT; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, worker_main, NULL) != 0) {
+            perror("pthread_create()");
+            exit(1);
+        }
+        pthread_detach(thread);
+    }
+    pthread_t reload_thread;
+    if (pthread_create(&reload_thread, NULL, reload_main, NULL) != 0) {
+        perror("pthread_create()");
+        exit(1);
+    }
+    pthread_detach(reload_thread);
+
+    conns_cap = 1024;
+    conns = calloc(conns_cap, sizeof(*conns));
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0 || conns == NULL) {
+        perror("epoll_create1()");
+        exit(1);
+    }
+    watch_fd(listen_fd);
+    watch_fd(udp_sockfd);
+    watch_fd(timer_fd);
+    watch_fd(close_timer_fd);
+    watch_fd(signal_fd);
+    watch_fd(reload_fd);
+
+    struct epoll_event events[MAX_EVENTS];
+    for (;;) {
+        int ready = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+        if (ready < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait()");
+            exit(1);
+        }
+
+        atomic_fetch_add(&loop_epoch, 1);   /* entering a read-side critical section */
+        for (int i = 0; i < ready; i++) {
+            int fd = events[i].data.fd;
+            if (fd == listen_fd) {
+                accept_connections(listen_fd);
+            } else if (fd == udp_sockfd) {
+                handle_datagram();
+            } else if (fd == timer_fd) {
+                uint64_t expirations;
+                if (read(timer_fd, &expirations, sizeof(expirations)) > 0) {
+                    resend_unconfirmed_doors();
+                }
+            } else if (fd == close_timer_fd) {
+                uint64_t expirations;
+                if (read(close_timer_fd, &expirations, sizeof(expirations)) > 0) {
+                    close_due_doors();
+                }
+            } else if (fd == reload_fd) {
+                uint64_t reloads;
+                if (read(reload_fd, &reloads, sizeof(reloads)) > 0) {
+                    invalidate_reader_caches();
+                }
+            } else if (fd == signal_fd) {
+                struct signalfd_siginfo info;
+                while (read(signal_fd, &info, sizeof(info)) > 0) {
+                    report_latency();
+                }
+            } else if (fd < conns_cap && conns[fd] != NULL) {
+                connection *conn = conns[fd];
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                    handle_readable(conn);
+                } else if (events[i].events & EPOLLOUT) {
+                    if (flush_connection(conn) < 0) {
+                        close_connection(conn);
+                    }
+                }
+            }
+        }
+        atomic_fetch_add(&loop_epoch, 1);   /* quiescent again */
+    }
+
+    free_policy(atomic_load(&current_policy));
+    munmap(shm, shm_stat.st_size);
+    close(shm_fd);
+    return 0;
+}
@@ -0,0 +1,164 @@
+/*
+ * Load generator for the overseer.
+ * Opens connections back to back, the way a building's card readers and doors come back after a power blip,
+ * registers half of them as card readers and half as doors, and times each one from connect() to the reply of
+ * a SCANNED sent straight after its registration. That reply can only come once the registration in front of it
+ * has been handled, so it bounds accept-to-registration from the device's side; send the overseer SIGUSR1
+ * afterwards for its own histogram.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "tcp_communication.h"
+
+typedef struct {
+    int fd;
+    int sent;
+    struct timespec start;
+    char reply[64];
+    size_t reply_len;
+} load_conn;
+
+static long usec_since(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000000 + (now.tv_nsec - start->tv_nsec) / 1000;
+}
+
+static int compare_long(const void *a, const void *b)
+{
+    long x = *(const long *)a, y = *(const long *)b;
+    return (x > y) - (x < y);
+}
+
+/* Register as a card reader (odd) or door (even), then ask for a decision that cannot be answered before that */
+static int send_registration(int epoll_fd, load_conn *conn, int i)
+{
+    char msg[128];
+    if (i % 2) {
+        snprintf(msg, sizeof(msg), "CARDREADER %d HELLO#CARDREADER %d SCANNED 0000000000000000 %d#", i, i, i);
+    } else {
+        snprintf(msg, sizeof(msg), "DOOR %d 127.0.0.1:%d FAIL_SECURE#CARDREADER %d SCANNED 0000000000000000 %d#",
+                 i, 20000 + i % 40000, i, i);
+    }
+    if (send(conn->fd, msg, strlen(msg), MSG_NOSIGNAL) != (ssize_t)strlen(msg)) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+        return -1;
+    }
+    conn->sent = 1;
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = conn };
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 3) {
+        fprintf(stderr, "usage: overseer_load {overseer address:port} {connections}\n");
+        exit(1);
+    }
+    struct sockaddr_in overseer;
+    if (tcp_parse_address(argv[1], &overseer) < 0) {
+        fprintf(stderr, "overseer_load: address should be in the format ip:port\n");
+        exit(1);
+    }
+    int count = atoi(argv[2]);
+    if (count <= 0) {
+        fprintf(stderr, "overseer_load: need at least one connection\n");
+        exit(1);
+    }
+
+    /* a few thousand sockets is more than the usual soft limit */
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < (rlim_t)count + 16) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    load_conn *conns = calloc(count, sizeof(*conns));
+    long *latency = malloc(count * sizeof(*latency));
+    int epoll_fd = epoll_create1(0);
+    if (conns == NULL || latency == NULL || epoll_fd < 0) {
+        perror("overseer_load");
+        exit(1);
+    }
+
+    /* answer whichever connections are ready between opening each, as separate devices would */
+    int opened = 0, done = 0, failed = 0;
+    struct epoll_event events[256];
+    while (done + failed < count) {
+        if (opened < count) {
+            load_conn *conn = &conns[opened++];
+            conn->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+            if (conn->fd < 0) {
+                perror("socket()");
+                exit(1);
+            }
+            clock_gettime(CLOCK_MONOTONIC, &conn->start);
+            if (connect(conn->fd, (struct sockaddr *)&overseer, sizeof(overseer)) < 0 && errno != EINPROGRESS) {
+                perror("connect()");
+                exit(1);
+            }
+            struct epoll_event ev = { .events = EPOLLOUT | EPOLLIN, .data.ptr = conn };
+            epoll_ctl(epoll_fd, EPOLL_CTL_ADD, conn->fd, &ev);
+        }
+        int n = epoll_wait(epoll_fd, events, 256, opened < count ? 0 : 5000);
+        if (n < 0 || (n == 0 && opened == count)) {
+            fprintf(stderr, "overseer_load: timed out with %d of %d connections answered\n", done, count);
+            break;
+        }
+        for (int e = 0; e < n; e++) {
+            load_conn *conn = events[e].data.ptr;
+            int i = conn - conns;
+            if (events[e].events & (EPOLLERR | EPOLLHUP)) {
+                failed++;
+                epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+                continue;
+            }
+            if (!conn->sent && (events[e].events & EPOLLOUT) && send_registration(epoll_fd, conn, i) < 0) {
+                failed++;
+                continue;
+            }
+            if (events[e].events & EPOLLIN) {
+                ssize_t got = recv(conn->fd, conn->reply + conn->reply_len, sizeof(conn->reply) - 1 - conn->reply_len, 0);
+                if (got <= 0) {
+                    failed++;
+                    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+                    continue;
+                }
+                conn->reply_len += got;
+                if (memchr(conn->reply, '#', conn->reply_len) != NULL) {
+                    latency[done++] = usec_since(&conn->start);
+                    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+                }
+            }
+        }
+    }
+
+    if (done > 0) {
+        qsort(latency, done, sizeof(*latency), compare_long);
+        printf("overseer_load: %d connections answered, %d failed, connect-to-reply p50 %ldus p99 %ldus max %ldus\n",
+               done, failed, latency[done / 2], latency[(long)done * 99 / 100], latency[done - 1]);
+    }
+
+    /* hold the connections open until the overseer has been asked for its own numbers */
+    printf("overseer_load: send the overseer SIGUSR1 for accept-to-registration, then press enter\n");
+    fflush(stdout);
+    getchar();
+    for (int i = 0; i < count; i++) {
+        close(conns[i].fd);
+    }
+    free(conns);
+    free(latency);
+    return failed ? 1 : 0;
+}
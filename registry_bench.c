@@ -0,0 +1,160 @@
+/*
+ * Registration storm benchmark for the fire alarm's door registry.
+ * Registers N doors, then has every one of them register again in a scattered order, as they all do after a
+ * network flap, and reports the cost per door of each. Linear-scan deduplication over a plain array is timed
+ * alongside for comparison. Given a running fire alarm unit's address, it also times DOOR/DREG round trips
+ * through the real thing for a storm of 100 doors.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include "door_registry.h"
+#include "tcp_communication.h"
+
+#define STORMS 3
+#define LINEAR_SCAN_LIMIT 20000     /* the quadratic comparison takes too long beyond this */
+#define WIRE_DOORS 100
+
+/* DOOR and DREG datagrams, as the fire alarm unit expects them */
+typedef struct {
+    char header[4];
+    struct in_addr door_addr;
+    in_port_t door_port;
+} door_datagram;
+
+static volatile int sink;
+
+static double now_sec(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* A storm visits every door once, in an order unrelated to registration order */
+static int storm_order(int i, int count)
+{
+    return (int)((long)i * 7919 % count);
+}
+
+static void bench_registry(int count)
+{
+    fanout_target *doors = malloc(count * sizeof(*doors));
+    if (doors == NULL) {
+        perror("malloc()");
+        exit(1);
+    }
+    for (int i = 0; i < count; i++) {
+        doors[i].addr.s_addr = htonl(0x0a000000 + i / 50);
+        doors[i].port = htons(4000 + i % 50);
+    }
+
+    door_registry registry = { 0 };
+    int added, total = 0;
+    double start = now_sec();
+    for (int i = 0; i < count; i++) {
+        door_registry_add(&registry, &doors[i], &added);
+        total += added;
+    }
+    double first = now_sec() - start;
+
+    start = now_sec();
+    for (int storm = 0; storm < STORMS; storm++) {
+        for (int i = 0; i < count; i++) {
+            door_registry_add(&registry, &doors[storm_order(i, count)], &added);
+            total += added;
+        }
+    }
+    double storms = (now_sec() - start) / STORMS;
+    printf("registry_bench: %6d doors: first registration %.1fns/door, storm %.1fns/door, %.2fms per storm, "
+           "%d registered\n", count, first / count * 1e9, storms / count * 1e9, storms * 1e3, registry.count);
+    if (total != count || registry.count != count) {
+        fprintf(stderr, "registry_bench: a storm added duplicates\n");
+        exit(1);
+    }
+    door_registry_free(&registry);
+
+    if (count <= LINEAR_SCAN_LIMIT) {
+        fanout_target *list = malloc(count * sizeof(*list));
+        int listed = 0;
+        start = now_sec();
+        for (int i = 0; i < count; i++) {
+            int j = 0;
+            while (j < listed && !(list[j].addr.s_addr == doors[i].addr.s_addr && list[j].port == doors[i].port)) {
+                j++;
+            }
+            if (j == listed) {
+                list[listed++] = doors[i];
+            }
+        }
+        for (int i = 0; i < count; i++) {
+            const fanout_target *door = &doors[storm_order(i, count)];
+            int j = 0;
+            while (j < listed && !(list[j].addr.s_addr == door->addr.s_addr && list[j].port == door->port)) {
+                j++;
+            }
+            sink += j;
+        }
+        printf("registry_bench: %6d doors: linear-scan array, registration and one storm %.2fms\n",
+               count, (now_sec() - start) * 1e3);
+        free(list);
+    }
+    free(doors);
+}
+
+/* DOOR datagrams to a live fire alarm unit, each waiting for its DREG */
+static void bench_wire(const struct sockaddr_in *firealarm)
+{
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    struct timeval timeout = { 2, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    for (int storm = 0; storm <= STORMS; storm++) {
+        double start = now_sec();
+        for (int i = 0; i < WIRE_DOORS; i++) {
+            door_datagram dgram;
+            memset(&dgram, 0, sizeof(dgram));
+            memcpy(dgram.header, "DOOR", 4);
+            dgram.door_addr.s_addr = htonl(INADDR_LOOPBACK);
+            dgram.door_port = htons(5000 + i);
+            door_datagram reply;
+            if (sendto(fd, &dgram, sizeof(dgram), 0, (const struct sockaddr *)firealarm, sizeof(*firealarm)) < 0
+                || recv(fd, &reply, sizeof(reply), 0) < (ssize_t)sizeof(reply) || memcmp(reply.header, "DREG", 4) != 0) {
+                fprintf(stderr, "registry_bench: no DREG from the fire alarm unit\n");
+                exit(1);
+            }
+        }
+        printf("registry_bench: %s of %d doors over UDP, %.1fus per DOOR/DREG round trip\n",
+               storm == 0 ? "first registration" : "storm", WIRE_DOORS, (now_sec() - start) / WIRE_DOORS * 1e6);
+    }
+    close(fd);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 2 && argc != 3) {
+        fprintf(stderr, "usage: registry_bench {doors} [{fire alarm address:port}]\n");
+        exit(1);
+    }
+    int count = atoi(argv[1]);
+    if (count <= 0) {
+        fprintf(stderr, "registry_bench: need at least one door\n");
+        exit(1);
+    }
+    bench_registry(count);
+
+    if (argc == 3) {
+        struct sockaddr_in firealarm;
+        if (tcp_parse_address(argv[2], &firealarm) < 0) {
+            fprintf(stderr, "registry_bench: address should be in the format ip:port\n");
+            exit(1);
+        }
+        bench_wire(&firealarm);
+    }
+    return 0;
+}
@@ -0,0 +1,71 @@
+/*
+ * Dead-band, rate of rise and adaptive heartbeat for a sensor's own readings. See report_policy.h.
+*/
+
+#include <math.h>
+#include <string.h>
+#include "report_policy.h"
+
+void report_policy_init(report_policy *policy, const report_config *config)
+{
+    memset(policy, 0, sizeof(*policy));
+    policy->config = *config;
+    policy->interval = config->max_interval / REPORT_HEARTBEAT_RANGE;
+}
+
+int report_policy_sample(report_policy *policy, float temperature, long long now)
+{
+    const report_config *config = &policy->config;
+
+    /* average the rate over about REPORT_RATE_PERIOD, so that noise between two close samples does not look like a
+     * fast rise; after a longer gap the rate is just the change over the period */
+    if (policy->sampled) {
+        long long elapsed = now - policy->last_sample_at;
+        if (elapsed > REPORT_RATE_PERIOD) {
+            elapsed = REPORT_RATE_PERIOD;
+        }
+        float change = temperature - policy->last_sample;
+        policy->rate += (change - policy->rate * elapsed / 1e6f) * (1e6f / REPORT_RATE_PERIOD);
+    }
+    policy->sampled = 1;
+    policy->last_sample = temperature;
+    policy->last_sample_at = now;
+
+    if (!policy->sent) {
+        return 1;
+    }
+    float moved = temperature - policy->last_sent;
+    if (moved <= -config->dead_band || moved >= config->dead_band) {
+        return 1;
+    }
+    if (moved > 0 && policy->rate >= config->rise_rate) {
+        return 1;
+    }
+    /* falling back under the threshold needs a full dead-band, so noise around it is not sent either */
+    return !isnan(config->threshold) && policy->last_sent < config->threshold && temperature >= config->threshold;
+}
+
+long long report_policy_sent(report_policy *policy, float temperature, int heartbeat)
+{
+    const report_config *config = &policy->config;
+    long long shortest = config->max_interval / REPORT_HEARTBEAT_RANGE;
+    long long longest = config->max_interval;
+
+    policy->sent = 1;
+    policy->last_sent = temperature;
+    policy->interval = heartbeat ? policy->interval * 2 : shortest;
+
+    if (!isnan(config->threshold) && config->approach > 0) {
+        float margin = (config->threshold - temperature) / config->approach;
+        if (margin < 1) {
+            longest = shortest + (long long)((longest - shortest) * (margin > 0 ? margin : 0));
+        }
+    }
+    if (policy->interval > longest) {
+        policy->interval = longest;
+    }
+    if (policy->interval < shortest) {
+        policy->interval = shortest;
+    }
+    return policy->interval;
+}
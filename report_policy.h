@@ -0,0 +1,46 @@
+/*
+ * When a temperature sensor sends its own reading.
+ *
+ * A reading is sent straight away when it has moved by at least the dead-band from the last one sent, when the
+ * temperature is rising faster than the rise rate, or when it crosses the fire alarm threshold upwards, so noise
+ * around a steady temperature is not sent but a fire is sent as soon as it shows. Otherwise a heartbeat repeats the
+ * last reading. Each heartbeat that finds nothing has moved doubles the wait for the next, from an eighth of max
+ * update wait up to max update wait itself, and a reading sent because it moved starts again from the shortest.
+ * Closer to the threshold than the approach band, the longest wait shrinks in proportion, down to the shortest at
+ * the threshold and above it.
+*/
+
+#ifndef REPORT_POLICY_H
+#define REPORT_POLICY_H
+
+#define REPORT_HEARTBEAT_RANGE 8    /* longest heartbeat / shortest */
+#define REPORT_RATE_PERIOD 1000000  /* usec over which the rate of rise is averaged */
+
+typedef struct {
+    float dead_band;            /* degrees */
+    float rise_rate;            /* degrees per second */
+    float threshold;            /* fire alarm threshold in degrees, or NAN if not known */
+    float approach;             /* degrees below the threshold */
+    long long max_interval;     /* usec, the longest heartbeat */
+} report_config;
+
+typedef struct {
+    report_config config;
+    int sent;                   /* a reading has been sent */
+    float last_sent;
+    int sampled;
+    float last_sample;
+    long long last_sample_at;
+    float rate;                 /* average rate of change, degrees per second */
+    long long interval;         /* usec until the next heartbeat */
+} report_policy;
+
+void report_policy_init(report_policy *policy, const report_config *config);
+
+/* Take a new temperature, read at now (usec, monotonic). Returns 1 if it should be sent straight away */
+int report_policy_sample(report_policy *policy, float temperature, long long now);
+
+/* Record that a reading was sent, because of a heartbeat or not. Returns the usec until the next heartbeat */
+long long report_policy_sent(report_policy *policy, float temperature, int heartbeat);
+
+#endif
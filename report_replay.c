@@ -0,0 +1,168 @@
+/*
+ * Replay of temperature traces through a sensor's reporting policy.
+ * Each trace is fed to report_policy.c the way tempsensor feeds it live readings, and to the rule it replaced,
+ * which sent every change and a heartbeat at a fixed max update wait. For both it prints datagrams sent per minute
+ * and, when a threshold is configured and the trace reaches it, how long after the first reading at or over the
+ * threshold one was sent.
+ *
+ * A trace is text, one reading per line: "{seconds} {temperature}", in time order; lines starting with '#' are
+ * comments. The policy is configured from the same environment variables as tempsensor.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "report_policy.h"
+
+typedef struct {
+    long long usec;
+    float temperature;
+} trace_sample;
+
+typedef struct {
+    long long sends;
+    long long late_usec;    /* from the first reading at or over the threshold until one was sent, or -1 */
+} replay_result;
+
+/* Read a whole trace. Returns the number of samples, or -1 */
+static long load_trace(const char *path, trace_sample **samples)
+{
+    FILE *in = fopen(path, "r");
+    if (in == NULL) {
+        perror(path);
+        return -1;
+    }
+    long count = 0, cap = 1024;
+    *samples = malloc(cap * sizeof(**samples));
+    char line[128];
+    double seconds;
+    float temperature;
+    while (*samples != NULL && fgets(line, sizeof(line), in) != NULL) {
+        if (line[0] == '#' || sscanf(line, "%lf %f", &seconds, &temperature) != 2) {
+            continue;
+        }
+        if (count == cap) {
+            cap *= 2;
+            trace_sample *grown = realloc(*samples, cap * sizeof(**samples));
+            if (grown == NULL) {
+                free(*samples);
+            }
+            *samples = grown;
+            if (grown == NULL) {
+                break;
+            }
+        }
+        (*samples)[count++] = (trace_sample){ .usec = llround(seconds * 1e6), .temperature = temperature };
+    }
+    fclose(in);
+    if (*samples == NULL) {
+        perror("report_replay");
+        return -1;
+    }
+    return count;
+}
+
+/* Play a trace through the policy, or through the old every-change rule when config is NULL */
+static replay_result replay(const trace_sample *samples, long count, const report_config *config, long long max_wait,
+                            float threshold)
+{
+    report_policy policy;
+    if (config != NULL) {
+        report_policy_init(&policy, config);
+    }
+    replay_result result = { 0, -1 };
+    long long crossed = -1, next_heartbeat = 0;
+    float current = 0;
+
+    for (long i = 0; i < count; i++) {
+        long long now = samples[i].usec;
+        /* heartbeats repeat the last reading sent */
+        while (i > 0 && next_heartbeat <= now) {
+            result.sends++;
+            if (crossed >= 0 && result.late_usec < 0 && current >= threshold) {
+                result.late_usec = next_heartbeat - crossed;
+            }
+            next_heartbeat += config != NULL ? report_policy_sent(&policy, current, 1) : max_wait;
+        }
+
+        float temperature = samples[i].temperature;
+        if (crossed < 0 && temperature >= threshold) {
+            crossed = now;
+        }
+        int send = i == 0 || temperature != current;
+        if (config != NULL && temperature != current) {
+            send = report_policy_sample(&policy, temperature, now) || i == 0;
+        }
+        current = temperature;
+        if (send) {
+            result.sends++;
+            if (crossed >= 0 && result.late_usec < 0 && temperature >= threshold) {
+                result.late_usec = now - crossed;
+            }
+            next_heartbeat = now + (config != NULL ? report_policy_sent(&policy, temperature, 0) : max_wait);
+        }
+    }
+    return result;
+}
+
+static void print_result(const char *rule, const replay_result *result, double minutes, int crosses)
+{
+    printf("  %-15s %8.1f datagrams/min", rule, result->sends / minutes);
+    if (crosses && result->late_usec >= 0) {
+        printf(", reading over the threshold sent after %.0fms", result->late_usec / 1e3);
+    } else if (crosses) {
+        printf(", reading over the threshold never sent");
+    }
+    printf("\n");
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3) {
+        fprintf(stderr, "usage: report_replay {max update wait (microseconds)} {trace file}...\n"
+                        "environment: TEMPSENSOR_DEAD_BAND, TEMPSENSOR_RISE_RATE (per second), TEMPSENSOR_THRESHOLD, "
+                        "TEMPSENSOR_APPROACH (degrees)\n");
+        exit(1);
+    }
+    long long max_wait = atoll(argv[1]);
+    if (max_wait <= 0) {
+        fprintf(stderr, "report_replay: max update wait must be positive\n");
+        exit(1);
+    }
+
+    /* the same defaults as tempsensor */
+    const char *value;
+    report_config config;
+    config.dead_band = (value = getenv("TEMPSENSOR_DEAD_BAND")) != NULL ? atof(value) : 0.5f;
+    config.rise_rate = (value = getenv("TEMPSENSOR_RISE_RATE")) != NULL ? atof(value) : 1.0f;
+    config.threshold = (value = getenv("TEMPSENSOR_THRESHOLD")) != NULL ? atof(value) : NAN;
+    config.approach = (value = getenv("TEMPSENSOR_APPROACH")) != NULL ? atof(value) : 10.0f;
+    config.max_interval = max_wait;
+
+    for (int i = 2; i < argc; i++) {
+        trace_sample *samples;
+        long count = load_trace(argv[i], &samples);
+        if (count < 0) {
+            exit(1);
+        }
+        if (count < 2) {
+            fprintf(stderr, "report_replay: %s has fewer than two readings\n", argv[i]);
+            free(samples);
+            continue;
+        }
+        double minutes = (samples[count - 1].usec - samples[0].usec) / 60e6;
+        int crosses = 0;
+        for (long j = 0; j < count && !isnan(config.threshold); j++) {
+            crosses |= samples[j].temperature >= config.threshold;
+        }
+
+        replay_result old_rule = replay(samples, count, NULL, max_wait, config.threshold);
+        replay_result policy = replay(samples, count, &config, max_wait, config.threshold);
+        printf("report_replay: %s, %ld readings over %.1f minutes\n", argv[i], count, minutes);
+        print_result("every change:", &old_rule, minutes, crosses);
+        print_result("report policy:", &policy, minutes, crosses);
+        free(samples);
+    }
+    return 0;
+}
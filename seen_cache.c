@@ -0,0 +1,25 @@
+/*
+ * Direct-mapped cache of readings already passed on. See seen_cache.h.
+*/
+
+#include <string.h>
+#include "seen_cache.h"
+
+void seen_cache_init(seen_cache *cache)
+{
+    memset(cache, 0, sizeof(*cache));
+}
+
+int seen_cache_add(seen_cache *cache, uint16_t id, long long timestamp)
+{
+    /* timestamps are microseconds, so their low bits vary the most; mix in the id and take the top bits */
+    uint64_t hash = ((uint64_t)timestamp ^ (uint64_t)id << 48) * 0x9e3779b97f4a7c15ull;
+    seen_entry *slot = &cache->slots[hash >> (64 - SEEN_CACHE_BITS)];
+    if (slot->used && slot->timestamp == timestamp && slot->id == id) {
+        return 1;
+    }
+    slot->timestamp = timestamp;
+    slot->id = id;
+    slot->used = 1;
+    return 0;
+}
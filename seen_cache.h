@@ -0,0 +1,33 @@
+/*
+ * Cache of the readings a temperature sensor has already passed on.
+ *
+ * A reading is identified by its sensor id and timestamp. The cache is a fixed, direct-mapped table: each reading
+ * hashes to one slot and replaces whatever was there, so lookups are O(1) and memory never grows. A reading pushed
+ * out by a collision may be passed on a second time if it comes back, which the hop count in the datagram still
+ * bounds; a reading that was never seen is never taken for one that was.
+*/
+
+#ifndef SEEN_CACHE_H
+#define SEEN_CACHE_H
+
+#include <stdint.h>
+
+#define SEEN_CACHE_BITS 12
+#define SEEN_CACHE_SLOTS (1 << SEEN_CACHE_BITS) /* well over the readings in flight in a network of hundreds */
+
+typedef struct {
+    long long timestamp;
+    uint16_t id;
+    uint8_t used;
+} seen_entry;
+
+typedef struct {
+    seen_entry slots[SEEN_CACHE_SLOTS];
+} seen_cache;
+
+void seen_cache_init(seen_cache *cache);
+
+/* Record a reading. Returns 1 if it had already been recorded, 0 if it is new */
+int seen_cache_add(seen_cache *cache, uint16_t id, long long timestamp);
+
+#endif
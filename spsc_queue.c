@@ -0,0 +1,63 @@
+/*
+ * Lock-free single-producer, single-consumer queue. See spsc_queue.h.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "spsc_queue.h"
+
+int spsc_queue_init(spsc_queue *queue, size_t capacity, size_t item_size)
+{
+    size_t cap = 1;
+    while (cap < capacity) {
+        cap *= 2;
+    }
+    memset(queue, 0, sizeof(*queue));
+    queue->items = malloc(cap * item_size);
+    if (queue->items == NULL) {
+        perror("spsc_queue_init");
+        return -1;
+    }
+    queue->item_size = item_size;
+    queue->mask = cap - 1;
+    atomic_init(&queue->head, 0);
+    atomic_init(&queue->tail, 0);
+    return 0;
+}
+
+void spsc_queue_free(spsc_queue *queue)
+{
+    free(queue->items);
+    queue->items = NULL;
+}
+
+int spsc_queue_push(spsc_queue *queue, const void *item)
+{
+    size_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    if (tail - queue->head_cache > queue->mask) {
+        /* looks full; see how far the consumer has got */
+        queue->head_cache = atomic_load_explicit(&queue->head, memory_order_acquire);
+        if (tail - queue->head_cache > queue->mask) {
+            return -1;
+        }
+    }
+    memcpy(queue->items + (tail & queue->mask) * queue->item_size, item, queue->item_size);
+    atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+    return 0;
+}
+
+int spsc_queue_pop(spsc_queue *queue, void *item)
+{
+    size_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    if (head == queue->tail_cache) {
+        /* looks empty; see whether the producer has added more */
+        queue->tail_cache = atomic_load_explicit(&queue->tail, memory_order_acquire);
+        if (head == queue->tail_cache) {
+            return -1;
+        }
+    }
+    memcpy(item, queue->items + (head & queue->mask) * queue->item_size, queue->item_size);
+    atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+    return 0;
+}
@@ -0,0 +1,44 @@
+/*
+ * Bounded single-producer, single-consumer queue of fixed-size items.
+ *
+ * Used to hand work between the fire alarm unit's threads without a lock: exactly one thread pushes and exactly
+ * one thread pops. The two indices live on separate cache lines and each side keeps a cached copy of the other's
+ * index, so in the steady state a push or pop touches no cache line the other thread is writing. Neither call
+ * blocks; waking a consumer that is asleep is up to the caller.
+*/
+
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+#define SPSC_CACHE_LINE 64
+
+typedef struct {
+    /* written by the producer */
+    _Alignas(SPSC_CACHE_LINE) atomic_size_t tail;
+    size_t head_cache;          /* consumer's index as last seen by the producer */
+
+    /* written by the consumer */
+    _Alignas(SPSC_CACHE_LINE) atomic_size_t head;
+    size_t tail_cache;          /* producer's index as last seen by the consumer */
+
+    /* fixed after spsc_queue_init */
+    _Alignas(SPSC_CACHE_LINE) char *items;
+    size_t item_size;
+    size_t mask;                /* capacity - 1; capacity is a power of two */
+} spsc_queue;
+
+/* capacity is rounded up to a power of two. Returns 0, or -1 if memory is exhausted */
+int spsc_queue_init(spsc_queue *queue, size_t capacity, size_t item_size);
+
+void spsc_queue_free(spsc_queue *queue);
+
+/* Producer only. Returns 0, or -1 if the queue is full */
+int spsc_queue_push(spsc_queue *queue, const void *item);
+
+/* Consumer only. Returns 0, or -1 if the queue is empty */
+int spsc_queue_pop(spsc_queue *queue, void *item);
+
+#endif
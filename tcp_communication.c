@@ -1,59 +1,331 @@
+/*
+ * Shared TCP transport: address parsing, bounded connects and sends, and framed ring-buffered connections.
+ * See tcp_communication.h.
+*/
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
-#include <netdb.h>
+#include "tcp_communication.h"
+
+#define RING_MASK (TCP_RING_SIZE - 1)
+
+/* Recycled connection structs */
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static tcp_conn *free_conns;
+
+static long long now_msec(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/* Wait for fd to become ready for events until deadline (a now_msec value). Returns 1 if ready, 0 on timeout */
+static int wait_ready(int fd, short events, long long deadline)
+{
+    for (;;) {
+        long long remaining = deadline - now_msec();
+        if (remaining < 0) {
+            remaining = 0;
+        }
+        struct pollfd pfd = { .fd = fd, .events = events };
+        int ready = poll(&pfd, 1, (int)remaining);
+        if (ready > 0) {
+            return 1;
+        }
+        if (ready == 0) {
+            errno = ETIMEDOUT;
+            return 0;
+        }
+        if (errno != EINTR) {
+            return 0;
+        }
+    }
+}
+
+int tcp_parse_address(const char *text, struct sockaddr_in *addr)
+{
+    char ip[INET_ADDRSTRLEN];
+    const char *colon = strchr(text, ':');
+    if (colon == NULL || (size_t)(colon - text) >= sizeof(ip)) {
+        return -1;
+    }
+    memcpy(ip, text, colon - text);
+    ip[colon - text] = '\0';
 
-int createSocket() {
-    // Create a socket, set up the server address, and connect
-    int sockfd = socket(AF_INET, SOCK_STREAM, 0);   // Create socket for client and corresponding error handling
-    if (sockfd == -1) { 
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons(atoi(colon + 1));
+    if (inet_pton(AF_INET, ip, &addr->sin_addr) != 1 || addr->sin_port == 0) {
+        return -1;
+    }
+    return 0;
+}
+
+int tcp_set_nonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags == -1) {
+        return -1;
+    }
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+int tcp_connect_start(const struct sockaddr_in *addr)
+{
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
         perror("socket()");
-        return 1;
+        return -1;
+    }
+    /* every message is small and latency matters more than packet count */
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    if (connect(fd, (const struct sockaddr *)addr, sizeof(*addr)) == -1 && errno != EINPROGRESS) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    return fd;
+}
+
+int tcp_connect_finish(int fd)
+{
+    int error = 0;
+    socklen_t len = sizeof(error);
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len) == -1) {
+        return -1;
+    }
+    if (error != 0) {
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
+
+int tcp_connect_timeout(const struct sockaddr_in *addr, int timeout_ms)
+{
+    int fd = tcp_connect_start(addr);
+    if (fd == -1) {
+        return -1;
+    }
+    if (!wait_ready(fd, POLLOUT, now_msec() + timeout_ms) || tcp_connect_finish(fd) == -1) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    return fd;
+}
+
+int tcp_send_all(int fd, const char *data, size_t len, int timeout_ms)
+{
+    long long deadline = now_msec() + timeout_ms;
+    while (len > 0) {
+        ssize_t sent = send(fd, data, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (sent > 0) {
+            data += sent;
+            len -= sent;
+        } else if (sent == -1 && errno == EINTR) {
+            continue;
+        } else if (sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            if (!wait_ready(fd, POLLOUT, deadline)) {
+                return -1;
+            }
+        } else {
+            return -1;
+        }
     }
-    return sockfd;
+    return 0;
 }
 
-void configureServerAddressForClient(struct sockaddr_in addr, const char server_ip[]) {
-    memset(&addr, 0, sizeof(addr));
-    if (inet_pton(AF_INET, server_ip, &addr.sin_addr) != 1) {
-        perror("inet_pton()");
-        return 1;
+ssize_t tcp_recv_timeout(int fd, char *buf, size_t len, int timeout_ms)
+{
+    long long deadline = now_msec() + timeout_ms;
+    for (;;) {
+        ssize_t n = recv(fd, buf, len, MSG_DONTWAIT);
+        if (n >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            return n;
+        }
+        if (errno != EINTR && !wait_ready(fd, POLLIN, deadline)) {
+            return -1;
+        }
     }
 }
 
-void establishConnection(int socket, struct sockaddr_in serverAddr, int portNumber) {
-    serverAddr.sin_family = AF_INET;
-    serverAddr.sin_port = htons(portNumber);
-    int connection_status = connect(socket, (struct sockaddr *)&serverAddr, sizeof(serverAddr));
-    if (connection_status == -1) {
-        perror("connect()");
-        return 1;
+/*************************
+Framed, ring-buffered conns
+*************************/
+
+tcp_conn *tcp_conn_new(int fd)
+{
+    pthread_mutex_lock(&pool_mutex);
+    tcp_conn *conn = free_conns;
+    if (conn != NULL) {
+        free_conns = conn->next_free;
     }
+    pthread_mutex_unlock(&pool_mutex);
 
+    if (conn == NULL) {
+        conn = malloc(sizeof(*conn));
+        if (conn == NULL) {
+            return NULL;
+        }
+    }
+    /* the ring contents are never read before being written, so only the bookkeeping needs resetting */
+    conn->fd = fd;
+    conn->in.head = conn->in.tail = 0;
+    conn->out.head = conn->out.tail = 0;
+    conn->in_scan = 0;
+    conn->next_free = NULL;
+    return conn;
 }
 
+void tcp_conn_free(tcp_conn *conn)
+{
+    if (conn == NULL) {
+        return;
+    }
+    if (conn->fd != -1) {
+        close(conn->fd);
+    }
+    pthread_mutex_lock(&pool_mutex);
+    conn->next_free = free_conns;
+    free_conns = conn;
+    pthread_mutex_unlock(&pool_mutex);
+}
 
-void sendData(int socket, char *data) {
-    // Send data
-    int sent = send(socket, data, strlen(data), 0);
-    if (sent == -1) {
-        perror("send()");
-        return 1;
+ssize_t tcp_conn_fill(tcp_conn *conn)
+{
+    tcp_ring *in = &conn->in;
+    size_t space = TCP_RING_SIZE - (in->tail - in->head);
+    if (space == 0) {
+        errno = ENOBUFS;
+        return -1;
     }
+
+    /* the free space is at most two runs: up to the end of the array, then from its start */
+    size_t pos = in->tail & RING_MASK;
+    size_t first = TCP_RING_SIZE - pos < space ? TCP_RING_SIZE - pos : space;
+    struct iovec iov[2] = {
+        { .iov_base = in->data + pos, .iov_len = first },
+        { .iov_base = in->data, .iov_len = space - first },
+    };
+    ssize_t n;
+    do {
+        n = readv(conn->fd, iov, first < space ? 2 : 1);
+    } while (n == -1 && errno == EINTR);
+    if (n > 0) {
+        in->tail += n;
+    }
+    return n;
 }
 
+char *tcp_conn_next_frame(tcp_conn *conn)
+{
+    tcp_ring *in = &conn->in;
+    for (;;) {
+        /* devices may separate messages with whitespace (doors append a newline) */
+        while (in->head < in->tail) {
+            char c = in->data[in->head & RING_MASK];
+            if (c != '\n' && c != '\r' && c != ' ' && c != '\0') {
+                break;
+            }
+            in->head++;
+        }
+        if (conn->in_scan < in->head) {
+            conn->in_scan = in->head;
+        }
+
+        char *hash = NULL;
+        while (conn->in_scan < in->tail) {
+            size_t pos = conn->in_scan & RING_MASK;
+            size_t run = in->tail - conn->in_scan;
+            if (run > TCP_RING_SIZE - pos) {
+                run = TCP_RING_SIZE - pos;
+            }
+            hash = memchr(in->data + pos, '#', run);
+            if (hash != NULL) {
+                conn->in_scan += hash - (in->data + pos);
+                break;
+            }
+            conn->in_scan += run;
+        }
+        if (hash == NULL) {
+            return NULL;
+        }
+
+        size_t start = in->head, end = conn->in_scan;
+        in->head = conn->in_scan = end + 1;
+        if (start == end) {
+            continue;   /* empty message */
+        }
+
+        size_t start_pos = start & RING_MASK, end_pos = end & RING_MASK;
+        if (start_pos < end_pos) {
+            /* the common case: hand out the message in place, replacing '#' with the terminator */
+            *hash = '\0';
+            return in->data + start_pos;
+        }
+        size_t first = TCP_RING_SIZE - start_pos;
+        memcpy(conn->scratch, in->data + start_pos, first);
+        memcpy(conn->scratch + first, in->data, end_pos);
+        conn->scratch[first + end_pos] = '\0';
+        return conn->scratch;
+    }
+}
 
-int receiveData(int socket, char *buffer) {
-    // Receive data
-    int dataReceived = recv(socket, buffer, sizeof(buffer), 0);
-    if (dataReceived == -1) {
-        perror("recv()");
-        return 1;
+int tcp_conn_queue(tcp_conn *conn, const char *msg, size_t len)
+{
+    tcp_ring *out = &conn->out;
+    if (len > TCP_RING_SIZE - (out->tail - out->head)) {
+        return -1;
     }
-    return dataReceived;
-}
\ No newline at end of file
+    size_t pos = out->tail & RING_MASK;
+    size_t first = TCP_RING_SIZE - pos < len ? TCP_RING_SIZE - pos : len;
+    memcpy(out->data + pos, msg, first);
+    memcpy(out->data, msg + first, len - first);
+    out->tail += len;
+    return 0;
+}
+
+int tcp_conn_flush(tcp_conn *conn)
+{
+    tcp_ring *out = &conn->out;
+    while (out->head < out->tail) {
+        /* everything queued goes out in one call: at most two runs of the ring */
+        size_t pending = out->tail - out->head;
+        size_t pos = out->head & RING_MASK;
+        size_t first = TCP_RING_SIZE - pos < pending ? TCP_RING_SIZE - pos : pending;
+        struct iovec iov[2] = {
+            { .iov_base = out->data + pos, .iov_len = first },
+            { .iov_base = out->data, .iov_len = pending - first },
+        };
+        struct msghdr msg = { .msg_iov = iov, .msg_iovlen = first < pending ? 2 : 1 };
+
+        ssize_t n = sendmsg(conn->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 1 : -1;
+        }
+        out->head += n;
+    }
+    return 0;
+}
@@ -1,5 +1,80 @@
-void configureServerAddress(struct sockaddr_in serverAddr, const char server_ip);
-int createSocket();
-void establishConnection(int socket, struct sockaddr_in serverAddr, int portNumber);
-void sendData(int socket, char *data);
-int receiveData(int socket, char *buffer);
\ No newline at end of file
+/*
+ * Shared TCP transport for the overseer, card readers, doors and fire alarm units.
+ *
+ * Every protocol message is ASCII text terminated by '#'. A tcp_conn pairs a socket with an input ring, from which
+ * complete messages are handed out in place, and an output ring, whose queued messages are written with a single
+ * writev. Connection structs are recycled through a free list, so busy servers do not churn the allocator.
+*/
+
+#ifndef TCP_COMMUNICATION_H
+#define TCP_COMMUNICATION_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+
+#define TCP_RING_SIZE 2048      /* power of two; also the longest message that can be framed */
+
+typedef struct {
+    char data[TCP_RING_SIZE];
+    size_t head;    /* bytes consumed so far; both counters only ever increase */
+    size_t tail;    /* bytes produced so far */
+} tcp_ring;
+
+typedef struct tcp_conn {
+    int fd;
+    tcp_ring in;
+    tcp_ring out;
+    size_t in_scan;                 /* input before this position is known to hold no '#' */
+    char scratch[TCP_RING_SIZE];    /* holds a message that wraps around the end of the input ring */
+    struct tcp_conn *next_free;
+} tcp_conn;
+
+/* Parse "ip:port" into addr. Returns 0, or -1 if malformed */
+int tcp_parse_address(const char *text, struct sockaddr_in *addr);
+
+int tcp_set_nonblocking(int fd);
+
+/* Start a non-blocking connect. Returns the socket (connected or in progress), or -1 if it failed outright */
+int tcp_connect_start(const struct sockaddr_in *addr);
+
+/* Check the outcome of a connect started with tcp_connect_start once the socket is writable. 0 if connected */
+int tcp_connect_finish(int fd);
+
+/* Connect, giving up after timeout_ms. Returns a connected non-blocking socket, or -1 */
+int tcp_connect_timeout(const struct sockaddr_in *addr, int timeout_ms);
+
+/* Send a whole message on a blocking or non-blocking socket, waiting up to timeout_ms for buffer space.
+ * Returns 0, or -1 if the peer has gone or the timeout passed */
+int tcp_send_all(int fd, const char *data, size_t len, int timeout_ms);
+
+/* Receive whatever is available within timeout_ms. Returns bytes read, 0 on close, -1 on error or timeout */
+ssize_t tcp_recv_timeout(int fd, char *buf, size_t len, int timeout_ms);
+
+/* Take a connection struct from the pool for fd. Returns NULL if memory is exhausted */
+tcp_conn *tcp_conn_new(int fd);
+
+/* Close the socket and return the struct to the pool */
+void tcp_conn_free(tcp_conn *conn);
+
+/* One read into the free space of the input ring. Returns bytes read, 0 if the peer closed, or -1 with errno
+ * set (EAGAIN when nothing is waiting, ENOBUFS when the ring is full without a complete message) */
+ssize_t tcp_conn_fill(tcp_conn *conn);
+
+/* Next complete message, without its '#' and NUL terminated, with leading whitespace skipped. The pointer refers
+ * to the ring itself and stays valid until the next tcp_conn_fill. Returns NULL if no complete message is buffered */
+char *tcp_conn_next_frame(tcp_conn *conn);
+
+/* Append a message to the output ring. Returns 0, or -1 if there is not enough room */
+int tcp_conn_queue(tcp_conn *conn, const char *msg, size_t len);
+
+/* Write as much queued output as the socket takes, in one writev. Returns 0 when everything is sent,
+ * 1 if output is still pending, or -1 if the connection is broken */
+int tcp_conn_flush(tcp_conn *conn);
+
+static inline size_t tcp_conn_pending(const tcp_conn *conn)
+{
+    return conn->out.tail - conn->out.head;
+}
+
+#endif
@@ -0,0 +1,248 @@
+/*
+ * Encoding and decoding of TEMP datagrams. See temp_wire.h.
+*/
+
+#include <string.h>
+#include "temp_wire.h"
+
+static unsigned char *put_varint(unsigned char *p, unsigned int value)
+{
+    while (value >= 0x80) {
+        *p++ = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    *p++ = (unsigned char)value;
+    return p;
+}
+
+/* Read a varint of at most 16 bits. Returns the position after it, or NULL if it runs past end or is too large */
+static const unsigned char *get_varint(const unsigned char *p, const unsigned char *end, unsigned int *value)
+{
+    *value = 0;
+    for (int shift = 0; shift < 21 && p < end; shift += 7) {
+        unsigned char byte = *p++;
+        *value |= (unsigned int)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return *value <= 0xffff ? p : NULL;
+        }
+    }
+    return NULL;
+}
+
+static const unsigned char *get_be(const unsigned char *p, int bytes, uint64_t *value)
+{
+    *value = 0;
+    for (int i = 0; i < bytes; i++) {
+        *value = *value << 8 | p[i];
+    }
+    return p + bytes;
+}
+
+static unsigned char *put_be(unsigned char *p, int bytes, uint64_t value)
+{
+    for (int i = bytes - 1; i >= 0; i--) {
+        p[i] = (unsigned char)value;
+        value >>= 8;
+    }
+    return p + bytes;
+}
+
+static int decode_legacy(const unsigned char *datagram, temp_reading *reading)
+{
+    struct timeval timestamp;
+    uint8_t count;
+    memcpy(&timestamp, datagram + offsetof(struct datagram_format, timestamp), sizeof(timestamp));
+    memcpy(&reading->temperature, datagram + offsetof(struct datagram_format, temperature), sizeof(reading->temperature));
+    memcpy(&reading->id, datagram + offsetof(struct datagram_format, id), sizeof(reading->id));
+    memcpy(&count, datagram + offsetof(struct datagram_format, address_count), sizeof(count));
+    if (count > TEMP_WIRE_MAX_ADDRESSES) {
+        return -1;
+    }
+    reading->timestamp = (long long)timestamp.tv_sec * 1000000 + timestamp.tv_usec;
+    reading->address_count = count;
+    reading->addresses = datagram + offsetof(struct datagram_format, address_list);
+    reading->hops = TEMP_WIRE_HOP_LIMIT - count;
+    reading->version = TEMP_WIRE_LEGACY_VERSION;
+    return 0;
+}
+
+int temp_wire_decode(const void *datagram, size_t len, temp_reading *reading)
+{
+    const unsigned char *p = datagram;
+    const unsigned char *end = p + len;
+    if (len < 4 || memcmp(p, "TEMP", 4) != 0) {
+        return -1;
+    }
+    if (len == sizeof(struct datagram_format)) {
+        return decode_legacy(p, reading);
+    }
+    /* version 2 is the same, less the hop count */
+    int version = len > 4 ? p[4] : 0;
+    size_t header = version == 2 ? 5 : 6;
+    if ((version != 2 && version != TEMP_WIRE_VERSION) || len < header + 8 + 4) {
+        return -1;
+    }
+    int hops = version == TEMP_WIRE_VERSION ? p[5] : -1;
+
+    uint64_t timestamp, temperature_bits;
+    p = get_be(p + header, 8, &timestamp);
+    p = get_be(p, 4, &temperature_bits);
+    uint32_t bits = (uint32_t)temperature_bits;
+    memcpy(&reading->temperature, &bits, sizeof(bits));
+    reading->timestamp = (long long)timestamp;
+
+    /* the count is at most 50, so always a single byte; temp_wire_append_address() relies on that */
+    unsigned int id, count;
+    if ((p = get_varint(p, end, &id)) == NULL || p == end || *p > TEMP_WIRE_MAX_ADDRESSES) {
+        return -1;
+    }
+    count = *p++;
+    reading->id = (uint16_t)id;
+    reading->address_count = (int)count;
+    reading->addresses = p;
+    reading->hops = hops >= 0 ? hops : TEMP_WIRE_HOP_LIMIT - (int)count;
+    reading->version = version;
+
+    /* check the list is all there, so that temp_wire_addresses() cannot run off the end */
+    for (unsigned int i = 0; i < count; i++) {
+        unsigned int port;
+        if (end - p < 4 || (p = get_varint(p + 4, end, &port)) == NULL) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void temp_wire_addresses(const temp_reading *reading, temp_wire_address *list)
+{
+    const unsigned char *p = reading->addresses;
+    for (int i = 0; i < reading->address_count; i++) {
+        if (reading->version == TEMP_WIRE_LEGACY_VERSION) {
+            struct addr_entry entry;
+            memcpy(&entry, p + i * sizeof(entry), sizeof(entry));
+            list[i].addr = entry.sensor_addr;
+            list[i].port = entry.sensor_port;
+        } else {
+            unsigned int port;
+            memcpy(&list[i].addr, p, 4);
+            p = get_varint(p + 4, p + 4 + 3, &port);
+            list[i].port = (in_port_t)port;
+        }
+    }
+}
+
+int temp_wire_contains(const temp_reading *reading, struct in_addr addr, in_port_t port)
+{
+    const unsigned char *p = reading->addresses;
+    for (int i = 0; i < reading->address_count; i++) {
+        struct in_addr entry_addr;
+        unsigned int entry_port;
+        if (reading->version == TEMP_WIRE_LEGACY_VERSION) {
+            struct addr_entry entry;
+            memcpy(&entry, p + i * sizeof(entry), sizeof(entry));
+            entry_addr = entry.sensor_addr;
+            entry_port = entry.sensor_port;
+        } else {
+            memcpy(&entry_addr, p, 4);
+            p = get_varint(p + 4, p + 4 + 3, &entry_port);
+        }
+        if (entry_addr.s_addr == addr.s_addr && entry_port == port) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+size_t temp_wire_append_address(unsigned char *datagram, temp_reading *reading, const temp_wire_address *address)
+{
+    /* the list is the tail of what was decoded; find where it ends, and where its first entry ends */
+    unsigned char *list = datagram + (reading->addresses - datagram);
+    const unsigned char *end = list, *second = list;
+    for (int i = 0; i < reading->address_count; i++) {
+        unsigned int port;
+        end = get_varint(end + 4, end + 4 + 3, &port);
+        if (i == 0) {
+            second = end;
+        }
+    }
+
+    if (reading->address_count == TEMP_WIRE_MAX_ADDRESSES) {
+        memmove(list, second, (size_t)(end - second));
+        end -= second - list;
+        reading->address_count--;
+    }
+    unsigned char *p = datagram + (end - datagram);
+    memcpy(p, &address->addr, 4);
+    p = put_varint(p + 4, address->port);
+
+    /* a count of at most 50 is a single varint byte, just before the list */
+    list[-1] = (unsigned char)++reading->address_count;
+    datagram[5] = (unsigned char)--reading->hops;
+    return (size_t)(p - datagram);
+}
+
+size_t temp_wire_encode(unsigned char *buffer, int hops, long long timestamp, float temperature, uint16_t id,
+                        const temp_wire_address *addresses, int count)
+{
+    uint32_t bits;
+    memcpy(&bits, &temperature, sizeof(bits));
+
+    unsigned char *p = buffer;
+    memcpy(p, "TEMP", 4);
+    p[4] = TEMP_WIRE_VERSION;
+    p[5] = (unsigned char)hops;
+    p = put_be(p + 6, 8, (uint64_t)timestamp);
+    p = put_be(p, 4, bits);
+    p = put_varint(p, id);
+    p = put_varint(p, (unsigned int)count);
+    for (int i = 0; i < count; i++) {
+        memcpy(p, &addresses[i].addr, 4);
+        p = put_varint(p + 4, addresses[i].port);
+    }
+    return (size_t)(p - buffer);
+}
+
+int temp_wire_is_batch(const void *datagram, size_t len)
+{
+    const unsigned char *p = datagram;
+    return len >= TEMP_WIRE_BATCH_HEADER && len != sizeof(struct datagram_format) && memcmp(p, "TEMP", 4) == 0
+           && p[4] == TEMP_WIRE_BATCH;
+}
+
+const unsigned char *temp_wire_batch_next(const void *batch, size_t len, size_t *offset, size_t *reading_len)
+{
+    const unsigned char *start = batch;
+    const unsigned char *end = start + len;
+    const unsigned char *p = start + *offset;
+    unsigned int length = 0;
+    while (length == 0) {
+        if (p >= end || (p = get_varint(p, end, &length)) == NULL || length > (size_t)(end - p)) {
+            return NULL;
+        }
+    }
+    *offset = (size_t)(p + length - start);
+    *reading_len = length;
+    return p;
+}
+
+size_t temp_wire_batch_start(unsigned char *buffer)
+{
+    memcpy(buffer, "TEMP", 4);
+    buffer[4] = TEMP_WIRE_BATCH;
+    return TEMP_WIRE_BATCH_HEADER;
+}
+
+size_t temp_wire_batch_add(unsigned char *buffer, size_t len, const unsigned char *datagram, size_t datagram_len)
+{
+    /* the length takes at most 3 bytes, and there may be a byte of padding */
+    if (len + 3 + datagram_len + 1 > TEMP_WIRE_BATCH_MAX) {
+        return 0;
+    }
+    unsigned char *p = put_varint(buffer + len, (unsigned int)datagram_len);
+    memcpy(p, datagram, datagram_len);
+    p += datagram_len;
+    if (p - buffer == sizeof(struct datagram_format)) {
+        *p++ = 0;
+    }
+    return (size_t)(p - buffer);
+}
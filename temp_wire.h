@@ -0,0 +1,107 @@
+/*
+ * Wire format of the TEMP datagrams exchanged by temperature sensors and read by the fire alarm unit.
+ *
+ * A datagram is "TEMP", a version byte, and then only what is in use:
+ *
+ *     "TEMP" | version (1) | hops left (1) | timestamp, usec since the epoch (8) | temperature, IEEE 754 (4)
+ *            | id (varint) | address count (varint) | per address: IPv4 address (4), port (varint)
+ *
+ * Multi-byte fixed fields are big-endian; varints are LEB128, seven bits per byte, least significant first. A
+ * reading from a sensor forwarded over a couple of hops takes about 35 bytes instead of the 432 of the original
+ * fixed layout, struct datagram_format, which is still accepted so that sensors can be upgraded one at a time.
+ * Its datagrams are told apart by their size, since that layout has padding where the version byte now is.
+ *
+ * A reading starts out with TEMP_WIRE_HOP_LIMIT hops left and each sensor that passes it on takes one, so it can
+ * never circulate for ever. Version 2 datagrams, from before there was a hop count, are taken to have used one hop
+ * per address in their list.
+ *
+ * A batch datagram carries several readings at once, each a whole compact datagram behind its length:
+ *
+ *     "TEMP" | TEMP_WIRE_BATCH (1) | per reading: length (varint) | datagram
+ *
+ * A zero length is padding and is skipped; it keeps a batch from ever being the size of the original layout.
+*/
+
+#ifndef TEMP_WIRE_H
+#define TEMP_WIRE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+
+#define TEMP_WIRE_VERSION 3
+#define TEMP_WIRE_LEGACY_VERSION 1  /* struct datagram_format */
+#define TEMP_WIRE_MAX_ADDRESSES 50
+#define TEMP_WIRE_HOP_LIMIT 255     /* more than the diameter of any sensor network */
+#define TEMP_WIRE_COMPACT_MAX (4 + 1 + 1 + 8 + 4 + 3 + 1 + TEMP_WIRE_MAX_ADDRESSES * (4 + 3))
+#define TEMP_WIRE_BATCH 0x80        /* in place of the version */
+#define TEMP_WIRE_BATCH_HEADER 5
+#define TEMP_WIRE_BATCH_MAX 1472    /* one unfragmented UDP datagram over Ethernet */
+#define TEMP_WIRE_MAX_SIZE TEMP_WIRE_BATCH_MAX  /* room for any TEMP datagram, including the original layout */
+
+/* Original layout, sent whole whatever the address count */
+struct addr_entry {
+    struct in_addr sensor_addr;
+    in_port_t sensor_port;      /* host order */
+};
+
+struct datagram_format {
+    char header[4];             /* {'T', 'E', 'M', 'P'} */
+    struct timeval timestamp;
+    float temperature;
+    uint16_t id;
+    uint8_t address_count;
+    struct addr_entry address_list[TEMP_WIRE_MAX_ADDRESSES];
+};
+
+typedef struct {
+    struct in_addr addr;
+    in_port_t port;             /* host order */
+} temp_wire_address;
+
+/* A decoded datagram. The address list is left where it is in the datagram, for temp_wire_addresses() */
+typedef struct {
+    long long timestamp;        /* usec since the epoch */
+    float temperature;
+    uint16_t id;
+    int address_count;
+    const unsigned char *addresses;
+    int hops;                   /* times it may still be passed on */
+    int version;                /* TEMP_WIRE_VERSION, or an older layout that must be re-encoded to be extended */
+} temp_reading;
+
+/* Decode a TEMP datagram of either layout in place. Returns 0, or -1 if it is truncated or malformed */
+int temp_wire_decode(const void *datagram, size_t len, temp_reading *reading);
+
+/* Copy out the address list of a decoded datagram; list must have room for reading->address_count entries */
+void temp_wire_addresses(const temp_reading *reading, temp_wire_address *list);
+
+/* Whether an address is in the address list of a decoded datagram */
+int temp_wire_contains(const temp_reading *reading, struct in_addr addr, in_port_t port);
+
+/* Take a hop and append an address to the list of a decoded TEMP_WIRE_VERSION datagram in place, dropping the
+ * oldest entry first if the list is full; the reading itself is not touched. reading->hops must not be 0, and
+ * datagram must have room for TEMP_WIRE_COMPACT_MAX bytes. Returns the new length, and updates reading to match */
+size_t temp_wire_append_address(unsigned char *datagram, temp_reading *reading, const temp_wire_address *address);
+
+/* Encode a reading in the compact layout. buffer must hold TEMP_WIRE_COMPACT_MAX bytes and count must not exceed
+ * TEMP_WIRE_MAX_ADDRESSES. Returns the length of the datagram */
+size_t temp_wire_encode(unsigned char *buffer, int hops, long long timestamp, float temperature, uint16_t id,
+                        const temp_wire_address *addresses, int count);
+
+/* Whether a TEMP datagram is a batch. Its readings are stepped through with temp_wire_batch_next() */
+int temp_wire_is_batch(const void *datagram, size_t len);
+
+/* The next reading of a batch from *offset on, which starts at TEMP_WIRE_BATCH_HEADER. Returns the reading's datagram
+ * and sets its length, or returns NULL at the end of the batch or if the rest of it is malformed */
+const unsigned char *temp_wire_batch_next(const void *batch, size_t len, size_t *offset, size_t *reading_len);
+
+/* Start an empty batch in buffer, which must hold TEMP_WIRE_BATCH_MAX bytes. Returns its length */
+size_t temp_wire_batch_start(unsigned char *buffer);
+
+/* Add a reading to a batch of length len, if it fits in TEMP_WIRE_BATCH_MAX. Returns the new length, or 0 if it
+ * does not fit */
+size_t temp_wire_batch_add(unsigned char *buffer, size_t len, const unsigned char *datagram, size_t datagram_len);
+
+#endif
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <pthread.h>
@@ -12,10 +13,16 @@
 #include <netinet/in.h>
 #include <sys/time.h>
 #include <time.h>
+#include <poll.h>
+#include <errno.h>
+#include <math.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include "temp_wire.h"
+#include "seen_cache.h"
+#include "report_policy.h"
 
-#define MAX_BUFFER_SIZE 1024
-
-struct timeval lastUpdateTime;
+#define MAX_BUFFER_SIZE TEMP_WIRE_MAX_SIZE
 
 // shared memory struct. This data will be shared with simulator.
 typedef struct
@@ -25,47 +32,65 @@ typedef struct
     pthread_cond_t cond;
 } shm_sensor;
 
-// Datagram format for each address entry that will be in datagram
-struct addr_entry
-{
-    struct in_addr sensor_addr;
-    in_port_t sensor_port;
-};
-
-// Datagram that will be sent by tempsensor with all necessary details
-struct datagram_format
-{
-    char header[4]; // {'T', 'E', 'M', 'P'}
-    struct timeval timestamp;
-    float temperature;
-    uint16_t id;
-    uint8_t address_count;
-    struct addr_entry address_list[50];
-};
-
-// used to search addr_entry array to see if a particular address is already in it
-int search(struct addr_entry entries[], int PortNumber, int numberEntries);
-void updateLastUpdateTime();
-int hasMaxWaitTimePassed(int maxUpdateWait);
+shm_sensor *shared;
+int temperatureEvent;   // eventfd raised by the watcher thread when the temperature changes
+int maxWaitCondvar;     // microseconds
+
+// Receivers from the command line, resolved once at startup, and one message per receiver so that a datagram can
+// be sent to all of them with a single sendmmsg()
+struct sockaddr_in *receivers;
+int receiverCount;
+struct mmsghdr *fanout;
+
+// A receiver may be a multicast group, which takes one datagram for all its members. The sensor joins every group it
+// sends to, and a reading that came in through a group is not passed on to that group again
+int *groupSockets;      // per receiver: socket subscribed to it, or -1 for a unicast receiver
+int groupCount;
+
+// Readings this sensor has sent or passed on, so that one arriving again by another path is not passed on twice
+seen_cache seen;
+
+// With a batch window, readings passed on within it go out together, one batch datagram per receiver, when the
+// window closes or a batch is full. Readings at or over the alarm threshold go out straight away with any waiting
+// before them. With no window each reading is passed on by itself
+long long batchWindow;  // microseconds
+int batchTimer;         // timerfd, armed while readings are waiting
+int batchWaiting;
+unsigned char (*batches)[TEMP_WIRE_BATCH_MAX];
+size_t *batchLengths;
+struct iovec *batchPayloads;
+float urgentThreshold;
+
+int parseAddress(const char *addressPort, struct sockaddr_in *addr);
+int joinGroup(const struct sockaddr_in *group, struct in_addr interface);
+void receiveDatagrams(int sockfd, int fromFd, int via, const temp_wire_address *thisSensor);
+void forwardReading(int sockfd, unsigned char *datagram, size_t length, const temp_wire_address *thisSensor, int via);
+void passOn(int sockfd, unsigned char *datagram, size_t length, const temp_reading *route, int via);
+void flushBatches(int sockfd);
+void sendToReceivers(int sockfd, unsigned char *datagram, size_t length, const temp_reading *route, int via);
+void sendFanout(int sockfd, int count);
+void *watchTemperature(void *arg);
+void armTimer(int timerFd, long long wait);
+void readReportConfig(report_config *config, int maxUpdateWait);
+long long monotonicUsec(void);
 
 int main(int argc, char **argv)
 {
     // Sees if enough command line arguments were supplied
     if (argc < 6)
     {
-        fprintf(stderr, "usage: {id} {address:port} {max condvar wait (microseconds)} {max update wait (microseconds)} {shared memory path} {shared memory offset} {receiver address:port}...");
+        fprintf(stderr, "usage: {id} {address:port} {max condvar wait (microseconds)} {max update wait (microseconds)} {shared memory path} {shared memory offset} {receiver address:port}...\n"
+                        "environment: TEMPSENSOR_DEAD_BAND, TEMPSENSOR_RISE_RATE (per second), TEMPSENSOR_THRESHOLD, TEMPSENSOR_APPROACH (degrees),\n"
+                        "             TEMPSENSOR_BATCH_WINDOW (microseconds)\n");
         exit(1);
     }
 
     // declare all addresses to be used in system
-    struct sockaddr_in sensor_addr, receiver_addr, client_addr;
+    struct sockaddr_in sensor_addr;
 
-    // declare all types of datagrams to be sent
-    struct datagram_format datagram, receivedDatagram, passMessageOn;
-    socklen_t addr_size;
-
-    // Configure buffer for receiving data
-    char receiveBuffer[MAX_BUFFER_SIZE];
+    // encoded datagram with this sensor's own readings
+    unsigned char datagram[TEMP_WIRE_COMPACT_MAX];
+    size_t datagramLength;
 
     // intialise parameters for system
     int id = atoi(argv[1]);
@@ -75,16 +100,48 @@ int main(int argc, char **argv)
     const char *shm_path = argv[5];
     off_t shm_offset = (off_t)atoi(argv[6]);
 
-    // Isolate port number from address number
-    const char *portString = strstr(tempsensor_addr, ":");
-    int portNumber = atoi(portString + 1);
+    // Resolve this sensor's address and every receiver's once
+    if (parseAddress(tempsensor_addr, &sensor_addr) == -1)
+    {
+        fprintf(stderr, "Invalid sensor address %s\n", tempsensor_addr);
+        exit(1);
+    }
+    receiverCount = argc > 7 ? argc - 7 : 0;
+    receivers = calloc(receiverCount + 1, sizeof(*receivers));
+    fanout = calloc(receiverCount + 1, sizeof(*fanout));
+    if (receivers == NULL || fanout == NULL)
+    {
+        perror("calloc()");
+        exit(1);
+    }
+    for (int i = 0; i < receiverCount; i++)
+    {
+        if (parseAddress(argv[7 + i], &receivers[i]) == -1)
+        {
+            fprintf(stderr, "Invalid receiver address %s\n", argv[7 + i]);
+            exit(1);
+        }
+    }
 
-    // configure initial UDP packet
-    struct timespec condWait;
-    condWait.tv_sec = 0;
-    condWait.tv_nsec = 0;
-    condWait.tv_sec += max_wait_condvar / 1000000;
-    condWait.tv_nsec += (max_wait_condvar % 1000000) * 1000;
+    maxWaitCondvar = max_wait_condvar;
+
+    const char *window = getenv("TEMPSENSOR_BATCH_WINDOW");
+    batchWindow = window != NULL ? atoll(window) : 0;
+    if (batchWindow > 0)
+    {
+        batches = calloc(receiverCount + 1, sizeof(*batches));
+        batchLengths = calloc(receiverCount + 1, sizeof(*batchLengths));
+        batchPayloads = calloc(receiverCount + 1, sizeof(*batchPayloads));
+        if (batches == NULL || batchLengths == NULL || batchPayloads == NULL)
+        {
+            perror("calloc()");
+            exit(1);
+        }
+        for (int i = 0; i < receiverCount; i++)
+        {
+            batchLengths[i] = temp_wire_batch_start(batches[i]);
+        }
+    }
 
     // Shared memory
     //  initialise shm
@@ -114,7 +171,7 @@ int main(int argc, char **argv)
     }
 
     // cast memory offset onto card_reader
-    shm_sensor *shared = (shm_sensor *)(shm + shm_offset);
+    shared = (shm_sensor *)(shm + shm_offset);
 
     // Create a socket
     int sockfd;
@@ -124,12 +181,7 @@ int main(int argc, char **argv)
         exit(EXIT_FAILURE);
     }
 
-    // configure connection for sensor to act as server for other sensors in system
-    memset(&sensor_addr, '\0', sizeof(sensor_addr));
-    sensor_addr.sin_family = AF_INET;
-    sensor_addr.sin_port = htons(portNumber);
-    sensor_addr.sin_addr.s_addr = inet_addr("127.0.0.1");
-
+    // sensor acts as server for other sensors in system
     /* bind server address to socket descriptor */
     if (bind(sockfd, (struct sockaddr *)&sensor_addr, sizeof(sensor_addr)) == -1)
     {
@@ -141,185 +193,151 @@ int main(int argc, char **argv)
     int flags = fcntl(sockfd, F_GETFL, 0);
     fcntl(sockfd, F_SETFL, flags | O_NONBLOCK);
 
-    // Create addr_entry instance containing this sensor's details
-    struct addr_entry thisSensor;
-    if (inet_pton(AF_INET, "127.0.0.1", &(thisSensor.sensor_addr)) <= 0)
+    // join the multicast groups among the receivers, on the interface of this sensor's address, and send to them
+    // from there too
+    groupSockets = malloc((receiverCount + 1) * sizeof(*groupSockets));
+    if (groupSockets == NULL)
     {
-        perror("Invalid address");
-        return 1;
+        perror("malloc()");
+        exit(1);
+    }
+    for (int i = 0; i < receiverCount; i++)
+    {
+        groupSockets[i] = -1;
+        if (IN_MULTICAST(ntohl(receivers[i].sin_addr.s_addr)))
+        {
+            if ((groupSockets[i] = joinGroup(&receivers[i], sensor_addr.sin_addr)) == -1)
+            {
+                exit(1);
+            }
+            groupCount++;
+        }
+    }
+    if (groupCount > 0
+        && setsockopt(sockfd, IPPROTO_IP, IP_MULTICAST_IF, &sensor_addr.sin_addr, sizeof(sensor_addr.sin_addr)) == -1)
+    {
+        perror("setsockopt(IP_MULTICAST_IF)");
+        exit(1);
+    }
+
+    // Create address entry containing this sensor's details
+    temp_wire_address thisSensor;
+    thisSensor.addr = sensor_addr.sin_addr;
+    thisSensor.port = ntohs(sensor_addr.sin_port);
+    seen_cache_init(&seen);
+
+    // The sensor sleeps until one of four things happens: a datagram arrives, the watcher thread sees the
+    // temperature change, the heartbeat comes due without this sensor having sent anything, or the batch window closes
+    temperatureEvent = eventfd(0, EFD_CLOEXEC);
+    int heartbeat = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    batchTimer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (temperatureEvent == -1 || heartbeat == -1 || batchTimer == -1)
+    {
+        perror("eventfd/timerfd");
+        exit(1);
+    }
+    pthread_t watcher;
+    if (pthread_create(&watcher, NULL, watchTemperature, NULL) != 0)
+    {
+        perror("pthread_create()");
+        exit(1);
+    }
+    pthread_detach(watcher);
+
+    // the four fds above, then the group sockets in receiver order
+    struct pollfd *events = calloc(4 + groupCount, sizeof(*events));
+    if (events == NULL)
+    {
+        perror("calloc()");
+        exit(1);
+    }
+    events[0] = (struct pollfd){.fd = sockfd, .events = POLLIN};
+    events[1] = (struct pollfd){.fd = temperatureEvent, .events = POLLIN};
+    events[2] = (struct pollfd){.fd = heartbeat, .events = POLLIN};
+    events[3] = (struct pollfd){.fd = batchTimer, .events = POLLIN};
+    for (int i = 0, j = 4; i < receiverCount; i++)
+    {
+        if (groupSockets[i] != -1)
+        {
+            events[j++] = (struct pollfd){.fd = groupSockets[i], .events = POLLIN};
+        }
     }
-    thisSensor.sensor_port = portNumber;
 
-    // mutex lock for normal operation
     pthread_mutex_lock(&shared->mutex);
     float oldTemp = shared->temperature;
-    float currentTemp;
-    int firstIteration = 1; // see if this is first iteration of for loop. 1 for true, 0 for false
+    pthread_mutex_unlock(&shared->mutex);
+    float currentTemp = oldTemp;
+    int sendReading = 1; // the first reading is sent straight away
+    int heartbeatDue = 0;
+
+    // what is sent and when is up to the reporting policy
+    report_config reportConfig;
+    readReportConfig(&reportConfig, max_wait_update);
+    urgentThreshold = reportConfig.threshold;
+    report_policy policy;
+    report_policy_init(&policy, &reportConfig);
+    report_policy_sample(&policy, currentTemp, monotonicUsec());
     for (;;)
     {
-        // update temperature reading 
-        currentTemp = shared->temperature;
-        pthread_mutex_unlock(&shared->mutex);
-        // send new datagram if temperature changes, if this is the first iteration of the for loop, or if max delay for info update has passed
-        if (currentTemp != oldTemp || firstIteration == 1 || hasMaxWaitTimePassed(max_wait_update) == 1)
+        // send new datagram if the policy wants the temperature sent, on the first iteration, or on a heartbeat
+        if (sendReading == 1 || heartbeatDue == 1)
         {
-            firstIteration = 0;
-            oldTemp = currentTemp;
-            // construct a struct that contains sensor's id, temp and current time and address list of only this sensor
-
-            // construct header
-            strcpy(datagram.header, "TEMP");
-
-            // timestamp
+            // encode a datagram that contains sensor's id, temp and current time and address list of only this sensor
             struct timeval timeStamp;
             gettimeofday(&timeStamp, NULL);
-
-            // temparture
-            datagram.temperature = currentTemp;
-            datagram.timestamp = timeStamp;
-
-            // id
-            datagram.id = id;
-
-            // address count
-            datagram.address_count = 1;
-
-            // list of addresses. It should only contain this sensor
-            // Add this sensor's details to the list
-            datagram.address_list[0] = thisSensor;
+            long long timeStampUsec = (long long)timeStamp.tv_sec * 1000000 + timeStamp.tv_usec;
+            datagramLength = temp_wire_encode(datagram, TEMP_WIRE_HOP_LIMIT, timeStampUsec, currentTemp, id, &thisSensor, 1);
+            seen_cache_add(&seen, id, timeStampUsec);
 
             //  send datagram to each receiver
-            for (int i = 7; i < argc; i++)
-            {
-                char *receiver_address_port = argv[i];
-                char *receiverPortString = strstr(receiver_address_port, ":");
-                int receiverPortNumber = atoi(receiverPortString + 1);
-
-                receiver_addr.sin_family = AF_INET;
-                receiver_addr.sin_addr.s_addr = inet_addr("127.0.0.1");
-                receiver_addr.sin_port = htons(receiverPortNumber);
-
-                if (sendto(sockfd, &datagram, sizeof(datagram), 0, (struct sockaddr *)&receiver_addr, sizeof(receiver_addr)) == -1)
-                {
-                    perror("sendto failed");
-                    exit(1);
-                }
-                // update time since the datagram was last sent to receivers
-                updateLastUpdateTime();
-            }
+            sendToReceivers(sockfd, datagram, datagramLength, NULL, -1);
+            // the next heartbeat is due when the policy says, counted from this reading
+            armTimer(heartbeat, report_policy_sent(&policy, currentTemp, !sendReading));
+            sendReading = 0;
+            heartbeatDue = 0;
         }
-        // configure size of address for receiving
-        addr_size = sizeof(client_addr);
-        while (1)
-        {
-            // receive data from other devices in network
-            int n = recvfrom(sockfd, &receiveBuffer, MAX_BUFFER_SIZE, MSG_DONTWAIT, (struct sockaddr *)&client_addr, &addr_size);
-            // if no datagrams received, exit while loop
-            if (n <= 0)
-            {
-                break;
-            }
-
-            // copy received data into a new datagram struct instance
-            memcpy(&receivedDatagram, &receiveBuffer, sizeof(receivedDatagram));
-
-            // copy header from received datagram
-            char receivedHeader[4];
-            strcpy(receivedHeader, receivedDatagram.header);
-
-            // copy timestamp from received datagram
-            struct timeval receivedTimeStamp;
-            receivedTimeStamp = receivedDatagram.timestamp;
-
-            // copy temperature from datagram
-            float receivedTemperature = receivedDatagram.temperature;
-
-            // copy ID from received datagram
-            int receivedId = receivedDatagram.id;
-
-            // copy addresses and address count into new datagram
-            int received_address_count = receivedDatagram.address_count;
-            struct addr_entry receivedEntries[50];
 
-            // copy received entires into the new datagram that will be posted
-            for (int i = 0; i < 50; i++)
-            {
-                receivedEntries[i] = receivedDatagram.address_list[i];
-            }
-
-            // Now add this sensor's details to the address list
-            // see if this list has 50 entries already.
-            if (receivedEntries[49].sensor_addr.s_addr == 0 && receivedEntries[49].sensor_port == 0)
-            {
-                // see which position this sensor should be placed in the list
-                for (int i = 0; i < 50; i++)
-                {
-                    if (receivedEntries[i].sensor_addr.s_addr != 0 && receivedEntries[i].sensor_port != 0)
-                    {
-                        receivedEntries[i] = thisSensor;
-                        received_address_count++;
-                        break;
-                    }
-                }
-            }
-
-            // if the list already has 50 entries then:
-            else
+        if (poll(events, 4 + groupCount, -1) == -1)
+        {
+            if (errno != EINTR)
             {
-                // shift every entry i - 1 places forward (first enrty will be replaced with second entry, 2nd with 3rd, etc)
-                for (int i = 0; i < 50; i++)
-                {
-                    receivedEntries[i] = receivedEntries[i + 1];
-                }
-                // place this sensor's details in the last position of the address list
-                receivedEntries[49] = thisSensor;
+                perror("poll()");
             }
+            continue;
+        }
 
-            // create new datagram and populate with all relevant data
-            struct datagram_format passMessageOn;
-            strcpy(passMessageOn.header, receivedHeader);
-            passMessageOn.timestamp = receivedTimeStamp;
-            passMessageOn.temperature = receivedTemperature;
-            passMessageOn.id = receivedId;
-            passMessageOn.address_count = received_address_count + 1;
-
-            // copy received addresses list to the list that will be posted to receivers
-            for (int i = 0; i < 50; i++)
+        uint64_t count;
+        if ((events[3].revents & POLLIN) && read(batchTimer, &count, sizeof(count)) > 0)
+        {
+            flushBatches(sockfd);
+        }
+        if ((events[2].revents & POLLIN) && read(heartbeat, &count, sizeof(count)) > 0)
+        {
+            heartbeatDue = 1;
+        }
+        if ((events[1].revents & POLLIN) && read(temperatureEvent, &count, sizeof(count)) > 0)
+        {
+            // update temperature reading
+            pthread_mutex_lock(&shared->mutex);
+            currentTemp = shared->temperature;
+            pthread_mutex_unlock(&shared->mutex);
+            if (currentTemp != oldTemp)
             {
-                passMessageOn.address_list[i] = receivedEntries[i];
+                oldTemp = currentTemp;
+                sendReading = report_policy_sample(&policy, currentTemp, monotonicUsec());
             }
-
-            // check to see if the received address list already contains any of the receivers this sensor is supposed to send data to
-            for (int i = 7; i < argc; i++)
+        }
+        if (events[0].revents & POLLIN)
+        {
+            receiveDatagrams(sockfd, sockfd, -1, &thisSensor);
+        }
+        for (int i = 0, j = 4; i < receiverCount; i++)
+        {
+            if (groupSockets[i] != -1 && (events[j++].revents & POLLIN))
             {
-                const char *address_port = argv[i];
-                const char *receiverPortString = strstr(address_port, ":");
-                int receiverPortNumber = atoi(receiverPortString + 1);
-
-                // use a search algorithm to find receiver addresses in the received address list
-                if (search(receivedEntries, receiverPortNumber, 50) == 1)
-                {
-                    // if addresses not found, then add receiver data to the address list
-                    receiver_addr.sin_family = AF_INET;
-                    receiver_addr.sin_addr.s_addr = inet_addr("127.0.0.1");
-                    receiver_addr.sin_port = htons(receiverPortNumber);
-
-                    // send to receiver
-                    if (sendto(sockfd, &passMessageOn, sizeof(passMessageOn), 0, (struct sockaddr *)&receiver_addr, sizeof(receiver_addr)) == -1)
-                    {
-                        perror("sendto failed");
-                        exit(1);
-                    }
-                }
+                receiveDatagrams(sockfd, groupSockets[i], i, &thisSensor);
             }
-            // clear message buffer
-            receiveBuffer[n] = '\0';
-            memset(receiveBuffer, 0, sizeof(receiveBuffer));
         }
-
-        pthread_mutex_lock(&shared->mutex);
-        // use timedwait to allow shared memory to be updated
-        pthread_cond_timedwait(&shared->cond, &shared->mutex, &condWait);
     }
 
     close(sockfd);
@@ -353,44 +371,292 @@ int main(int argc, char **argv)
     return 0;
 }
 
-// search function to see if address list contains a particular address
-int search(struct addr_entry entries[], int PortNumber, int numberEntries)
+// parse an address:port argument. Returns 0, or -1 if it is malformed
+int parseAddress(const char *addressPort, struct sockaddr_in *addr)
+{
+    char address[INET_ADDRSTRLEN];
+    const char *portString = strchr(addressPort, ':');
+    if (portString == NULL || portString - addressPort >= (long)sizeof(address))
+    {
+        return -1;
+    }
+    memcpy(address, addressPort, portString - addressPort);
+    address[portString - addressPort] = '\0';
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons(atoi(portString + 1));
+    return inet_pton(AF_INET, address, &addr->sin_addr) == 1 ? 0 : -1;
+}
+
+// subscribe to a multicast group on the interface with the given address. Returns the socket, or -1
+int joinGroup(const struct sockaddr_in *group, struct in_addr interface)
 {
-    for (int i = 0; i < numberEntries; i++)
+    // bound to the group itself, so that only its datagrams arrive here; other sensors on this host join it too
+    int groupFd = socket(AF_INET, SOCK_DGRAM, 0);
+    int on = 1;
+    struct ip_mreq membership = {.imr_multiaddr = group->sin_addr, .imr_interface = interface};
+    if (groupFd == -1 || setsockopt(groupFd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) == -1
+        || bind(groupFd, (const struct sockaddr *)group, sizeof(*group)) == -1
+        || setsockopt(groupFd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership)) == -1)
     {
-        if (entries[i].sensor_port == PortNumber)
+        perror("joining multicast group");
+        if (groupFd != -1)
         {
-            return -1;
+            close(groupFd);
         }
+        return -1;
     }
-    return 1;
+    fcntl(groupFd, F_SETFL, fcntl(groupFd, F_GETFL, 0) | O_NONBLOCK);
+    return groupFd;
 }
 
-// save the current time. This will primarily be used to see when a message was last sent by the tempsensor
-void updateLastUpdateTime()
+// take every waiting datagram off a socket and pass on the readings in it. via is the receiver it came in through,
+// if it is a group, or -1
+void receiveDatagrams(int sockfd, int fromFd, int via, const temp_wire_address *thisSensor)
 {
-    gettimeofday(&lastUpdateTime, NULL);
+    // Readings from other sensors are extended in place and passed on from here, or from their own buffer if they
+    // came in a batch
+    static unsigned char receiveBuffer[MAX_BUFFER_SIZE], readingBuffer[MAX_BUFFER_SIZE];
+    while (1)
+    {
+        // receive data from other devices in network
+        int n = recv(fromFd, receiveBuffer, MAX_BUFFER_SIZE, MSG_DONTWAIT);
+        // if no datagrams received, exit while loop
+        if (n <= 0)
+        {
+            break;
+        }
+
+        // a batch is taken apart, and each of its readings passed on as if it had come by itself
+        if (!temp_wire_is_batch(receiveBuffer, n))
+        {
+            forwardReading(sockfd, receiveBuffer, n, thisSensor, via);
+            continue;
+        }
+        size_t offset = TEMP_WIRE_BATCH_HEADER, readingLength;
+        const unsigned char *reading;
+        while ((reading = temp_wire_batch_next(receiveBuffer, n, &offset, &readingLength)) != NULL)
+        {
+            memcpy(readingBuffer, reading, readingLength);
+            forwardReading(sockfd, readingBuffer, readingLength, thisSensor, via);
+        }
+    }
 }
 
-// Function to check if the maximum update wait time has passed
-int hasMaxWaitTimePassed(int maxUpdateWait)
+// pass on a reading from another sensor. datagram must have room for TEMP_WIRE_COMPACT_MAX bytes
+void forwardReading(int sockfd, unsigned char *datagram, size_t length, const temp_wire_address *thisSensor, int via)
 {
-    struct timeval currentTime;
-    gettimeofday(&currentTime, NULL);
+    // decode the received datagram where it is
+    temp_reading received;
+    if (temp_wire_decode(datagram, length, &received) == -1)
+    {
+        return;
+    }
 
-    // Calculate the time difference in microseconds
-    int timePassed_sec = (currentTime.tv_sec - lastUpdateTime.tv_sec) * 1000000;
-    int timePassed_usec = currentTime.tv_usec - lastUpdateTime.tv_usec;
-    int timePassed = timePassed_sec + timePassed_usec;
-    // Compare with the maximum update wait time
-    if (timePassed > maxUpdateWait)
+    // each reading is passed on once at most, and not at all once it has used up its hops
+    if (received.hops <= 0 || seen_cache_add(&seen, received.id, received.timestamp))
     {
-        // If the time difference is greater than the max update wait, return 1
-        return 1;
+        return;
+    }
+
+    // a datagram in an older layout from a sensor not yet upgraded is converted first, so that it can be extended
+    // in place like any other
+    if (received.version != TEMP_WIRE_VERSION)
+    {
+        temp_wire_address entries[TEMP_WIRE_MAX_ADDRESSES];
+        temp_wire_addresses(&received, entries);
+        length = temp_wire_encode(datagram, received.hops, received.timestamp, received.temperature, received.id,
+                                  entries, received.address_count);
+        temp_wire_decode(datagram, length, &received);
+    }
+
+    // Now add this sensor's details to the end of the address list; if the list already has 50 entries the oldest
+    // is dropped to make room
+    length = temp_wire_append_address(datagram, &received, thisSensor);
+
+    // pass it on to every receiver that is not already in the address list
+    passOn(sockfd, datagram, length, &received, via);
+}
+
+// send a reading passed on from another sensor, now or in the receivers' batches
+void passOn(int sockfd, unsigned char *datagram, size_t length, const temp_reading *route, int via)
+{
+    if (batchWindow <= 0)
+    {
+        sendToReceivers(sockfd, datagram, length, route, via);
+        return;
+    }
+
+    for (int i = 0; i < receiverCount; i++)
+    {
+        if (i == via || temp_wire_contains(route, receivers[i].sin_addr, ntohs(receivers[i].sin_port)))
+        {
+            continue;
+        }
+        size_t added = temp_wire_batch_add(batches[i], batchLengths[i], datagram, length);
+        if (added == 0)
+        {
+            // this receiver's batch is full; send everything waiting and start again
+            flushBatches(sockfd);
+            added = temp_wire_batch_add(batches[i], batchLengths[i], datagram, length);
+        }
+        batchLengths[i] = added;
+        if (!batchWaiting)
+        {
+            batchWaiting = 1;
+            armTimer(batchTimer, batchWindow);
+        }
+    }
+
+    if (!isnan(urgentThreshold) && route->temperature >= urgentThreshold)
+    {
+        flushBatches(sockfd);
+    }
+}
+
+// send every receiver's batch that has readings in it, with a single sendmmsg()
+void flushBatches(int sockfd)
+{
+    if (!batchWaiting)
+    {
+        return;
+    }
+    int count = 0;
+    for (int i = 0; i < receiverCount; i++)
+    {
+        if (batchLengths[i] == TEMP_WIRE_BATCH_HEADER)
+        {
+            continue;
+        }
+        batchPayloads[i].iov_base = batches[i];
+        batchPayloads[i].iov_len = batchLengths[i];
+        fanout[count].msg_hdr.msg_name = &receivers[i];
+        fanout[count].msg_hdr.msg_namelen = sizeof(receivers[i]);
+        fanout[count].msg_hdr.msg_iov = &batchPayloads[i];
+        fanout[count].msg_hdr.msg_iovlen = 1;
+        count++;
+        batchLengths[i] = TEMP_WIRE_BATCH_HEADER;
     }
-    else
+    sendFanout(sockfd, count);
+
+    batchWaiting = 0;
+    struct itimerspec disarm = {0};
+    timerfd_settime(batchTimer, 0, &disarm, NULL);
+}
+
+// send a datagram to every receiver, or with a route, to every receiver not in its address list and not the group
+// via that it came through, in one sendmmsg()
+void sendToReceivers(int sockfd, unsigned char *datagram, size_t length, const temp_reading *route, int via)
+{
+    struct iovec payload = {.iov_base = datagram, .iov_len = length};
+    int count = 0;
+    for (int i = 0; i < receiverCount; i++)
     {
-        // If the time difference is less than the max update wait, return 0
-        return 0;
+        if (i == via
+            || (route != NULL && temp_wire_contains(route, receivers[i].sin_addr, ntohs(receivers[i].sin_port))))
+        {
+            continue;
+        }
+        fanout[count].msg_hdr.msg_name = &receivers[i];
+        fanout[count].msg_hdr.msg_namelen = sizeof(receivers[i]);
+        fanout[count].msg_hdr.msg_iov = &payload;
+        fanout[count].msg_hdr.msg_iovlen = 1;
+        count++;
     }
-}
\ No newline at end of file
+    sendFanout(sockfd, count);
+}
+
+// send the first count messages of fanout
+void sendFanout(int sockfd, int count)
+{
+    int sent = 0;
+    while (sent < count)
+    {
+        int n = sendmmsg(sockfd, fanout + sent, count - sent, 0);
+        if (n == -1)
+        {
+            // a full send buffer loses the rest of this fan-out, like any other datagram lost in the network
+            if (errno == EAGAIN)
+            {
+                return;
+            }
+            // any other error is particular to the message at the front, so drop that one and send the rest
+            struct sockaddr_in *receiver = fanout[sent].msg_hdr.msg_name;
+            fprintf(stderr, "sendmmsg to %s:%d failed: %s\n", inet_ntoa(receiver->sin_addr), ntohs(receiver->sin_port),
+                    strerror(errno));
+            sent++;
+            continue;
+        }
+        sent += n;
+    }
+}
+
+// Wait on the shared memory condition variable and raise temperatureEvent whenever the temperature has changed.
+// The wait ends after max condvar wait at the latest, so a change whose signal was missed is still noticed
+void *watchTemperature(void *arg)
+{
+    (void)arg;
+    pthread_mutex_lock(&shared->mutex);
+    float lastSeen = shared->temperature;
+    for (;;)
+    {
+        // pthread_cond_timedwait takes an absolute time
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += maxWaitCondvar / 1000000;
+        deadline.tv_nsec += (long)(maxWaitCondvar % 1000000) * 1000;
+        if (deadline.tv_nsec >= 1000000000)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&shared->cond, &shared->mutex, &deadline);
+
+        if (shared->temperature != lastSeen)
+        {
+            lastSeen = shared->temperature;
+            uint64_t one = 1;
+            if (write(temperatureEvent, &one, sizeof(one)) < 0)
+            {
+                perror("write(eventfd)");
+            }
+        }
+    }
+    return NULL;
+}
+
+// (Re)start a timer so that it fires once, wait microseconds from now
+void armTimer(int timerFd, long long wait)
+{
+    struct itimerspec due = {0};
+    due.it_value.tv_sec = wait / 1000000;
+    due.it_value.tv_nsec = (long)(wait % 1000000) * 1000;
+    if (due.it_value.tv_sec == 0 && due.it_value.tv_nsec == 0)
+    {
+        due.it_value.tv_nsec = 1; // a zero it_value would disarm the timer
+    }
+    if (timerfd_settime(timerFd, 0, &due, NULL) == -1)
+    {
+        perror("timerfd_settime()");
+    }
+}
+
+// reporting policy settings, from the environment so that the command line stays as the simulator expects
+void readReportConfig(report_config *config, int maxUpdateWait)
+{
+    const char *value;
+    config->dead_band = (value = getenv("TEMPSENSOR_DEAD_BAND")) != NULL ? atof(value) : 0.5f;
+    config->rise_rate = (value = getenv("TEMPSENSOR_RISE_RATE")) != NULL ? atof(value) : 1.0f;
+    config->threshold = (value = getenv("TEMPSENSOR_THRESHOLD")) != NULL ? atof(value) : NAN;
+    config->approach = (value = getenv("TEMPSENSOR_APPROACH")) != NULL ? atof(value) : 10.0f;
+    config->max_interval = maxUpdateWait;
+}
+
+// time for the reporting policy, which must not jump with the wall clock
+long long monotonicUsec(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
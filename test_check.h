@@ -0,0 +1,29 @@
+/*
+ * Minimal checking for the unit tests run by "make test".
+ *
+ * CHECK records a failure with its file and line and carries on, so one run reports every broken case. A test
+ * program returns test_result() from main, which prints a summary and gives make a non-zero status on failure.
+*/
+
+#ifndef TEST_CHECK_H
+#define TEST_CHECK_H
+
+#include <stdio.h>
+
+static int test_checks, test_failures;
+
+#define CHECK(condition) do { \
+        test_checks++; \
+        if (!(condition)) { \
+            test_failures++; \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+        } \
+    } while (0)
+
+static inline int test_result(const char *name)
+{
+    printf("%s: %d checks, %d failed\n", name, test_checks, test_failures);
+    return test_failures == 0 ? 0 : 1;
+}
+
+#endif
@@ -0,0 +1,95 @@
+/*
+ * Unit tests for the sliding detection window in detection_window.c.
+ * Distinct sensors are counted once however often they report, readings expire a period after their own
+ * timestamp, late readings count at their own timestamp, readings stamped in the future count as taken now,
+ * readings too old to share a window are dropped, and the ring keeps every reading as it grows.
+*/
+
+#include <stdio.h>
+#include "detection_window.h"
+#include "test_check.h"
+
+#define PERIOD 1000000LL
+#define START 1700000000000000LL
+
+static void test_distinct(void)
+{
+    detection_window window;
+    CHECK(detection_window_init(&window, PERIOD) == 0);
+
+    CHECK(detection_window_add(&window, 1, START, START) == 1);
+    CHECK(detection_window_add(&window, 1, START + 100, START + 100) == 1);
+    CHECK(detection_window_add(&window, 2, START + 200, START + 200) == 2);
+    CHECK(detection_window_add(&window, 1, START + 300, START + 300) == 2);
+    CHECK(detection_window_add(&window, 3, START + 400, START + 400) == 3);
+
+    /* sensor 1's first readings leave the period, but its newest is still in it */
+    CHECK(detection_window_add(&window, 4, START + PERIOD + 150, START + PERIOD + 150) == 4);
+    /* now sensor 2 leaves, and then 1 and 3 */
+    CHECK(detection_window_add(&window, 4, START + PERIOD + 299, START + PERIOD + 299) == 3);
+    CHECK(detection_window_add(&window, 4, START + PERIOD + 450, START + PERIOD + 450) == 1);
+    detection_window_free(&window);
+}
+
+static void test_late(void)
+{
+    detection_window window;
+    CHECK(detection_window_init(&window, PERIOD) == 0);
+
+    CHECK(detection_window_add(&window, 1, START + 500000, START + 500000) == 1);
+    /* late, but still inside the period: counted at its own timestamp, so it also leaves at its own time */
+    CHECK(detection_window_add(&window, 2, START + 100000, START + 500000) == 2);
+    CHECK(detection_window_add(&window, 3, START + 300000, START + 600000) == 3);
+    CHECK(detection_window_add(&window, 1, START + 1100001, START + 1100001) == 2);
+    CHECK(detection_window_add(&window, 1, START + 1300001, START + 1300001) == 1);
+
+    /* a reading older than the period is not counted at all */
+    CHECK(detection_window_add(&window, 5, START + 200000, START + 1300001) == 1);
+    /* a late reading for a sensor already counted keeps its newer timestamp */
+    CHECK(detection_window_add(&window, 1, START + 1000000, START + 1300001) == 1);
+    CHECK(detection_window_add(&window, 6, START + 2200000, START + 2200000) == 2);
+    detection_window_free(&window);
+}
+
+static void test_future(void)
+{
+    detection_window window;
+    CHECK(detection_window_init(&window, PERIOD) == 0);
+
+    /* a reading stamped ten periods ahead is counted as taken now, so current readings still share its window */
+    CHECK(detection_window_add(&window, 1, START + 10 * PERIOD, START) == 1);
+    CHECK(detection_window_add(&window, 2, START + 100, START + 100) == 2);
+    CHECK(detection_window_add(&window, 3, START + 50, START + 200) == 3);
+    /* and it leaves a period after now, not a period after its own stamp */
+    CHECK(detection_window_add(&window, 4, START + PERIOD + 10, START + PERIOD + 10) == 3);
+    CHECK(detection_window_add(&window, 4, START + PERIOD + 150, START + PERIOD + 150) == 1);
+    detection_window_free(&window);
+}
+
+static void test_growth(void)
+{
+    detection_window window;
+    CHECK(detection_window_init(&window, PERIOD) == 0);
+
+    /* far more readings than the initial ring, from distinct sensors, a few of them late */
+    int count = 0;
+    for (int i = 0; i < 20000; i++) {
+        long long timestamp = START + i * 10 - (i % 5 == 0 ? 25 : 0);
+        count = detection_window_add(&window, (uint16_t)i, timestamp, START + i * 10);
+    }
+    CHECK(count == 20000);
+
+    /* ordering survived the growth: the readings taken before START + 100000, the late one at 99975 included,
+     * leave together */
+    CHECK(detection_window_add(&window, 65535, START + PERIOD + 100000, START + PERIOD + 100000) == 10000);
+    detection_window_free(&window);
+}
+
+int main(void)
+{
+    test_distinct();
+    test_late();
+    test_future();
+    test_growth();
+    return test_result("test_detection_window");
+}
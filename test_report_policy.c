@@ -0,0 +1,136 @@
+/*
+ * Unit tests for a sensor's reporting policy in report_policy.c.
+ * The dead-band, the rate of rise, crossing the threshold, heartbeats backing off and starting again, and the
+ * longest heartbeat shrinking as the temperature approaches the threshold.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include "report_policy.h"
+#include "test_check.h"
+
+#define MAX_WAIT 8000000LL
+#define SHORTEST (MAX_WAIT / REPORT_HEARTBEAT_RANGE)
+
+static report_config config(float dead_band, float threshold)
+{
+    report_config c = { .dead_band = dead_band, .rise_rate = 1.0f, .threshold = threshold, .approach = 10.0f,
+                        .max_interval = MAX_WAIT };
+    return c;
+}
+
+static void test_dead_band(void)
+{
+    report_config c = config(0.5f, NAN);
+    report_policy policy;
+    report_policy_init(&policy, &c);
+
+    /* the first reading is always sent */
+    CHECK(report_policy_sample(&policy, 20.0f, 0) == 1);
+    report_policy_sent(&policy, 20.0f, 0);
+
+    /* noise inside the dead-band is not */
+    int sends = 0;
+    for (int i = 1; i <= 100; i++) {
+        sends += report_policy_sample(&policy, i % 2 ? 20.3f : 19.7f, i * 100000LL);
+    }
+    CHECK(sends == 0);
+
+    /* a full dead-band either way is */
+    CHECK(report_policy_sample(&policy, 20.5f, 20000000) == 1);
+    CHECK(report_policy_sample(&policy, 19.5f, 30000000) == 1);
+}
+
+static void test_rise_rate(void)
+{
+    /* a dead-band too wide to matter, so only the rate can send */
+    report_config c = config(5.0f, NAN);
+    report_policy policy;
+    report_policy_init(&policy, &c);
+    report_policy_sample(&policy, 20.0f, 0);
+    report_policy_sent(&policy, 20.0f, 0);
+
+    /* 2 degrees a second, sampled every 100ms: the averaged rate passes 1 degree a second after 7 samples */
+    int first_send = 0;
+    for (int i = 1; i <= 20 && first_send == 0; i++) {
+        if (report_policy_sample(&policy, 20.0f + 0.2f * i, i * 100000LL)) {
+            first_send = i;
+        }
+    }
+    CHECK(first_send == 7);
+
+    /* the same change falling is left to the dead-band, which it does not reach in 20 samples */
+    report_policy_init(&policy, &c);
+    report_policy_sample(&policy, 20.0f, 0);
+    report_policy_sent(&policy, 20.0f, 0);
+    int sends = 0;
+    for (int i = 1; i <= 20; i++) {
+        sends += report_policy_sample(&policy, 20.0f - 0.2f * i, i * 100000LL);
+    }
+    CHECK(sends == 0);
+}
+
+static void test_threshold(void)
+{
+    report_config c = config(0.5f, 50.0f);
+    report_policy policy;
+    report_policy_init(&policy, &c);
+    report_policy_sample(&policy, 49.8f, 0);
+    report_policy_sent(&policy, 49.8f, 0);
+
+    /* crossing upwards is sent although it moved less than the dead-band */
+    CHECK(report_policy_sample(&policy, 50.1f, 2000000) == 1);
+    report_policy_sent(&policy, 50.1f, 0);
+    /* dropping back under it by less than the dead-band is not, and neither is the next small rise */
+    CHECK(report_policy_sample(&policy, 49.9f, 4000000) == 0);
+    CHECK(report_policy_sample(&policy, 50.2f, 6000000) == 0);
+}
+
+static void test_heartbeat(void)
+{
+    report_config c = config(0.5f, NAN);
+    report_policy policy;
+    report_policy_init(&policy, &c);
+
+    /* each quiet heartbeat doubles the wait up to max update wait; a reading that moved starts again */
+    CHECK(report_policy_sent(&policy, 20.0f, 0) == SHORTEST);
+    CHECK(report_policy_sent(&policy, 20.0f, 1) == 2 * SHORTEST);
+    CHECK(report_policy_sent(&policy, 20.0f, 1) == 4 * SHORTEST);
+    CHECK(report_policy_sent(&policy, 20.0f, 1) == MAX_WAIT);
+    CHECK(report_policy_sent(&policy, 20.0f, 1) == MAX_WAIT);
+    CHECK(report_policy_sent(&policy, 21.0f, 0) == SHORTEST);
+}
+
+static void test_approach(void)
+{
+    report_config c = config(0.5f, 50.0f);
+    report_policy policy;
+    report_policy_init(&policy, &c);
+
+    /* further below the threshold than the approach band, the heartbeat backs off all the way */
+    report_policy_sent(&policy, 30.0f, 0);
+    for (int i = 0; i < 5; i++) {
+        report_policy_sent(&policy, 30.0f, 1);
+    }
+    CHECK(report_policy_sent(&policy, 30.0f, 1) == MAX_WAIT);
+
+    /* half way through the band, only half way */
+    long long halfway = SHORTEST + (MAX_WAIT - SHORTEST) / 2;
+    CHECK(report_policy_sent(&policy, 45.0f, 1) == halfway);
+    CHECK(report_policy_sent(&policy, 45.0f, 1) == halfway);
+
+    /* at the threshold and over it, every heartbeat is the shortest */
+    CHECK(report_policy_sent(&policy, 50.0f, 1) == SHORTEST);
+    CHECK(report_policy_sent(&policy, 50.0f, 1) == SHORTEST);
+    CHECK(report_policy_sent(&policy, 70.0f, 1) == SHORTEST);
+}
+
+int main(void)
+{
+    test_dead_band();
+    test_rise_rate();
+    test_threshold();
+    test_heartbeat();
+    test_approach();
+    return test_result("test_report_policy");
+}
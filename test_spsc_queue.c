@@ -0,0 +1,132 @@
+/*
+ * Unit tests for the single-producer, single-consumer queue in spsc_queue.c.
+ * Capacity rounding, full and empty queues, order across many wraps of the indices, and a producer and consumer
+ * on two threads checking that every item arrives once, whole and in order.
+*/
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "spsc_queue.h"
+#include "test_check.h"
+
+#define THREADED_ITEMS 2000000
+
+/* Wider than a word, so a torn copy would show */
+typedef struct {
+    uint64_t sequence;
+    uint64_t check;
+    char pad[16];
+} item;
+
+static item make_item(uint64_t sequence)
+{
+    item it;
+    it.sequence = sequence;
+    it.check = ~sequence;
+    memset(it.pad, (int)(sequence & 0x7f), sizeof(it.pad));
+    return it;
+}
+
+static int item_ok(const item *it, uint64_t sequence)
+{
+    item expected = make_item(sequence);
+    return memcmp(it, &expected, sizeof(expected)) == 0;
+}
+
+static void test_single_thread(void)
+{
+    spsc_queue queue;
+    CHECK(spsc_queue_init(&queue, 5, sizeof(item)) == 0);
+
+    /* 5 rounds up to 8 */
+    item it = make_item(0);
+    int pushed = 0;
+    while (spsc_queue_push(&queue, &it) == 0) {
+        it = make_item(++pushed);
+    }
+    CHECK(pushed == 8);
+    for (int i = 0; i < 8; i++) {
+        CHECK(spsc_queue_pop(&queue, &it) == 0 && item_ok(&it, i));
+    }
+    CHECK(spsc_queue_pop(&queue, &it) == -1);
+
+    /* interleaved pushes and pops keep order as the indices wrap the ring many times */
+    uint64_t next_push = 0, next_pop = 0;
+    int ordered = 1;
+    for (int round = 0; round < 10000; round++) {
+        int burst = round % 9;
+        for (int i = 0; i < burst; i++) {
+            it = make_item(next_push);
+            if (spsc_queue_push(&queue, &it) == 0) {
+                next_push++;
+            }
+        }
+        for (int i = 0; i < (round % 7); i++) {
+            if (spsc_queue_pop(&queue, &it) == 0) {
+                ordered &= item_ok(&it, next_pop++);
+            }
+        }
+    }
+    while (spsc_queue_pop(&queue, &it) == 0) {
+        ordered &= item_ok(&it, next_pop++);
+    }
+    CHECK(ordered);
+    CHECK(next_pop == next_push && next_push > 10000);
+    spsc_queue_free(&queue);
+
+    CHECK(spsc_queue_init(&queue, 1, sizeof(int)) == 0);
+    int value = 7;
+    CHECK(spsc_queue_push(&queue, &value) == 0);
+    CHECK(spsc_queue_push(&queue, &value) == -1);
+    value = 0;
+    CHECK(spsc_queue_pop(&queue, &value) == 0 && value == 7);
+    CHECK(spsc_queue_pop(&queue, &value) == -1);
+    spsc_queue_free(&queue);
+}
+
+static void *produce(void *arg)
+{
+    spsc_queue *queue = arg;
+    for (uint64_t i = 0; i < THREADED_ITEMS; i++) {
+        item it = make_item(i);
+        while (spsc_queue_push(queue, &it) == -1) {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+static void test_threads(void)
+{
+    spsc_queue queue;
+    CHECK(spsc_queue_init(&queue, 256, sizeof(item)) == 0);
+    pthread_t producer;
+    CHECK(pthread_create(&producer, NULL, produce, &queue) == 0);
+
+    uint64_t received = 0;
+    int ordered = 1;
+    while (received < THREADED_ITEMS) {
+        item it;
+        if (spsc_queue_pop(&queue, &it) == -1) {
+            sched_yield();
+            continue;
+        }
+        ordered &= item_ok(&it, received);
+        received++;
+    }
+    pthread_join(producer, NULL);
+    item it;
+    CHECK(ordered);
+    CHECK(spsc_queue_pop(&queue, &it) == -1);
+    spsc_queue_free(&queue);
+}
+
+int main(void)
+{
+    test_single_thread();
+    test_threads();
+    return test_result("test_spsc_queue");
+}
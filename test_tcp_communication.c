@@ -0,0 +1,284 @@
+/*
+ * Unit tests for the framed transport in tcp_communication.c, run over a socketpair.
+ * Covers messages split across reads, a message that wraps the end of the input ring, the longest message the
+ * ring can frame and one too long for it, output that the socket only partly takes, and a pooled connection
+ * struct reused after close.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include "tcp_communication.h"
+#include "test_check.h"
+
+/* A connection on one end of a socketpair; the other end is returned in peer */
+static tcp_conn *open_pair(int *peer)
+{
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1) {
+        perror("socketpair()");
+        exit(1);
+    }
+    tcp_set_nonblocking(fds[0]);
+    *peer = fds[1];
+    tcp_conn *conn = tcp_conn_new(fds[0]);
+    if (conn == NULL) {
+        perror("tcp_conn_new()");
+        exit(1);
+    }
+    return conn;
+}
+
+static void send_text(int fd, const char *text, size_t len)
+{
+    if (send(fd, text, len, 0) != (ssize_t)len) {
+        perror("send()");
+        exit(1);
+    }
+}
+
+/* Fill until the socket has nothing more waiting */
+static void fill_all(tcp_conn *conn)
+{
+    while (tcp_conn_fill(conn) > 0) {
+    }
+}
+
+static void test_address(void)
+{
+    struct sockaddr_in addr;
+    CHECK(tcp_parse_address("127.0.0.1:4100", &addr) == 0);
+    CHECK(addr.sin_family == AF_INET && ntohs(addr.sin_port) == 4100 && ntohl(addr.sin_addr.s_addr) == 0x7f000001);
+    CHECK(tcp_parse_address("127.0.0.1", &addr) == -1);
+    CHECK(tcp_parse_address("127.0.0.1:0", &addr) == -1);
+    CHECK(tcp_parse_address("localhost:4100", &addr) == -1);
+    CHECK(tcp_parse_address("255.255.255.255255.255.255.255:1", &addr) == -1);
+}
+
+static void test_frames(void)
+{
+    int peer;
+    tcp_conn *conn = open_pair(&peer);
+    char *frame;
+
+    /* empty messages and the whitespace doors put between messages are skipped */
+    send_text(peer, "OPEN#\n##  STATE O#", 18);
+    fill_all(conn);
+    CHECK((frame = tcp_conn_next_frame(conn)) != NULL && strcmp(frame, "OPEN") == 0);
+    CHECK((frame = tcp_conn_next_frame(conn)) != NULL && strcmp(frame, "STATE O") == 0);
+    CHECK(tcp_conn_next_frame(conn) == NULL);
+
+    /* a message split across reads is only handed out once its '#' has arrived */
+    send_text(peer, "CARDREADER 1 SCA", 16);
+    fill_all(conn);
+    CHECK(tcp_conn_next_frame(conn) == NULL);
+    send_text(peer, "NNED 0123", 9);
+    fill_all(conn);
+    CHECK(tcp_conn_next_frame(conn) == NULL);
+    send_text(peer, "#DEN", 4);
+    fill_all(conn);
+    CHECK((frame = tcp_conn_next_frame(conn)) != NULL && strcmp(frame, "CARDREADER 1 SCANNED 0123") == 0);
+    CHECK(tcp_conn_next_frame(conn) == NULL);
+    send_text(peer, "IED#", 4);
+    fill_all(conn);
+    CHECK((frame = tcp_conn_next_frame(conn)) != NULL && strcmp(frame, "DENIED") == 0);
+
+    /* the peer closing shows as a zero-length fill */
+    close(peer);
+    CHECK(tcp_conn_fill(conn) == 0);
+    tcp_conn_free(conn);
+}
+
+static void test_wrap(void)
+{
+    int peer;
+    tcp_conn *conn = open_pair(&peer);
+    char filler[TCP_RING_SIZE];
+    char *frame;
+
+    /* move the ring to 8 bytes before its end */
+    memset(filler, 'x', TCP_RING_SIZE - 9);
+    filler[TCP_RING_SIZE - 9] = '#';
+    send_text(peer, filler, TCP_RING_SIZE - 8);
+    fill_all(conn);
+    CHECK((frame = tcp_conn_next_frame(conn)) != NULL && strlen(frame) == TCP_RING_SIZE - 9);
+    CHECK(tcp_conn_next_frame(conn) == NULL);
+
+    /* this one runs over the end of the ring, so it comes out of the scratch buffer */
+    send_text(peer, "0123456789ABCDEF#", 17);
+    fill_all(conn);
+    frame = tcp_conn_next_frame(conn);
+    CHECK(frame == conn->scratch);
+    CHECK(frame != NULL && strcmp(frame, "0123456789ABCDEF") == 0);
+
+    /* and the next one is in place again, from the start of the array */
+    send_text(peer, "STATE#", 6);
+    fill_all(conn);
+    frame = tcp_conn_next_frame(conn);
+    CHECK(frame != NULL && frame != conn->scratch && strcmp(frame, "STATE") == 0);
+
+    /* a message whose text ends on the last byte of the array has its '#' at the start, and is copied too */
+    size_t used = conn->in.tail & (TCP_RING_SIZE - 1);
+    memset(filler, 'y', TCP_RING_SIZE - used);
+    send_text(peer, filler, TCP_RING_SIZE - used);
+    send_text(peer, "#", 1);
+    fill_all(conn);
+    frame = tcp_conn_next_frame(conn);
+    CHECK(frame == conn->scratch);
+    CHECK(frame != NULL && strlen(frame) == TCP_RING_SIZE - used && frame[TCP_RING_SIZE - used - 1] == 'y');
+    CHECK((conn->in.head & (TCP_RING_SIZE - 1)) == 1);
+
+    close(peer);
+    tcp_conn_free(conn);
+}
+
+static void test_message_size(void)
+{
+    int peer;
+    tcp_conn *conn = open_pair(&peer);
+    char text[TCP_RING_SIZE];
+    char *frame;
+
+    /* the longest message fills the whole ring with its '#', starting part way through so that it wraps */
+    send_text(peer, "A#", 2);
+    fill_all(conn);
+    CHECK((frame = tcp_conn_next_frame(conn)) != NULL && strcmp(frame, "A") == 0);
+    memset(text, 'm', TCP_RING_SIZE - 1);
+    text[TCP_RING_SIZE - 1] = '#';
+    send_text(peer, text, TCP_RING_SIZE);
+    fill_all(conn);
+    frame = tcp_conn_next_frame(conn);
+    CHECK(frame != NULL && strlen(frame) == TCP_RING_SIZE - 1 && frame[TCP_RING_SIZE - 2] == 'm');
+
+    /* one byte more never gets its '#' into the ring: the fill reports the ring full instead */
+    memset(text, 'o', TCP_RING_SIZE);
+    send_text(peer, text, TCP_RING_SIZE);
+    send_text(peer, "#", 1);
+    fill_all(conn);
+    CHECK(tcp_conn_next_frame(conn) == NULL);
+    errno = 0;
+    CHECK(tcp_conn_fill(conn) == -1 && errno == ENOBUFS);
+    CHECK(tcp_conn_next_frame(conn) == NULL);
+
+    close(peer);
+    tcp_conn_free(conn);
+}
+
+/* Read everything waiting on fd into buf from *used on, skipping the filler byte 'j', which messages never hold */
+static void drain(int fd, char *buf, size_t *used, size_t cap)
+{
+    char chunk[4096];
+    ssize_t n;
+    while ((n = recv(fd, chunk, sizeof(chunk), MSG_DONTWAIT)) > 0) {
+        for (ssize_t i = 0; i < n; i++) {
+            if (chunk[i] != 'j' && *used < cap) {
+                buf[(*used)++] = chunk[i];
+            }
+        }
+    }
+}
+
+static void test_partial_writes(void)
+{
+    int peer;
+    tcp_conn *conn = open_pair(&peer);
+    char expected[8192], received[8192];
+    size_t expected_len = 0, received_len = 0;
+
+    /* fill the socket so that flushes can only write part of what is queued */
+    char junk[4096];
+    memset(junk, 'j', sizeof(junk));
+    while (send(conn->fd, junk, sizeof(junk), MSG_DONTWAIT) > 0) {
+    }
+
+    /* queue and flush in rounds, so the output ring wraps and each flush meets a nearly full socket */
+    int pending = 0, partial = 0;
+    for (int round = 0; round < 40; round++) {
+        char msg[128];
+        int len = snprintf(msg, sizeof(msg), "STATE %d ", round);
+        memset(msg + len, 'A' + round % 26, 90 - len);
+        msg[90] = '#';
+        while (tcp_conn_queue(conn, msg, 91) == -1) {
+            CHECK(tcp_conn_pending(conn) + 91 > TCP_RING_SIZE);
+            drain(peer, received, &received_len, sizeof(received));
+            CHECK(tcp_conn_flush(conn) >= 0);
+        }
+        memcpy(expected + expected_len, msg, 91);
+        expected_len += 91;
+        pending = tcp_conn_flush(conn);
+        CHECK(pending >= 0);
+        partial |= pending == 1;
+    }
+    CHECK(partial);
+    while (tcp_conn_pending(conn) > 0) {
+        drain(peer, received, &received_len, sizeof(received));
+        CHECK(tcp_conn_flush(conn) >= 0);
+    }
+    drain(peer, received, &received_len, sizeof(received));
+    CHECK(received_len == expected_len && memcmp(received, expected, expected_len) == 0);
+
+    /* more than the ring holds is refused outright */
+    char big[TCP_RING_SIZE + 1];
+    memset(big, 'b', sizeof(big));
+    CHECK(tcp_conn_queue(conn, big, sizeof(big)) == -1);
+    CHECK(tcp_conn_queue(conn, big, TCP_RING_SIZE) == 0);
+    CHECK(tcp_conn_queue(conn, "#", 1) == -1);
+
+    /* a peer that has gone is an error, not pending output */
+    close(peer);
+    CHECK(tcp_conn_flush(conn) == -1);
+    tcp_conn_free(conn);
+}
+
+static void test_pool_reuse(void)
+{
+    int peer;
+    tcp_conn *conn = open_pair(&peer);
+
+    /* leave half a message in the input and output queued */
+    send_text(peer, "STATE#HALF A MESS", 17);
+    fill_all(conn);
+    CHECK(tcp_conn_next_frame(conn) != NULL);
+    CHECK(tcp_conn_next_frame(conn) == NULL);
+    CHECK(tcp_conn_queue(conn, "OPENING#", 8) == 0);
+    int old_fd = conn->fd;
+    tcp_conn_free(conn);
+    close(peer);
+    CHECK(fcntl(old_fd, F_GETFD) == -1 && errno == EBADF);
+
+    /* the struct comes back from the pool with nothing of the old connection in it */
+    tcp_conn *reused = open_pair(&peer);
+    CHECK(reused == conn);
+    CHECK(tcp_conn_pending(reused) == 0);
+    CHECK(tcp_conn_next_frame(reused) == NULL);
+    send_text(peer, "NEW#", 4);
+    fill_all(reused);
+    char *frame = tcp_conn_next_frame(reused);
+    CHECK(frame != NULL && strcmp(frame, "NEW") == 0);
+
+    /* a second struct is needed while the first is in use */
+    int other_peer;
+    tcp_conn *other = open_pair(&other_peer);
+    CHECK(other != reused);
+
+    close(peer);
+    close(other_peer);
+    tcp_conn_free(reused);
+    tcp_conn_free(other);
+}
+
+int main(void)
+{
+    test_address();
+    test_frames();
+    test_wrap();
+    test_message_size();
+    test_partial_writes();
+    test_pool_reuse();
+    return test_result("test_tcp_communication");
+}
@@ -0,0 +1,239 @@
+/*
+ * Unit tests for the TEMP wire format in temp_wire.c.
+ * Round trips through both layouts and batches, and the decoder's bounds checks: every truncation of a valid
+ * datagram, oversized counts and varints, unknown versions and batches whose lengths run past their end.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include "temp_wire.h"
+#include "test_check.h"
+
+#define TIMESTAMP 1700000000123456LL
+
+static temp_wire_address address(int last_octet, in_port_t port)
+{
+    temp_wire_address entry = { .port = port };
+    entry.addr.s_addr = htonl(0x0a000000 | last_octet);
+    return entry;
+}
+
+static void test_round_trip(void)
+{
+    temp_wire_address route[3] = { address(1, 3000), address(2, 127), address(3, 65535) };
+    unsigned char buf[TEMP_WIRE_COMPACT_MAX];
+    size_t len = temp_wire_encode(buf, 7, TIMESTAMP, 21.5f, 300, route, 3);
+
+    temp_reading reading;
+    CHECK(temp_wire_decode(buf, len, &reading) == 0);
+    CHECK(reading.timestamp == TIMESTAMP && reading.temperature == 21.5f && reading.id == 300);
+    CHECK(reading.hops == 7 && reading.version == TEMP_WIRE_VERSION && reading.address_count == 3);
+
+    temp_wire_address list[3];
+    temp_wire_addresses(&reading, list);
+    for (int i = 0; i < 3; i++) {
+        CHECK(list[i].addr.s_addr == route[i].addr.s_addr && list[i].port == route[i].port);
+    }
+    CHECK(temp_wire_contains(&reading, route[2].addr, 65535));
+    CHECK(!temp_wire_contains(&reading, route[2].addr, 3000));
+    CHECK(!temp_wire_is_batch(buf, len));
+
+    /* no addresses at all is valid */
+    len = temp_wire_encode(buf, TEMP_WIRE_HOP_LIMIT, TIMESTAMP, -5, 0, NULL, 0);
+    CHECK(temp_wire_decode(buf, len, &reading) == 0 && reading.address_count == 0);
+}
+
+static void test_truncated(void)
+{
+    temp_wire_address route[2] = { address(1, 3000), address(2, 200) };
+    unsigned char buf[TEMP_WIRE_COMPACT_MAX];
+    size_t len = temp_wire_encode(buf, 5, TIMESTAMP, 30, 20000, route, 2);
+    temp_reading reading;
+
+    /* every prefix is missing something the header or the count promised. Each is copied to a buffer of its own
+     * size, so that a read past the end shows under a memory checker */
+    int rejected = 0;
+    for (size_t cut = 0; cut < len; cut++) {
+        unsigned char *prefix = malloc(cut ? cut : 1);
+        memcpy(prefix, buf, cut);
+        rejected += temp_wire_decode(prefix, cut, &reading) == -1;
+        free(prefix);
+    }
+    CHECK(rejected == (int)len);
+    CHECK(temp_wire_decode(buf, len, &reading) == 0);
+}
+
+static void test_malformed(void)
+{
+    unsigned char buf[TEMP_WIRE_COMPACT_MAX + 8];
+    temp_reading reading;
+    size_t len = temp_wire_encode(buf, 5, TIMESTAMP, 30, 1, NULL, 0);
+
+    /* the count is the last byte; more than TEMP_WIRE_MAX_ADDRESSES is refused before the list is looked at */
+    buf[len - 1] = TEMP_WIRE_MAX_ADDRESSES + 1;
+    CHECK(temp_wire_decode(buf, len, &reading) == -1);
+
+    /* ids are 16 bits; a varint that does not end, or ends above that, is refused */
+    len = 6 + 8 + 4;
+    memcpy(buf + len, "\xff\xff\x04\x00", 4);
+    CHECK(temp_wire_decode(buf, len + 4, &reading) == -1);
+    memcpy(buf + len, "\xff\xff\xff\xff\x00", 5);
+    CHECK(temp_wire_decode(buf, len + 5, &reading) == -1);
+    memcpy(buf + len, "\xff\xff\x03\x00", 4);
+    CHECK(temp_wire_decode(buf, len + 4, &reading) == 0 && reading.id == 0xffff);
+
+    /* a port varint running off the end of the datagram */
+    temp_wire_address one = address(1, 3000);
+    len = temp_wire_encode(buf, 5, TIMESTAMP, 30, 1, &one, 1);
+    buf[len - 1] |= 0x80;
+    CHECK(temp_wire_decode(buf, len, &reading) == -1);
+
+    /* not TEMP, or a version this decoder does not know */
+    len = temp_wire_encode(buf, 5, TIMESTAMP, 30, 1, NULL, 0);
+    buf[0] = 'X';
+    CHECK(temp_wire_decode(buf, len, &reading) == -1);
+    buf[0] = 'T';
+    buf[4] = TEMP_WIRE_VERSION + 1;
+    CHECK(temp_wire_decode(buf, len, &reading) == -1);
+    buf[4] = TEMP_WIRE_BATCH;
+    CHECK(temp_wire_decode(buf, len, &reading) == -1);
+}
+
+static void test_version_2(void)
+{
+    /* version 2 has no hop byte; it counts one hop used per address */
+    temp_wire_address route[2] = { address(1, 3000), address(2, 3001) };
+    unsigned char v3[TEMP_WIRE_COMPACT_MAX], v2[TEMP_WIRE_COMPACT_MAX];
+    size_t len = temp_wire_encode(v3, 9, TIMESTAMP, 40, 2, route, 2);
+    memcpy(v2, v3, 5);
+    v2[4] = 2;
+    memcpy(v2 + 5, v3 + 6, len - 6);
+
+    temp_reading reading;
+    CHECK(temp_wire_decode(v2, len - 1, &reading) == 0);
+    CHECK(reading.version == 2 && reading.hops == TEMP_WIRE_HOP_LIMIT - 2 && reading.id == 2);
+    CHECK(temp_wire_contains(&reading, route[1].addr, 3001));
+}
+
+static void test_legacy(void)
+{
+    struct datagram_format legacy;
+    memset(&legacy, 0, sizeof(legacy));
+    memcpy(legacy.header, "TEMP", 4);
+    legacy.timestamp.tv_sec = TIMESTAMP / 1000000;
+    legacy.timestamp.tv_usec = TIMESTAMP % 1000000;
+    legacy.temperature = 55;
+    legacy.id = 42;
+    legacy.address_count = 2;
+    legacy.address_list[0].sensor_addr = address(1, 0).addr;
+    legacy.address_list[0].sensor_port = 3000;
+    legacy.address_list[1].sensor_addr = address(2, 0).addr;
+    legacy.address_list[1].sensor_port = 3001;
+
+    temp_reading reading;
+    CHECK(temp_wire_decode(&legacy, sizeof(legacy), &reading) == 0);
+    CHECK(reading.version == TEMP_WIRE_LEGACY_VERSION && reading.timestamp == TIMESTAMP && reading.id == 42);
+    CHECK(reading.temperature == 55 && reading.address_count == 2 && reading.hops == TEMP_WIRE_HOP_LIMIT - 2);
+    CHECK(temp_wire_contains(&reading, address(2, 0).addr, 3001));
+
+    legacy.address_count = TEMP_WIRE_MAX_ADDRESSES + 1;
+    CHECK(temp_wire_decode(&legacy, sizeof(legacy), &reading) == -1);
+}
+
+static void test_append(void)
+{
+    temp_wire_address route[TEMP_WIRE_MAX_ADDRESSES];
+    for (int i = 0; i < TEMP_WIRE_MAX_ADDRESSES; i++) {
+        route[i] = address(i + 1, 1000 + i);
+    }
+    unsigned char buf[TEMP_WIRE_COMPACT_MAX];
+    temp_reading reading;
+
+    size_t len = temp_wire_encode(buf, 3, TIMESTAMP, 30, 8, route, 2);
+    CHECK(temp_wire_decode(buf, len, &reading) == 0);
+    temp_wire_address self = address(200, 40000);
+    len = temp_wire_append_address(buf, &reading, &self);
+    CHECK(reading.address_count == 3 && reading.hops == 2);
+    CHECK(temp_wire_decode(buf, len, &reading) == 0);
+    CHECK(reading.address_count == 3 && reading.hops == 2 && temp_wire_contains(&reading, self.addr, 40000));
+    CHECK(reading.temperature == 30 && reading.id == 8);
+
+    /* a full list drops its oldest entry to make room */
+    len = temp_wire_encode(buf, 3, TIMESTAMP, 30, 8, route, TEMP_WIRE_MAX_ADDRESSES);
+    CHECK(len <= TEMP_WIRE_COMPACT_MAX);
+    CHECK(temp_wire_decode(buf, len, &reading) == 0);
+    len = temp_wire_append_address(buf, &reading, &self);
+    CHECK(len <= TEMP_WIRE_COMPACT_MAX);
+    CHECK(temp_wire_decode(buf, len, &reading) == 0);
+    CHECK(reading.address_count == TEMP_WIRE_MAX_ADDRESSES);
+    CHECK(!temp_wire_contains(&reading, route[0].addr, route[0].port));
+    CHECK(temp_wire_contains(&reading, route[1].addr, route[1].port));
+    CHECK(temp_wire_contains(&reading, self.addr, 40000));
+}
+
+static void test_batch(void)
+{
+    unsigned char batch[TEMP_WIRE_BATCH_MAX], reading_buf[TEMP_WIRE_COMPACT_MAX];
+    size_t len = temp_wire_batch_start(batch);
+    temp_wire_address route = address(1, 3000);
+    int added = 0;
+    size_t added_len;
+
+    /* fill a batch until it refuses more; it never grows past TEMP_WIRE_BATCH_MAX */
+    for (;;) {
+        size_t reading_len = temp_wire_encode(reading_buf, 5, TIMESTAMP + added, 20, (uint16_t)added, &route, 1);
+        if ((added_len = temp_wire_batch_add(batch, len, reading_buf, reading_len)) == 0) {
+            break;
+        }
+        CHECK(added_len <= TEMP_WIRE_BATCH_MAX && added_len != sizeof(struct datagram_format));
+        len = added_len;
+        added++;
+    }
+    CHECK(added > 1);
+    CHECK(temp_wire_is_batch(batch, len));
+
+    size_t offset = TEMP_WIRE_BATCH_HEADER, reading_len;
+    const unsigned char *next;
+    int seen = 0;
+    while ((next = temp_wire_batch_next(batch, len, &offset, &reading_len)) != NULL) {
+        temp_reading reading;
+        CHECK(temp_wire_decode(next, reading_len, &reading) == 0 && reading.id == seen);
+        seen++;
+    }
+    CHECK(seen == added);
+
+    /* a length running past the end stops the batch there */
+    len = temp_wire_batch_start(batch);
+    size_t reading_len_one = temp_wire_encode(reading_buf, 5, TIMESTAMP, 20, 1, &route, 1);
+    len = temp_wire_batch_add(batch, len, reading_buf, reading_len_one);
+    offset = TEMP_WIRE_BATCH_HEADER;
+    CHECK(temp_wire_batch_next(batch, len - 1, &offset, &reading_len) == NULL);
+    batch[TEMP_WIRE_BATCH_HEADER] = 0x80;     /* a varint that never ends */
+    offset = TEMP_WIRE_BATCH_HEADER;
+    CHECK(temp_wire_batch_next(batch, TEMP_WIRE_BATCH_HEADER + 1, &offset, &reading_len) == NULL);
+
+    /* a batch the size of the original layout would be taken for one; padding keeps it off that size */
+    len = temp_wire_batch_start(batch);
+    unsigned char big[sizeof(struct datagram_format)];
+    memset(big, 0, sizeof(big));
+    size_t target = sizeof(struct datagram_format) - TEMP_WIRE_BATCH_HEADER - 2;
+    len = temp_wire_batch_add(batch, len, big, target);
+    CHECK(len == sizeof(struct datagram_format) + 1 && temp_wire_is_batch(batch, len));
+    offset = TEMP_WIRE_BATCH_HEADER;
+    CHECK(temp_wire_batch_next(batch, len, &offset, &reading_len) != NULL && reading_len == target);
+    CHECK(temp_wire_batch_next(batch, len, &offset, &reading_len) == NULL);
+}
+
+int main(void)
+{
+    test_round_trip();
+    test_truncated();
+    test_malformed();
+    test_version_2();
+    test_legacy();
+    test_append();
+    test_batch();
+    return test_result("test_temp_wire");
+}
@@ -0,0 +1,198 @@
+/*
+ * Loader for the overseer's connections and layout files. See topology.h for the file formats.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "topology.h"
+
+typedef struct {
+    uint32_t from;
+    uint32_t to;
+} edge;
+
+typedef struct {
+    edge *edges;
+    size_t len;
+    size_t cap;
+} edge_list;
+
+static int add_edge(edge_list *list, unsigned long from, unsigned long to)
+{
+    if (from >= TOPOLOGY_MAX_ID || to >= TOPOLOGY_MAX_ID) {
+        return 0;
+    }
+    if (list->len == list->cap) {
+        size_t cap = list->cap ? list->cap * 2 : 1024;
+        edge *grown = realloc(list->edges, cap * sizeof(*grown));
+        if (grown == NULL) {
+            return -1;
+        }
+        list->edges = grown;
+        list->cap = cap;
+    }
+    list->edges[list->len].from = (uint32_t)from;
+    list->edges[list->len].to = (uint32_t)to;
+    list->len++;
+    return 0;
+}
+
+/* Slurp a whole file into a NUL-terminated buffer */
+static char *read_file(const char *path)
+{
+    FILE *in = fopen(path, "r");
+    if (in == NULL) {
+        perror(path);
+        return NULL;
+    }
+    fseek(in, 0, SEEK_END);
+    long size = ftell(in);
+    rewind(in);
+    char *text = malloc(size + 1);
+    if (text == NULL || fread(text, 1, size, in) != (size_t)size) {
+        perror(path);
+        free(text);
+        fclose(in);
+        return NULL;
+    }
+    fclose(in);
+    text[size] = '\0';
+    return text;
+}
+
+/* "CARDREADER {reader id} DOOR {door id}" */
+static int parse_connections(char *text, edge_list *list)
+{
+    char *save = NULL;
+    for (char *line = strtok_r(text, "\n", &save); line != NULL; line = strtok_r(NULL, "\n", &save)) {
+        unsigned long reader, door;
+        if (sscanf(line, " CARDREADER %lu DOOR %lu", &reader, &door) == 2) {
+            if (add_edge(list, reader, door) == -1) {
+                return -1;
+            }
+        } else if (line[strspn(line, " \t\r")] != '\0' && line[strspn(line, " \t\r")] != '#') {
+            fprintf(stderr, "topology: ignoring connection '%s'\n", line);
+        }
+    }
+    return 0;
+}
+
+/* "ZONE {zone id} DOOR:{door id} DOOR:{door id} ..." */
+static int parse_layout(char *text, edge_list *list)
+{
+    char *line_save = NULL;
+    for (char *line = strtok_r(text, "\n", &line_save); line != NULL; line = strtok_r(NULL, "\n", &line_save)) {
+        char *save = NULL;
+        char *token = strtok_r(line, " \t\r", &save);
+        if (token == NULL || token[0] == '#') {
+            continue;
+        }
+        char *id_token = strtok_r(NULL, " \t\r", &save);
+        if (strcmp(token, "ZONE") != 0 || id_token == NULL) {
+            fprintf(stderr, "topology: ignoring layout line starting '%s'\n", token);
+            continue;
+        }
+        unsigned long zone = strtoul(id_token, NULL, 10);
+        while ((token = strtok_r(NULL, " \t\r", &save)) != NULL) {
+            if (strncmp(token, "DOOR:", 5) != 0) {
+                fprintf(stderr, "topology: zone %lu: ignoring '%s'\n", zone, token);
+                continue;
+            }
+            if (add_edge(list, zone, strtoul(token + 5, NULL, 10)) == -1) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+/* Counting sort of the edge list into CSR rows, then sort and deduplicate each (short) row in place */
+static int build_csr(const edge_list *list, csr_graph *graph)
+{
+    uint32_t node_count = 0;
+    for (size_t i = 0; i < list->len; i++) {
+        if (list->edges[i].from + 1 > node_count) {
+            node_count = list->edges[i].from + 1;
+        }
+    }
+
+    graph->node_count = node_count;
+    graph->offsets = calloc(node_count + 1, sizeof(*graph->offsets));
+    graph->targets = malloc((list->len ? list->len : 1) * sizeof(*graph->targets));
+    if (graph->offsets == NULL || graph->targets == NULL) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < list->len; i++) {
+        graph->offsets[list->edges[i].from + 1]++;
+    }
+    for (uint32_t n = 0; n < node_count; n++) {
+        graph->offsets[n + 1] += graph->offsets[n];
+    }
+    uint32_t *fill = malloc((node_count ? node_count : 1) * sizeof(*fill));
+    if (fill == NULL) {
+        return -1;
+    }
+    memcpy(fill, graph->offsets, node_count * sizeof(*fill));
+    for (size_t i = 0; i < list->len; i++) {
+        graph->targets[fill[list->edges[i].from]++] = list->edges[i].to;
+    }
+    free(fill);
+
+    uint32_t out = 0;
+    for (uint32_t n = 0; n < node_count; n++) {
+        uint32_t begin = graph->offsets[n], end = graph->offsets[n + 1];
+        uint32_t *row = graph->targets + begin;
+        for (uint32_t i = 1; i < end - begin; i++) {
+            uint32_t value = row[i], j = i;
+            while (j > 0 && row[j - 1] > value) {
+                row[j] = row[j - 1];
+                j--;
+            }
+            row[j] = value;
+        }
+        graph->offsets[n] = out;
+        for (uint32_t i = begin; i < end; i++) {
+            if (i == begin || graph->targets[i] != graph->targets[i - 1]) {
+                graph->targets[out++] = graph->targets[i];
+            }
+        }
+    }
+    graph->offsets[node_count] = out;
+    graph->edge_count = out;
+    return 0;
+}
+
+int topology_load(const char *connections_path, const char *layout_path, topology *topo)
+{
+    memset(topo, 0, sizeof(*topo));
+    edge_list readers = { 0 }, zones = { 0 };
+    int result = -1;
+
+    char *connections = read_file(connections_path);
+    char *layout = read_file(layout_path);
+    if (connections != NULL && layout != NULL
+        && parse_connections(connections, &readers) == 0 && parse_layout(layout, &zones) == 0
+        && build_csr(&readers, &topo->reader_doors) == 0 && build_csr(&zones, &topo->zone_doors) == 0) {
+        result = 0;
+    }
+
+    free(connections);
+    free(layout);
+    free(readers.edges);
+    free(zones.edges);
+    if (result == -1) {
+        topology_free(topo);
+    }
+    return result;
+}
+
+void topology_free(topology *topo)
+{
+    free(topo->reader_doors.offsets);
+    free(topo->reader_doors.targets);
+    free(topo->zone_doors.offsets);
+    free(topo->zone_doors.targets);
+    memset(topo, 0, sizeof(*topo));
+}
@@ -0,0 +1,47 @@
+/*
+ * Site topology used by the overseer, loaded once from the connections and layout files.
+ *
+ * Connections file, one line per link: "CARDREADER {card reader id} DOOR {door id}"
+ * Layout file, one line per fire zone:  "ZONE {zone id} DOOR:{door id} DOOR:{door id} ..."
+ *
+ * Both relations are stored in compressed sparse row form indexed directly by device id, so the doors behind a
+ * card reader or a fire zone are one contiguous slice of a flat array.
+*/
+
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <stdint.h>
+
+#define TOPOLOGY_MAX_ID (1u << 24)
+
+/* Compressed sparse row adjacency. The neighbours of node n are targets[offsets[n]] .. targets[offsets[n + 1] - 1] */
+typedef struct {
+    uint32_t node_count;    /* one past the largest id that has an entry */
+    uint32_t edge_count;
+    uint32_t *offsets;      /* node_count + 1 entries */
+    uint32_t *targets;      /* edge_count entries, sorted and unique per node */
+} csr_graph;
+
+typedef struct {
+    csr_graph reader_doors; /* card reader id -> doors it controls */
+    csr_graph zone_doors;   /* fire zone id -> every door listed in that zone */
+} topology;
+
+/* Load both files. Returns 0, or -1 if either file cannot be read */
+int topology_load(const char *connections_path, const char *layout_path, topology *topo);
+
+void topology_free(topology *topo);
+
+/* Neighbours of id, or an empty slice if id is out of range */
+static inline const uint32_t *csr_neighbours(const csr_graph *graph, uint32_t id, uint32_t *count)
+{
+    if (id >= graph->node_count) {
+        *count = 0;
+        return graph->targets;
+    }
+    *count = graph->offsets[id + 1] - graph->offsets[id];
+    return graph->targets + graph->offsets[id];
+}
+
+#endif
@@ -0,0 +1,103 @@
+/*
+ * UDP sinks standing in for many tempsensor receivers.
+ * Opens {sinks} sockets and counts the datagrams each receives for {seconds}. Given a unicast address:port, the
+ * sinks are bound to consecutive ports from it; given a multicast group:port, every sink is bound to the group and
+ * joins it on the loopback interface, as tempsensors on 127.0.0.1 would. At the end it prints how many datagrams the
+ * sinks received, so a run that lost datagrams shows.
+*/
+
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "tcp_communication.h"
+
+#define MAX_SINKS 1024
+
+static long long now_usec(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static int open_sink(const struct sockaddr_in *addr, int group)
+{
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    int on = 1;
+    if (fd == -1 || (group && setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) == -1)
+        || bind(fd, (const struct sockaddr *)addr, sizeof(*addr)) == -1) {
+        perror("udp_sinks: bind()");
+        exit(1);
+    }
+    if (group) {
+        struct ip_mreq membership = { .imr_multiaddr = addr->sin_addr };
+        membership.imr_interface.s_addr = htonl(INADDR_LOOPBACK);
+        if (setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership)) == -1) {
+            perror("udp_sinks: joining the group");
+            exit(1);
+        }
+    }
+    return fd;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 4) {
+        fprintf(stderr, "usage: udp_sinks {address:first port | group:port} {sinks} {seconds}\n");
+        exit(1);
+    }
+    struct sockaddr_in addr;
+    if (tcp_parse_address(argv[1], &addr) < 0) {
+        fprintf(stderr, "udp_sinks: address should be in the format ip:port\n");
+        exit(1);
+    }
+    int count = atoi(argv[2]);
+    double seconds = atof(argv[3]);
+    int group = IN_MULTICAST(ntohl(addr.sin_addr.s_addr));
+    if (count < 1 || count > MAX_SINKS || seconds <= 0 || (!group && ntohs(addr.sin_port) + count > 65536)) {
+        fprintf(stderr, "udp_sinks: between 1 and %d sinks, on ports below 65536, for a positive time\n", MAX_SINKS);
+        exit(1);
+    }
+
+    static struct pollfd sinks[MAX_SINKS];
+    static long received[MAX_SINKS];
+    for (int i = 0; i < count; i++) {
+        struct sockaddr_in sink = addr;
+        if (!group) {
+            sink.sin_port = htons(ntohs(addr.sin_port) + i);
+        }
+        sinks[i].fd = open_sink(&sink, group);
+        sinks[i].events = POLLIN;
+    }
+
+    char buf[65536];
+    long long end = now_usec() + (long long)(seconds * 1e6);
+    for (long long now = now_usec(); now < end; now = now_usec()) {
+        if (poll(sinks, count, (int)((end - now + 999) / 1000)) <= 0) {
+            continue;
+        }
+        for (int i = 0; i < count; i++) {
+            if (sinks[i].revents & POLLIN) {
+                while (recv(sinks[i].fd, buf, sizeof(buf), MSG_DONTWAIT) >= 0) {
+                    received[i]++;
+                }
+            }
+        }
+    }
+
+    long total = 0, fewest = received[0], most = received[0];
+    for (int i = 0; i < count; i++) {
+        total += received[i];
+        fewest = received[i] < fewest ? received[i] : fewest;
+        most = received[i] > most ? received[i] : most;
+    }
+    printf("udp_sinks: %d %s received %ld datagrams, %ld to %ld each\n", count, group ? "group members" : "sinks",
+           total, fewest, most);
+    return 0;
+}